@@ -24,6 +24,9 @@ using namespace glm;
 #include <map>
 #include "bmaploader.hpp"
 #include "TriTable.hpp"
+#include "Fields.hpp"
+#include "MarchingCubes.hpp"
+#include "MeshUtils.hpp"
 //#include "shader.h"
 #include "shader.hpp"
 
@@ -581,27 +584,6 @@ public:
 };
 
 
-float f1(float x, float y, float z) {
-    return x*x + y*y + z*z;
-}
-
-float f2(float x, float y, float z) {
-    return sin(x*y*z);
-}
-
-float f3(float x, float y, float z) {
-    return sin(x)*cos(y)*sin(z);
-}
-
-float f4(float x, float y, float z) {
-	return y - sin(x)*cos(z);
-}
-
-float f5(float x, float y, float z) {
-	return x*x - y*y - z*z - z;
-}
-
-
 void render (std::vector<float> vertices, std::vector<float> normalVertices, glm::mat4 MVP) {
 
     // create shader for object
@@ -704,139 +686,6 @@ void render (std::vector<float> vertices, std::vector<float> normalVertices, glm
 }
 
 
-std::vector<float> marching_cubes(
-        std::function<float(float, float, float)> f,
-        float isovalue,
-        float min,
-        float max,
-        float stepsize)
-{
-    // Compute the number of steps in each direction
-    int nsteps = static_cast<int>((max - min) / stepsize);
-
-    // Allocate memory for the vertices
-    std::vector<float> vertices;
-
-    // Loop over all cubes in the grid
-    for (int i = 0; i < nsteps; ++i)
-    {
-        for (int j = 0; j < nsteps; ++j)
-        {
-            for (int k = 0; k < nsteps; ++k)
-            {
-                // Compute the position of the current cube
-                float x0 = min + i * stepsize;
-                float y0 = min + j * stepsize;
-                float z0 = min + k * stepsize;
-
-                // Compute the isosurface crossings of the current cube
-                int cubeindex = 0;
-                std::array<float, 8> vals;
-                std::array<std::array<float, 3>, 8> verts;
-
-                vals[0] = f(x0, y0, z0);
-                vals[1] = f(x0 + stepsize, y0, z0);
-                vals[2] = f(x0 + stepsize, y0, z0 + stepsize);
-                vals[3] = f(x0, y0, z0 + stepsize);
-                vals[4] = f(x0, y0 + stepsize, z0);
-                vals[5] = f(x0 + stepsize, y0 + stepsize, z0);
-                vals[6] = f(x0 + stepsize, y0 + stepsize, z0 + stepsize);
-                vals[7] = f(x0, y0 + stepsize, z0 + stepsize);
-
-                if (vals[0] < isovalue) cubeindex |= 1;
-                if (vals[1] < isovalue) cubeindex |= 2;
-                if (vals[2] < isovalue) cubeindex |= 4;
-                if (vals[3] < isovalue) cubeindex |= 8;
-                if (vals[4] < isovalue) cubeindex |= 16;
-                if (vals[5] < isovalue) cubeindex |= 32;
-                if (vals[6] < isovalue) cubeindex |= 64;
-                if (vals[7] < isovalue) cubeindex |= 128;
-
-                // Use the LUTs to generate the vertices for the current cube
-                for (int l = 0; marching_cubes_lut[cubeindex][l] != -1; l += 3)
-                {
-                    int edge0 = marching_cubes_lut[cubeindex][l];
-                    int edge1 = marching_cubes_lut[cubeindex][l + 1];
-                    int edge2 = marching_cubes_lut[cubeindex][l + 2];
-
-                    float x1 = x0 + vertTable[edge0][0] * stepsize;
-                    float y1 = y0 + vertTable[edge0][1] * stepsize;
-                    float z1 = z0 + vertTable[edge0][2] * stepsize;
-                    float x2 = x0 + vertTable[edge1][0] * stepsize;
-                    float y2 = y0 + vertTable[edge1][1] * stepsize;
-                    float z2 = z0 + vertTable[edge1][2] * stepsize;
-
-                    float x3 = x0 + vertTable[edge2][0] * stepsize;
-                    float y3 = y0 + vertTable[edge2][1] * stepsize;
-                    float z3 = z0 + vertTable[edge2][2] * stepsize;
-
-                    vertices.push_back(x1);
-                    vertices.push_back(y1);
-                    vertices.push_back(z1);
-
-                    vertices.push_back(x2);
-                    vertices.push_back(y2);
-                    vertices.push_back(z2);
-
-                    vertices.push_back(x3);
-                    vertices.push_back(y3);
-                    vertices.push_back(z3);
-                }
-            }
-        }
-    }
-    return vertices;
-}
-
-std::vector<float> compute_normals(const std::vector<float>& vertices) {
-    std::vector<float> normals(vertices.size(), 0.0f);
-    for (int i = 0; i < vertices.size(); i += 9) {
-        glm::vec3 v0(vertices[i], vertices[i + 1], vertices[i + 2]);
-        glm::vec3 v1(vertices[i + 3], vertices[i + 4], vertices[i + 5]);
-        glm::vec3 v2(vertices[i + 6], vertices[i + 7], vertices[i + 8]);
-        glm::vec3 e1 = v1 - v0;
-        glm::vec3 e2 = v2 - v0;
-        glm::vec3 normal = glm::normalize(glm::cross(e1, e2));
-        normals[i] = normal.x;
-        normals[i + 1] = normal.y;
-        normals[i + 2] = normal.z;
-        normals[i + 3] = normal.x;
-        normals[i + 4] = normal.y;
-        normals[i + 5] = normal.z;
-        normals[i + 6] = normal.x;
-        normals[i + 7] = normal.y;
-        normals[i + 8] = normal.z;
-    }
-    return normals;
-}
-
-
-void writePLY(const std::vector<float>& vertices, const std::vector<float>& normals, const std::string& fileName) {
-    std::ofstream file(fileName);
-    file << "ply\n";
-    file << "format ascii 1.0\n";
-    file << "element vertex " << vertices.size() / 3 << "\n";
-    file << "property float x\n";
-    file << "property float y\n";
-    file << "property float z\n";
-    file << "property float nx\n";
-    file << "property float ny\n";
-    file << "property float nz\n";
-    file << "element face " << vertices.size() / 9 << "\n";
-    file << "property list uchar int vertex_indices\n";
-    file << "end_header\n";
-    for (int i = 0; i < vertices.size(); i += 3) {
-        file << vertices[i] << " " << vertices[i + 1] << " " << vertices[i + 2] << " ";
-        file << normals[i] << " " << normals[i + 1] << " " << normals[i + 2] << "\n";
-    }
-    for (int i = 0; i < vertices.size(); i += 9) {
-        file << "3 " << i / 3 << " " << i / 3 + 1 << " " << i / 3 + 2 << "\n";
-    }
-    file.close();
-}
-
-
-
 int main() {
 	// Initializes GLFW
 	if( !glfwInit() )
@@ -889,15 +738,22 @@ int main() {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS);
 
+    // extract on every hardware thread
+    MCOptions mcOptions;
+    mcOptions.threads = 0;
+    mcOptions.placement = MCOptions::LINEAR;
+
+    // smooth normals from the field gradient, computed while extracting
+    std::vector<float> normals;
     std::vector<float> vertices = marching_cubes(
-        f5,
+        Field5(),
         -1.5,
         min,
         max,
-        stepsize);
+        stepsize,
+        normals,
+        mcOptions);
 
-    
-    std::vector<float> normals = compute_normals(vertices);
     glm::vec3 lightpos(5.0f, 5.0f, 5.0f);
     /*writePLY(vertices, normalVertices, "F1.ply");
     
@@ -23,6 +23,17 @@ using namespace glm;
 #include <vector>
 #include <map>
 #include "TriTable.hpp"
+#include "Fields.hpp"
+#include "MarchingCubes.hpp"
+#include "MeshUtils.hpp"
+#include "SpanSpace.hpp"
+#include "DualContouring.hpp"
+#include "Decimate.hpp"
+#include "LevelOfDetail.hpp"
+#include "AsyncExtraction.hpp"
+#include "Expression.hpp"
+#include "BrickMesher.hpp"
+#include "GLSoup.hpp"
 //#include "shader.h"
 #include "shader.hpp"
 
@@ -96,12 +107,51 @@ Camera camera(glm::vec3(5, 5, 5), glm::vec3(0, 0, 0));
 bool dragging = false;
 double lastXPos, lastYPos;
 
+// isovalue of the surface, changed with [ and ]
+float isovalue = -1.5f;
+bool isovalueChanged = false;
+
+// extraction method, cycled with M: marching cubes, surface nets, dual contouring
+int extractionMethod = 0;
+
+// whether to decimate the extracted mesh to a quarter of its triangles, toggled with D
+bool decimating = false;
+
+// whether to extract at four times the resolution near the camera and coarser away from
+// it, toggled with L
+bool levelOfDetail = false;
+
+// whether to sweep the isovalue back and forth, re-extracting as fast as the worker can,
+// toggled with T
+bool animating = false;
+
+// whether to extract the marching cubes soup on the render thread straight into mapped GPU
+// buffers instead of building meshes on the worker and uploading them, toggled with G
+bool mappedSoup = false;
+
+// whether to sculpt the field, toggled with S: a right click raises the surface under the
+// cursor and a shift right click carves it, and only the bricks an edit reaches are
+// extracted again and spliced into the GPU buffers
+bool sculpting = false;
+bool editPending = false;
+double editX, editY;
+float editSign = 1;
+
+// whether to extract at four times the resolution on the render thread a few bricks per
+// frame, drawing the bricks done so far, toggled with P. Sculpting extracts the same way.
+bool progressive = false;
+
 // Callbacks
 static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 static void cursorPositionCallback(GLFWwindow* window, double xpos, double ypos);
 static void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+    if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS && sculpting) {
+        glfwGetCursorPos(window, &editX, &editY);
+        editSign = (mods & GLFW_MOD_SHIFT) ? 1.0f : -1.0f;
+        editPending = true;
+    }
     if (button == GLFW_MOUSE_BUTTON_LEFT) {
         if (action == GLFW_PRESS) {
             dragging = true;
@@ -134,6 +184,37 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
     if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
         camera.updateRadius(0.1f);
     }
+    if (action != GLFW_RELEASE && (key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET)) {
+        isovalue += key == GLFW_KEY_LEFT_BRACKET ? -0.1f : 0.1f;
+        isovalueChanged = true;
+    }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+        extractionMethod = (extractionMethod + 1) % 3;
+        isovalueChanged = true;
+    }
+    if (key == GLFW_KEY_D && action == GLFW_PRESS) {
+        decimating = !decimating;
+        isovalueChanged = true;
+    }
+    if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        levelOfDetail = !levelOfDetail;
+        isovalueChanged = true;
+    }
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        animating = !animating;
+    }
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        mappedSoup = !mappedSoup;
+        isovalueChanged = true;
+    }
+    if (key == GLFW_KEY_S && action == GLFW_PRESS) {
+        sculpting = !sculpting;
+        isovalueChanged = true;
+    }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        progressive = !progressive;
+        isovalueChanged = true;
+    }
 }
 
 
@@ -251,27 +332,6 @@ void processInput (GLFWwindow* window) {
 }
 
 
-float f1(float x, float y, float z) {
-    return x*x + y*y + z*z;
-}
-
-float f2(float x, float y, float z) {
-    return sin(x*y*z);
-}
-
-float f3(float x, float y, float z) {
-    return sin(x)*cos(y)*sin(z);
-}
-
-float f4(float x, float y, float z) {
-	return y - sin(x)*cos(z);
-}
-
-float f5(float x, float y, float z) {
-	return x*x - y*y - z*z - z;
-}
-
-
 void render (std::vector<float> vertices, std::vector<float> normalVertices, glm::mat4 MVP) {
 
     // create shader for object
@@ -373,137 +433,21 @@ void render (std::vector<float> vertices, std::vector<float> normalVertices, glm
     //glDeleteBuffers(1, &vboNormals);
 }
 
-std::vector<float> marching_cubes(
-        std::function<float(float, float, float)> f,
-        float isovalue,
-        float min,
-        float max,
-        float stepsize)
-{
-    // Compute the number of steps in each direction
-    int nsteps = static_cast<int>((max - min) / stepsize);
-
-    // Allocate memory for the vertices
-    std::vector<float> vertices;
-
-    // Loop over all cubes in the grid
-    for (int i = 0; i < nsteps; ++i)
-    {
-        for (int j = 0; j < nsteps; ++j)
-        {
-            for (int k = 0; k < nsteps; ++k)
-            {
-                // Compute the position of the current cube
-                float x0 = min + i * stepsize;
-                float y0 = min + j * stepsize;
-                float z0 = min + k * stepsize;
-
-                // Compute the isosurface crossings of the current cube
-                int cubeindex = 0;
-                std::array<float, 8> vals;
-                std::array<std::array<float, 3>, 8> verts;
-
-                vals[0] = f(x0, y0, z0);
-                vals[1] = f(x0 + stepsize, y0, z0);
-                vals[2] = f(x0 + stepsize, y0, z0 + stepsize);
-                vals[3] = f(x0, y0, z0 + stepsize);
-                vals[4] = f(x0, y0 + stepsize, z0);
-                vals[5] = f(x0 + stepsize, y0 + stepsize, z0);
-                vals[6] = f(x0 + stepsize, y0 + stepsize, z0 + stepsize);
-                vals[7] = f(x0, y0 + stepsize, z0 + stepsize);
-
-                if (vals[0] < isovalue) cubeindex |= 1;
-                if (vals[1] < isovalue) cubeindex |= 2;
-                if (vals[2] < isovalue) cubeindex |= 4;
-                if (vals[3] < isovalue) cubeindex |= 8;
-                if (vals[4] < isovalue) cubeindex |= 16;
-                if (vals[5] < isovalue) cubeindex |= 32;
-                if (vals[6] < isovalue) cubeindex |= 64;
-                if (vals[7] < isovalue) cubeindex |= 128;
-
-                // Use the LUTs to generate the vertices for the current cube
-                for (int l = 0; marching_cubes_lut[cubeindex][l] != -1; l += 3)
-                {
-                    int edge0 = marching_cubes_lut[cubeindex][l];
-                    int edge1 = marching_cubes_lut[cubeindex][l + 1];
-                    int edge2 = marching_cubes_lut[cubeindex][l + 2];
-
-                    float x1 = x0 + vertTable[edge0][0] * stepsize;
-                    float y1 = y0 + vertTable[edge0][1] * stepsize;
-                    float z1 = z0 + vertTable[edge0][2] * stepsize;
-                    float x2 = x0 + vertTable[edge1][0] * stepsize;
-                    float y2 = y0 + vertTable[edge1][1] * stepsize;
-                    float z2 = z0 + vertTable[edge1][2] * stepsize;
-
-                    float x3 = x0 + vertTable[edge2][0] * stepsize;
-                    float y3 = y0 + vertTable[edge2][1] * stepsize;
-                    float z3 = z0 + vertTable[edge2][2] * stepsize;
-
-                    vertices.push_back(x1);
-                    vertices.push_back(y1);
-                    vertices.push_back(z1);
-
-                    vertices.push_back(x2);
-                    vertices.push_back(y2);
-                    vertices.push_back(z2);
-
-                    vertices.push_back(x3);
-                    vertices.push_back(y3);
-                    vertices.push_back(z3);
-                }
-            }
-        }
-    }
-    return vertices;
-}
-
-std::vector<float> compute_normals(const std::vector<float>& vertices) {
-    std::vector<float> normals(vertices.size(), 0.0f);
-    for (int i = 0; i < vertices.size(); i += 9) {
-        glm::vec3 v0(vertices[i], vertices[i + 1], vertices[i + 2]);
-        glm::vec3 v1(vertices[i + 3], vertices[i + 4], vertices[i + 5]);
-        glm::vec3 v2(vertices[i + 6], vertices[i + 7], vertices[i + 8]);
-        glm::vec3 e1 = v1 - v0;
-        glm::vec3 e2 = v2 - v0;
-        glm::vec3 normal = glm::normalize(glm::cross(e1, e2));
-        normals[i] = normal.x;
-        normals[i + 1] = normal.y;
-        normals[i + 2] = normal.z;
-        normals[i + 3] = normal.x;
-        normals[i + 4] = normal.y;
-        normals[i + 5] = normal.z;
-        normals[i + 6] = normal.x;
-        normals[i + 7] = normal.y;
-        normals[i + 8] = normal.z;
-    }
-    return normals;
-}
-
-void writePLY(const std::vector<float>& vertices, const std::vector<float>& normals, const std::string& fileName) {
-    std::ofstream file(fileName);
-    file << "ply\n";
-    file << "format ascii 1.0\n";
-    file << "element vertex " << vertices.size() / 3 << "\n";
-    file << "property float x\n";
-    file << "property float y\n";
-    file << "property float z\n";
-    file << "property float nx\n";
-    file << "property float ny\n";
-    file << "property float nz\n";
-    file << "element face " << vertices.size() / 9 << "\n";
-    file << "property list uchar int vertex_indices\n";
-    file << "end_header\n";
-    for (int i = 0; i < vertices.size(); i += 3) {
-        file << vertices[i] << " " << vertices[i + 1] << " " << vertices[i + 2] << " ";
-        file << normals[i] << " " << normals[i + 1] << " " << normals[i + 2] << "\n";
+// ./a.out ["expression"] [isovalue] extracts the given field of x, y and z instead of f5
+int main(int argc, char* argv[]) {
+    MCExpression expression;
+    std::string expressionError;
+    bool custom = argc > 1;
+    if (custom && !expression.compile(argv[1], &expressionError)) {
+        fprintf(stderr, "%s: %s\n", argv[1], expressionError.c_str());
+        return -1;
     }
-    for (int i = 0; i < vertices.size(); i += 9) {
-        file << "3 " << i / 3 << " " << i / 3 + 1 << " " << i / 3 + 2 << "\n";
+    if (argc > 2) {
+        isovalue = atof(argv[2]);
+    } else if (custom) {
+        isovalue = 0;
     }
-    file.close();
-}
 
-int main() {
 	// Initializes GLFW
 	if( !glfwInit() )
 	{
@@ -555,15 +499,59 @@ int main() {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS);
 
-    std::vector<float> vertices = marching_cubes(
-        f5,
-        -1.5,
-        min,
-        max,
-        stepsize);
+    // extract on every hardware thread
+    MCOptions mcOptions;
+    mcOptions.threads = 0;
+    mcOptions.placement = MCOptions::LINEAR;
+    mcOptions.normals = true;
+
+    // sample the field once, so the surface can be re-extracted from the blocks it
+    // passes through whenever the isovalue changes
+    MCSpanIndex spanIndex = custom ? mc_build_span_index(expression, min, max, stepsize, mcOptions)
+                                   : mc_build_span_index(Field5(), min, max, stepsize, mcOptions);
+
+    // welded mesh with gradient normals, so shared vertices are uploaded once
+    // level of detail meshes are marching cubes around the camera position they were made for
+    MCOptions lodOptions = mcOptions;
+    lodOptions.blockSize = 16;
+    float lodStepsize = stepsize / 4;
+    glm::vec3 lodEye = camera.getPosition();
+
+    // extraction job for the current settings, simplified between extraction and upload when
+    // decimating. The settings are copied, as the callbacks keep changing them while the
+    // worker runs.
+    auto extractJob = [&]() -> std::function<MCMesh()> {
+        float iso = isovalue;
+        int method = extractionMethod;
+        bool simplify = decimating;
+        bool lod = levelOfDetail;
+        float viewpoint[3] = { lodEye.x, lodEye.y, lodEye.z };
+        return [=, &spanIndex, &expression]() {
+            MCMesh mesh;
+            if (lod && custom) {
+                mesh = marching_cubes_lod(expression, iso, min, max, lodStepsize, viewpoint, lodOptions);
+            } else if (lod) {
+                mesh = marching_cubes_lod(Field5(), iso, min, max, lodStepsize, viewpoint, lodOptions);
+            } else if (method == 1) {
+                mesh = surface_nets(spanIndex, iso, mcOptions);
+            } else if (method == 2) {
+                mesh = dual_contouring(spanIndex, iso, mcOptions);
+            } else {
+                mesh = marching_cubes_indexed(spanIndex, iso, mcOptions);
+            }
+            if (simplify) {
+                mesh = decimate(mesh, mesh.indices.size() / 12);
+            }
+            return mesh;
+        };
+    };
+
+    // the next mesh is extracted in the background while the last one is drawn
+    MCAsyncExtractor extractor;
+    extractor.request(extractJob());
+    MCMesh mesh;
+
 
-    
-    std::vector<float> normals = compute_normals(vertices);
     glm::vec3 lightpos(5.0f, 5.0f, 5.0f);
 
     // initializes model-view-projection matrix
@@ -571,7 +559,86 @@ int main() {
     GLuint shaderProgram =  LoadShaders("PhongShader.vert", "PhongShader.frag");
     
 
-    GLuint VBO, VAO, NBO;
+    // two sets of buffers: a new mesh is uploaded into the set not drawn last frame, and
+    // drawn from the next frame on
+    GLuint VAO[2], VBO[2], NBO[2], EBO[2];
+    GLsizei indexCount[2] = { 0, 0 };
+    int front = 0;
+    glGenVertexArrays(2, VAO);
+    glGenBuffers(2, VBO);
+    glGenBuffers(2, NBO);
+    glGenBuffers(2, EBO);
+    for (int b = 0; b < 2; ++b) {
+        glBindVertexArray(VAO[b]);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO[b]);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, NBO[b]);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[b]);
+    }
+    glBindVertexArray(0);
+
+    // buffers the soup is extracted into directly
+    MCGLSoup soup;
+    soup.create();
+
+    // the field with the edits made so far, kept per brick of 16^3 cells so an edit only
+    // re-extracts the bricks it reaches
+    MCSculptedField<Field5> sculptedField;
+    MCSculptedField<MCExpression> sculptedExpression(expression);
+    MCOptions sculptOptions = mcOptions;
+    sculptOptions.cull = true;
+    MCBrickMesher mesher;
+    MCGLBrickSoup brickSoup;
+    brickSoup.create();
+
+    // bricks are extracted for at most a quarter of a 60 Hz frame each frame, and the
+    // latency runs from the reset or edit until none are left
+    const double frameBudgetMs = 4;
+    double brickStart = 0;
+
+    // adds an edit where the ray from the camera through the cursor first crosses the
+    // isovalue, and extracts as many of the dirty bricks as fit in the frame budget
+    auto sculpt = [&](auto& field, glm::mat4 V, glm::mat4 Projection) {
+        if (editPending) {
+            glm::vec4 viewport(0, 0, screenW, screenH);
+            glm::vec3 nearPoint = glm::unProject(glm::vec3(editX, screenH - editY, 0), V, Projection, viewport);
+            glm::vec3 farPoint = glm::unProject(glm::vec3(editX, screenH - editY, 1), V, Projection, viewport);
+            glm::vec3 direction = glm::normalize(farPoint - nearPoint);
+            glm::vec3 eye = camera.getPosition();
+            bool inside = false, below = false;
+            for (float t = 0; t < 4 * (max - min); t += 0.5f * stepsize) {
+                glm::vec3 p = eye + direction * t;
+                if (p.x < min || p.y < min || p.z < min || p.x > max || p.y > max || p.z > max) {
+                    if (inside) {
+                        break;
+                    }
+                    continue;
+                }
+                bool b = field(p.x, p.y, p.z) < isovalue;
+                if (inside && b != below) {
+                    float lo[3], hi[3];
+                    field.add(p.x, p.y, p.z, 0.5f, editSign, lo, hi);
+                    mesher.mark(lo, hi);
+                    break;
+                }
+                inside = true;
+                below = b;
+            }
+            editPending = false;
+        }
+        mesher.update(field, frameBudgetMs);
+        brickSoup.update(mesher);
+    };
+
+    // frame time and mesh generation latency, shown in the window title
+    double lastFrame = glfwGetTime();
+    double lastTitle = lastFrame;
+    double frameMs = 0;
+    double latencyMs = 0;
+    int frames = 0;
 
     // Initialize LightDir vector
     glm::vec3 lightDir = glm::normalize(glm::vec3(5.0f, 5.0f, 5.0f));
@@ -593,6 +660,65 @@ int main() {
         // Sets the projection matrix
         glm::mat4 Projection = glm::perspective(glm::radians(45.0f), (float)screenW / (float)screenH, 0.1f, 1000.0f);
 
+        // sculpting and progressive extraction run on the render thread, a few bricks a
+        // frame. A new isovalue starts every brick over, and the bricks not reached yet keep
+        // drawing the last surface.
+        bool bricked = sculpting || progressive;
+        if (bricked && (isovalueChanged || editPending || mesher.pending() > 0)) {
+            if (isovalueChanged || mesher.pending() == 0) {
+                brickStart = glfwGetTime();
+            }
+            if (isovalueChanged) {
+                mesher.reset(isovalue, min, max, progressive ? lodStepsize : stepsize, sculptOptions);
+                isovalueChanged = false;
+            }
+            if (custom) {
+                sculpt(sculptedExpression, V, Projection);
+            } else {
+                sculpt(sculptedField, V, Projection);
+            }
+            if (mesher.pending() == 0) {
+                latencyMs = (glfwGetTime() - brickStart) * 1000;
+            }
+        }
+
+        // refine around the camera again once it has moved by a block of the finest level
+        if (levelOfDetail && glm::length(camera.getPosition() - lodEye) > lodOptions.blockSize * lodStepsize) {
+            isovalueChanged = true;
+        }
+        // the next isovalue of the sweep as soon as the worker is free
+        if (animating && !(bricked ? mesher.pending() > 0 : extractor.busy())) {
+            isovalue = -1.5f + 1.5f * sinf(glfwGetTime());
+            isovalueChanged = true;
+        }
+        if (isovalueChanged && mappedSoup) {
+            double start = glfwGetTime();
+            soup.update([&](auto allocate) {
+                return marching_cubes_into(spanIndex, isovalue, allocate, mcOptions);
+            });
+            latencyMs = (glfwGetTime() - start) * 1000;
+            isovalueChanged = false;
+        }
+        if (isovalueChanged) {
+            lodEye = camera.getPosition();
+            extractor.request(extractJob());
+            isovalueChanged = false;
+        }
+        if (extractor.poll(mesh, &latencyMs)) {
+            int back = 1 - front;
+            glBindVertexArray(VAO[back]);
+            glBindBuffer(GL_ARRAY_BUFFER, VBO[back]);
+            glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(float), mesh.vertices.data(), GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, NBO[back]);
+            glBufferData(GL_ARRAY_BUFFER, mesh.normals.size() * sizeof(float), mesh.normals.data(), GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[back]);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(uint32_t), mesh.indices.data(), GL_DYNAMIC_DRAW);
+            glBindVertexArray(0);
+            indexCount[back] = mesh.indices.size();
+            front = back;
+            mesh = MCMesh();
+        }
+
         // Loads the projection matrix onto the projection matrix stack
         glMatrixMode(GL_PROJECTION);
         glPushMatrix();
@@ -610,24 +736,6 @@ int main() {
         MVP = Projection * V * M;
 
 
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &NBO);
-        glBindVertexArray(VAO);
-
-
-
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_DYNAMIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, NBO);
-        glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), normals.data(), GL_DYNAMIC_DRAW);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(1);
-
-
         // use the shader program
         glUseProgram(shaderProgram);
 
@@ -656,16 +764,16 @@ int main() {
         // Set the value of enableLighting to true for rendering the object
         glUniform1i(glGetUniformLocation(shaderProgram, "enableLighting"), 1);
 
-        // draw the triangles
-        glBindVertexArray(VAO);
-        // draw triangles using VAO
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, vertices.size() / 3);
-
-        // cleanup
-        glDeleteVertexArrays(1, &VAO);
-        glDeleteBuffers(1, &VBO);
-        glDeleteBuffers(1, &NBO);
+        // draw the triangles of the newest mesh
+        if (bricked) {
+            brickSoup.draw();
+        } else if (mappedSoup) {
+            soup.draw();
+        } else {
+            glBindVertexArray(VAO[front]);
+            glDrawElements(GL_TRIANGLES, indexCount[front], GL_UNSIGNED_INT, (void*)0);
+            glBindVertexArray(0);
+        }
 
         // Set the value of enableLighting to false for rendering the axes and cube
         glUniform1i(glGetUniformLocation(shaderProgram, "enableLighting"), 0);
@@ -686,11 +794,33 @@ int main() {
         // Swap the front and back buffers
         glfwSwapBuffers(window);
 
+        double now = glfwGetTime();
+        frameMs += (now - lastFrame) * 1000;
+        lastFrame = now;
+        ++frames;
+        if (now - lastTitle > 0.5) {
+            char title[128];
+            snprintf(title, sizeof(title), "Phong Shader - frame %.1f ms, mesh latency %.1f ms, %d triangles",
+                     frameMs / frames, latencyMs,
+                     bricked ? (int)brickSoup.triangles() : mappedSoup ? soup.vertexCount / 3 : indexCount[front] / 3);
+            glfwSetWindowTitle(window, title);
+            frameMs = 0;
+            frames = 0;
+            lastTitle = now;
+        }
+
 
 	} // Checks if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 		   glfwWindowShouldClose(window) == 0 );
 
+	glDeleteVertexArrays(2, VAO);
+	glDeleteBuffers(2, VBO);
+	glDeleteBuffers(2, NBO);
+	glDeleteBuffers(2, EBO);
+	soup.destroy();
+	brickSoup.destroy();
+
 	// Closes OpenGL window and terminates GLFW
 	glfwTerminate();
 
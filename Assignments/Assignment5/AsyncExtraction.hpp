@@ -0,0 +1,105 @@
+#ifndef ASYNCEXTRACTION_HPP
+#define ASYNCEXTRACTION_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "MarchingCubes.hpp"
+
+// Builds meshes on a background thread, so the render loop keeps drawing the last one while
+// the next is extracted. A request made while another is still waiting replaces it, so
+// after a burst of requests only the latest runs. The job is called on the worker thread
+// and must not touch state the caller keeps changing; capture copies instead.
+struct MCAsyncExtractor {
+    MCAsyncExtractor() : worker([this]() { run(); }) {}
+
+    ~MCAsyncExtractor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    MCAsyncExtractor(const MCAsyncExtractor&) = delete;
+    MCAsyncExtractor& operator=(const MCAsyncExtractor&) = delete;
+
+    // Queues job, replacing any request that has not started yet
+    void request(std::function<MCMesh()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = std::move(job);
+            pendingSince = std::chrono::steady_clock::now();
+        }
+        wake.notify_one();
+    }
+
+    // Moves the newest finished mesh into mesh and returns true, or returns false when none
+    // finished since the last call. latencyMs receives the time from its request to the end
+    // of its extraction.
+    bool poll(MCMesh& mesh, double* latencyMs = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!finished) {
+            return false;
+        }
+        mesh = std::move(result);
+        result = MCMesh();
+        finished = false;
+        if (latencyMs) {
+            *latencyMs = latency;
+        }
+        return true;
+    }
+
+    // Whether a request is waiting or being extracted
+    bool busy() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return running || pending;
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [this]() { return stopping || pending; });
+            if (stopping) {
+                return;
+            }
+            std::function<MCMesh()> job = std::move(pending);
+            pending = nullptr;
+            auto since = pendingSince;
+            running = true;
+
+            lock.unlock();
+            MCMesh mesh = job();
+            auto end = std::chrono::steady_clock::now();
+            lock.lock();
+
+            running = false;
+            result = std::move(mesh);
+            latency = std::chrono::duration<double, std::milli>(end - since).count();
+            finished = true;
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::function<MCMesh()> pending;
+    std::chrono::steady_clock::time_point pendingSince;
+    bool running = false;
+    bool stopping = false;
+    MCMesh result;
+    bool finished = false;
+    double latency = 0;
+
+    // Last, so it starts once the state above is constructed
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef BRICKMESHER_HPP
+#define BRICKMESHER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "MarchingCubes.hpp"
+
+// Marching cubes soup kept per brick of size^3 cells for interactive editing. An edit to the
+// field marks the bricks whose cells it reaches dirty, and update extracts only those again,
+// so the cost of an edit follows its size rather than the size of the domain. Each brick is
+// walked on its own with slices of (size + 1)^2 points (see MCBlocks::stride), and the
+// bricks together hold the same triangles as marching_cubes with the same options, brick
+// by brick rather than slab by slab. Given a time budget, update extracts only the dirty
+// bricks that fit in it and leaves the rest for the next call, so a viewer can spread a
+// large extraction over frames and draw the bricks done so far; reset starts over at once.
+struct MCBrickMesher {
+    struct Brick {
+        std::vector<float> vertices;
+        std::vector<float> normals;
+        bool dirty = true;
+    };
+
+    float isovalue = 0;
+    float min = 0;
+    float stepsize = 1;
+    int nsteps = 0;
+    int size = 16;
+    int count = 0;
+    MCOptions options;
+    std::vector<Brick> bricks;
+
+    // Bricks extracted by the last update, in increasing order
+    std::vector<int> changed;
+
+    // The dirty bricks, from head on, in the order they became dirty
+    std::vector<int> queue;
+    size_t head = 0;
+
+    // Every brick is active, as update culls whole bricks itself
+    MCBlocks blocks;
+
+    // Time of the longest brick of the last update, or 0 before any, in ms
+    double brickMs = 0;
+
+    // Starts over on [min, max]^3 with every brick dirty. Normals are extracted with the
+    // soup when options.normals is set.
+    void reset(float isovalue_, float min_, float max, float stepsize_, const MCOptions& options_, int size_ = 16) {
+        isovalue = isovalue_;
+        min = min_;
+        stepsize = stepsize_;
+        nsteps = std::max(0, static_cast<int>((max - min) / stepsize));
+        size = std::max(1, size_);
+        count = (nsteps + size - 1) / size;
+        options = options_;
+        bricks.assign(static_cast<size_t>(count) * count * count, Brick());
+        changed.clear();
+        queue.resize(bricks.size());
+        for (size_t b = 0; b < bricks.size(); ++b) {
+            queue[b] = static_cast<int>(b);
+        }
+        head = 0;
+        blocks.size = size;
+        blocks.count = count;
+        blocks.active.assign(bricks.size(), 1);
+        brickMs = 0;
+    }
+
+    // Marks the bricks of every cell the field may have changed in after an edit inside the
+    // box [lo, hi]. Cells are taken half a step wider, the reach of the samples that
+    // secant placement and differenced normals take around a vertex.
+    void mark(const float* lo, const float* hi) {
+        int b0[3], b1[3];
+        for (int a = 0; a < 3; ++a) {
+            float c0 = std::floor((lo[a] - min) / stepsize - 0.5f);
+            float c1 = std::floor((hi[a] - min) / stepsize + 0.5f);
+            if (c1 < 0 || c0 >= nsteps) {
+                return;
+            }
+            b0[a] = std::max(0, static_cast<int>(c0)) / size;
+            b1[a] = std::min(nsteps - 1, static_cast<int>(c1)) / size;
+        }
+        for (int bz = b0[2]; bz <= b1[2]; ++bz) {
+            for (int by = b0[1]; by <= b1[1]; ++by) {
+                for (int bx = b0[0]; bx <= b1[0]; ++bx) {
+                    touch(static_cast<int>((static_cast<size_t>(bz) * count + by) * count + bx));
+                }
+            }
+        }
+    }
+
+    void mark_all() {
+        for (size_t b = 0; b < bricks.size(); ++b) {
+            touch(static_cast<int>(b));
+        }
+    }
+
+    // Extracts the dirty bricks of f on the worker pool of options.threads and returns how
+    // many it extracted. Bricks that bounds() or options.lipschitz show the isovalue misses
+    // are emptied without sampling them, when options.cull is set. With a budget, a worker
+    // only takes another brick while the longest brick of the last call still fits in what
+    // is left of budgetMs, so a call overruns it by at most a brick longer than those. The
+    // first brick always runs, so every call gets on, and when no brick has been timed yet
+    // it runs alone to time one before the workers start.
+    template <typename Field>
+    int update(const Field& f, double budgetMs = std::numeric_limits<double>::infinity()) {
+        typedef std::chrono::steady_clock Clock;
+        int total = pending();
+        bool budgeted = budgetMs < std::numeric_limits<double>::infinity();
+        Clock::time_point start = Clock::now();
+        auto since = [](Clock::time_point t) {
+            return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+        };
+        std::vector<MCStats> stats(total);
+        std::atomic<int> next(0);
+        int threads = std::max(1, std::min(mc_thread_count(options), total));
+        std::vector<double> longest(threads, 0.0);
+        auto work = [&](int t) {
+            while (!budgeted || next == 0 || since(start) + std::max(brickMs, longest[t]) <= budgetMs) {
+                int n = next++;
+                if (n >= total) {
+                    break;
+                }
+                Clock::time_point brickStart = Clock::now();
+                extract(f, queue[head + n], stats[n]);
+                longest[t] = std::max(longest[t], since(brickStart));
+            }
+        };
+        if (budgeted && brickMs == 0 && total > 0) {
+            Clock::time_point brickStart = Clock::now();
+            extract(f, queue[head + next++], stats[0]);
+            longest[0] = since(brickStart);
+            brickMs = longest[0];
+        }
+        mc_run_slabs(threads, 1, threads, options, [&](int t, int, int) { work(t); });
+        int done = std::min(static_cast<int>(next), total);
+        stats.resize(done);
+        mc_report_stats(stats, options);
+        if (done > 0) {
+            brickMs = *std::max_element(longest.begin(), longest.end());
+        }
+        changed.assign(queue.begin() + head, queue.begin() + head + done);
+        head += done;
+        if (head == queue.size()) {
+            queue.clear();
+            head = 0;
+        }
+        std::sort(changed.begin(), changed.end());
+        return done;
+    }
+
+    // Dirty bricks waiting for an update
+    int pending() const {
+        return static_cast<int>(queue.size() - head);
+    }
+
+    size_t triangles() const {
+        size_t total = 0;
+        for (const Brick& brick : bricks) {
+            total += brick.vertices.size() / 9;
+        }
+        return total;
+    }
+
+    // The soup of every brick in order, with their normals when normals is not null
+    std::vector<float> soup(std::vector<float>* normals = nullptr) const {
+        std::vector<float> vertices;
+        vertices.reserve(9 * triangles());
+        if (normals) {
+            normals->clear();
+        }
+        for (const Brick& brick : bricks) {
+            vertices.insert(vertices.end(), brick.vertices.begin(), brick.vertices.end());
+            if (normals) {
+                normals->insert(normals->end(), brick.normals.begin(), brick.normals.end());
+            }
+        }
+        return vertices;
+    }
+
+private:
+    void touch(int b) {
+        if (!bricks[b].dirty) {
+            bricks[b].dirty = true;
+            queue.push_back(b);
+        }
+    }
+
+    template <typename Field>
+    void extract(const Field& f, int b, MCStats& stats) {
+        int bx = b % count, by = b / count % count, bz = b / count / count;
+        MCBlocks window = blocks;
+        window.x0 = bx * size;
+        window.y0 = by * size;
+        window.x1 = window.x0 + size;
+        window.y1 = window.y0 + size;
+        window.stride = size + 1;
+        int k0 = bz * size;
+        int k1 = std::min(nsteps, k0 + size);
+
+        MCSoupOutput out;
+        out.withNormals = options.normals;
+        Brick& brick = bricks[b];
+        brick.dirty = false;
+
+        float lo[3] = { min + window.x0 * stepsize, min + window.y0 * stepsize, min + k0 * stepsize };
+        float hi[3] = { min + std::min(window.x1, nsteps) * stepsize, min + std::min(window.y1, nsteps) * stepsize,
+                        min + k1 * stepsize };
+        Interval range;
+        if (options.cull && mc_field_range(f, lo, hi, options, range, stats)) {
+            float pad = 1e-5f * (1.0f + std::fabs(range.lo) + std::fabs(range.hi));
+            if (range.hi < isovalue - pad || range.lo > isovalue + pad) {
+                stats.cellsSkipped += static_cast<long long>(std::min(window.x1, nsteps) - window.x0) *
+                                      (std::min(window.y1, nsteps) - window.y0) * (k1 - k0);
+                brick.vertices.swap(out.vertices);
+                brick.normals.swap(out.normals);
+                return;
+            }
+        }
+
+        constexpr bool lattice = mc_has_lattice<Field>::value;
+        size_t points = lattice ? 0 : static_cast<size_t>(size + 1) * (size + 1);
+        std::vector<float> lower(points), upper(points);
+        MCRow row(min, stepsize, lattice ? 0 : nsteps + 1);
+        mc_walk_window(f, isovalue, min, stepsize, nsteps, window, options.placement, k0, k1, lower, upper, row, out, stats);
+        brick.vertices.swap(out.vertices);
+        brick.normals.swap(out.normals);
+    }
+};
+
+// A field with local edits on top of it, for sculpting: each edit adds
+// strength * (1 - d^2 / r^2)^3 within radius r of its centre, a bump that is smooth and
+// zero outside the ball, so an edit only changes the field inside the box of the ball.
+// A negative strength pulls the surface outwards, since cells below the isovalue are inside.
+// Edits are checked against each row's box, so rows away from them cost the base field only.
+template <typename Field>
+struct MCSculptedField {
+    struct Edit {
+        float centre[3];
+        float radius;
+        float strength;
+    };
+
+    Field base;
+    std::vector<Edit> edits;
+
+    MCSculptedField() {}
+    MCSculptedField(const Field& base_) : base(base_) {}
+
+    // Adds an edit and gives the box it changes the field in
+    void add(float x, float y, float z, float radius, float strength, float* lo, float* hi) {
+        edits.push_back({ { x, y, z }, radius, strength });
+        const float* c = edits.back().centre;
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = c[a] - radius;
+            hi[a] = c[a] + radius;
+        }
+    }
+
+    float operator()(float x, float y, float z) const {
+        float v = base(x, y, z);
+        for (const Edit& e : edits) {
+            v += bump(e, x, y, z);
+        }
+        return v;
+    }
+
+    void eval_row(const float* x, const float* y, const float* z, float* out, int count) const {
+        mc_eval_row(base, x, y, z, out, count);
+        float lo[3] = { x[0], y[0], z[0] }, hi[3] = { x[0], y[0], z[0] };
+        for (int i = 1; i < count; ++i) {
+            lo[0] = std::min(lo[0], x[i]);
+            hi[0] = std::max(hi[0], x[i]);
+            lo[1] = std::min(lo[1], y[i]);
+            hi[1] = std::max(hi[1], y[i]);
+            lo[2] = std::min(lo[2], z[i]);
+            hi[2] = std::max(hi[2], z[i]);
+        }
+        for (const Edit& e : edits) {
+            if (!overlaps(e, lo, hi)) {
+                continue;
+            }
+            for (int i = 0; i < count; ++i) {
+                out[i] += bump(e, x[i], y[i], z[i]);
+            }
+        }
+    }
+
+    // The base field's bounds, widened by each edit that reaches the box
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        const float inf = std::numeric_limits<float>::infinity();
+        Interval range(-inf, inf);
+        if constexpr (mc_has_bounds<Field>::value) {
+            range = base.bounds(x, y, z);
+        }
+        float lo[3] = { x.lo, y.lo, z.lo }, hi[3] = { x.hi, y.hi, z.hi };
+        for (const Edit& e : edits) {
+            if (overlaps(e, lo, hi)) {
+                range = range + Interval(std::min(e.strength, 0.0f), std::max(e.strength, 0.0f));
+            }
+        }
+        return range;
+    }
+
+private:
+    static float bump(const Edit& e, float x, float y, float z) {
+        float dx = x - e.centre[0], dy = y - e.centre[1], dz = z - e.centre[2];
+        float q = (dx * dx + dy * dy + dz * dz) / (e.radius * e.radius);
+        if (q >= 1) {
+            return 0;
+        }
+        float w = 1 - q;
+        return e.strength * w * w * w;
+    }
+
+    static bool overlaps(const Edit& e, const float* lo, const float* hi) {
+        for (int a = 0; a < 3; ++a) {
+            if (e.centre[a] + e.radius < lo[a] || e.centre[a] - e.radius > hi[a]) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif
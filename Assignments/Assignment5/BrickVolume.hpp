@@ -0,0 +1,622 @@
+#ifndef BRICKVOLUME_HPP
+#define BRICKVOLUME_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Interval.hpp"
+#include "MarchingCubes.hpp"
+#include "Volume.hpp"
+
+// Compresses n bytes into out as LZ4 style sequences: a token holding the number of
+// literals in its high nibble and the match length minus 4 in its low one, each extended
+// by bytes added on while they are 255, then the literals and the 16-bit distance back to
+// the match. The last sequence has literals only. Matches are found through a hash of the
+// 4 bytes at each position, keeping the latest position for every hash.
+inline void mc_lz_compress(const uint8_t* in, size_t n, std::vector<uint8_t>& out)
+{
+    const int hashBits = 12;
+    std::vector<int32_t> table(1 << hashBits, -1);
+    auto put_length = [&](size_t length) {
+        for (; length >= 255; length -= 255) {
+            out.push_back(255);
+        }
+        out.push_back(static_cast<uint8_t>(length));
+    };
+    auto put_literals = [&](size_t anchor, size_t end, size_t matchExtra) {
+        size_t literals = end - anchor;
+        out.push_back(static_cast<uint8_t>((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(matchExtra, 15)));
+        if (literals >= 15) {
+            put_length(literals - 15);
+        }
+        out.insert(out.end(), in + anchor, in + end);
+    };
+
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + 4 <= n)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, in + i, 4);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+        int32_t candidate = table[hash];
+        table[hash] = static_cast<int32_t>(i);
+        uint32_t previous = 0;
+        if (candidate >= 0) {
+            memcpy(&previous, in + candidate, 4);
+        }
+        if (candidate < 0 || i - candidate > 65535 || previous != sequence) {
+            ++i;
+            continue;
+        }
+
+        size_t length = 4;
+        while (i + length < n && in[candidate + length] == in[i + length]) {
+            ++length;
+        }
+        size_t distance = i - candidate;
+        put_literals(anchor, i, length - 4);
+        out.push_back(static_cast<uint8_t>(distance & 255));
+        out.push_back(static_cast<uint8_t>(distance >> 8));
+        if (length - 4 >= 15) {
+            put_length(length - 4 - 15);
+        }
+        i += length;
+        anchor = i;
+    }
+    put_literals(anchor, n, 0);
+}
+
+// Inverse of mc_lz_compress. Returns false unless the n bytes decode to exactly outSize.
+inline bool mc_lz_decompress(const uint8_t* in, size_t n, uint8_t* out, size_t outSize)
+{
+    size_t ip = 0, op = 0;
+    auto get_length = [&](size_t& length) {
+        uint8_t b;
+        do {
+            if (ip >= n) {
+                return false;
+            }
+            b = in[ip++];
+            length += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < n)
+    {
+        uint8_t token = in[ip++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(literals)) {
+            return false;
+        }
+        if (literals > n - ip || literals > outSize - op) {
+            return false;
+        }
+        memcpy(out + op, in + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == n) {
+            break;
+        }
+
+        if (n - ip < 2) {
+            return false;
+        }
+        size_t distance = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !get_length(length)) {
+            return false;
+        }
+        length += 4;
+        if (distance == 0 || distance > op || length > outSize - op) {
+            return false;
+        }
+        // Byte by byte, as the match may overlap what it is copying
+        for (size_t m = 0; m < length; ++m, ++op) {
+            out[op] = out[op - distance];
+        }
+    }
+    return op == outSize;
+}
+
+// Reversible filter run on the samples of a brick before compressing them: integer samples
+// are replaced by their difference from the previous sample, which is small in smooth data,
+// and the bytes of wider types are split into planes, so the high bytes that barely change
+// end up next to each other.
+inline void mc_brick_filter(const uint8_t* in, int count, int size, bool integer, uint8_t* out)
+{
+    for (int i = count - 1; integer && i >= 0; --i) {
+        uint32_t s = 0, previous = 0;
+        memcpy(&s, in + i * size, size);
+        if (i > 0) {
+            memcpy(&previous, in + (i - 1) * size, size);
+        }
+        uint32_t delta = s - previous;
+        for (int b = 0; b < size; ++b) {
+            out[b * count + i] = static_cast<uint8_t>(delta >> (8 * b));
+        }
+    }
+    for (int i = 0; !integer && i < count; ++i) {
+        for (int b = 0; b < size; ++b) {
+            out[b * count + i] = in[i * size + b];
+        }
+    }
+}
+
+inline void mc_brick_unfilter(const uint8_t* in, int count, int size, bool integer, uint8_t* out)
+{
+    uint32_t previous = 0;
+    for (int i = 0; i < count; ++i) {
+        uint32_t s = 0;
+        for (int b = 0; b < size; ++b) {
+            s |= static_cast<uint32_t>(in[b * count + i]) << (8 * b);
+        }
+        if (integer) {
+            s += previous;
+            previous = s;
+        }
+        memcpy(out + i * size, &s, size);
+    }
+}
+
+// Header of a bricked volume file. It is followed by the table of bricks and then their
+// compressed samples.
+struct MCBrickHeader {
+    char magic[4];
+    uint32_t type;
+
+    // Samples along each axis of the cubic lattice, and cells along each axis of a brick
+    uint32_t samples;
+    uint32_t brickSize;
+
+    float min;
+    float stepsize;
+    float scale;
+    float offset;
+};
+
+// Entry of the brick table, x fastest. Brick (bx, by, bz) covers brickSize^3 cells and
+// stores the (brickSize + 1)^3 samples at their corners from brickSize * (bx, by, bz) on,
+// so extracting its cells reads no other brick. Past the end of the lattice the last
+// samples are repeated.
+struct MCBrick {
+    // Range of the samples of the brick
+    float lo;
+    float hi;
+
+    // Value of every sample of a constant brick, which stores nothing
+    float value;
+
+    // Bytes stored for the brick: 0 when it is constant, the size of its samples when they
+    // did not compress, and otherwise compressed
+    uint32_t bytes;
+    uint64_t offset;
+};
+
+// Volume stored as compressed bricks with the range of every brick in a table, used as a
+// field by the extractors. Its bounds() come from the table, so with the blocks of
+// marching_cubes lined up with the bricks (see options()) only the bricks the isovalue
+// passes through are decompressed. Opening maps the file; bricks are decompressed into a
+// per-thread cache when first read. Copies share the mapping and the count of
+// decompressed bricks.
+struct MCBrickVolume {
+    MCVolume::Type type = MCVolume::FLOAT32;
+    int samples = 0;
+    int brickSize = 0;
+    int brickCount = 0;
+    float min = 0;
+    float stepsize = 1;
+    float scale = 1;
+    float offset = 0;
+
+    std::shared_ptr<void> mapping;
+    const MCBrick* bricks = nullptr;
+    const uint8_t* base = nullptr;
+
+    // Bricks decompressed so far, by every thread and copy, each counted once however often
+    // the caches start over, and which of them were
+    std::shared_ptr<std::atomic<long long>> decoded;
+    std::shared_ptr<std::vector<std::atomic<bool>>> reached;
+
+    // Number of the opened file, which keys the per-thread caches of decompressed bricks.
+    // A later file could be mapped at the same address, so the address cannot.
+    uint64_t id = 0;
+
+    // Decompressed bricks each thread keeps before starting over
+    static constexpr size_t cacheBytes = 64 << 20;
+
+    // Maps a file written by mc_write_bricks. Returns false when it cannot be read or is not
+    // a bricked volume.
+    bool open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(MCBrickHeader)) {
+            close(fd);
+            return false;
+        }
+        size_t size = info.st_size;
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        std::shared_ptr<void> owner(map, [size](void* p) { munmap(p, size); });
+
+        MCBrickHeader header;
+        memcpy(&header, map, sizeof(header));
+        if (memcmp(header.magic, "MCBV", 4) != 0 || header.type > MCVolume::FLOAT32 || header.samples < 2 ||
+            header.brickSize < 1) {
+            return false;
+        }
+        int count = (header.samples - 1 + header.brickSize - 1) / header.brickSize;
+        size_t tableBytes = static_cast<size_t>(count) * count * count * sizeof(MCBrick);
+        if (size < sizeof(header) + tableBytes) {
+            return false;
+        }
+        const MCBrick* table = reinterpret_cast<const MCBrick*>(static_cast<const uint8_t*>(map) + sizeof(header));
+        for (size_t b = 0; b < tableBytes / sizeof(MCBrick); ++b) {
+            if (table[b].offset > size || table[b].bytes > size - table[b].offset) {
+                return false;
+            }
+        }
+
+        type = static_cast<MCVolume::Type>(header.type);
+        samples = header.samples;
+        brickSize = header.brickSize;
+        brickCount = count;
+        min = header.min;
+        stepsize = header.stepsize;
+        scale = header.scale;
+        offset = header.offset;
+        mapping = owner;
+        bricks = table;
+        base = static_cast<const uint8_t*>(map);
+        decoded = std::make_shared<std::atomic<long long>>(0);
+        reached = std::make_shared<std::vector<std::atomic<bool>>>(static_cast<size_t>(count) * count * count);
+        static std::atomic<uint64_t> opened(0);
+        id = ++opened;
+        return true;
+    }
+
+    int nsteps() const {
+        return samples - 1;
+    }
+
+    // Upper end of the lattice, to pass to marching_cubes along with min and stepsize
+    float max() const {
+        return min + (nsteps() + 0.5f) * stepsize;
+    }
+
+    // Options with the blocks of marching_cubes lined up with the bricks, so that culling
+    // goes by the ranges in the table and each active block reads a single brick
+    MCOptions options(MCOptions o = MCOptions()) const {
+        o.cull = true;
+        o.blockSize = brickSize;
+        return o;
+    }
+
+    int brick_samples() const {
+        return (brickSize + 1) * (brickSize + 1) * (brickSize + 1);
+    }
+
+    // Decompresses brick b into its values
+    void decode(int b, float* out) const {
+        const MCBrick& brick = bricks[b];
+        int count = brick_samples();
+        int size = static_cast<int>(MCVolume::type_size(type));
+        size_t raw = static_cast<size_t>(count) * size;
+        std::vector<uint8_t> bytes(raw), filtered(raw);
+        bool ok = true;
+        if (brick.bytes == raw) {
+            memcpy(filtered.data(), base + brick.offset, raw);
+        } else {
+            ok = mc_lz_decompress(base + brick.offset, brick.bytes, filtered.data(), raw);
+        }
+        if (!ok) {
+            // A damaged brick reads as its constant value rather than stopping the extraction
+            std::fill(out, out + count, brick.value);
+            return;
+        }
+        mc_brick_unfilter(filtered.data(), count, size, type != MCVolume::FLOAT32, bytes.data());
+        switch (type) {
+            case MCVolume::UINT8: mc_convert_samples<uint8_t>(bytes.data(), count, scale, offset, out); break;
+            case MCVolume::UINT16: mc_convert_samples<uint16_t>(bytes.data(), count, scale, offset, out); break;
+            case MCVolume::FLOAT32: mc_convert_samples<float>(bytes.data(), count, scale, offset, out); break;
+        }
+    }
+
+    // Values of brick b from the cache of the calling thread, or null for a constant brick
+    const float* brick_values(int b) const {
+        if (bricks[b].bytes == 0) {
+            return nullptr;
+        }
+        struct Cache {
+            uint64_t owner = 0;
+            std::unordered_map<int, std::vector<float>> values;
+        };
+        static thread_local Cache cache;
+        size_t brickBytes = brick_samples() * sizeof(float);
+        if (cache.owner != id || cache.values.size() * brickBytes >= cacheBytes) {
+            cache.values.clear();
+            cache.owner = id;
+        }
+        auto found = cache.values.find(b);
+        if (found != cache.values.end()) {
+            return found->second.data();
+        }
+        std::vector<float>& values = cache.values[b];
+        values.resize(brick_samples());
+        decode(b, values.data());
+        if (!(*reached)[b].exchange(true)) {
+            (*decoded)++;
+        }
+        return values.data();
+    }
+
+    // Brick holding cell c along an axis
+    int brick_of(int c) const {
+        return std::min(c / brickSize, brickCount - 1);
+    }
+
+    // Value at (x, y, z) within brick (bx, by, bz), x, y and z running from 0 to brickSize
+    float brick_sample(int bx, int by, int bz, int x, int y, int z) const {
+        int b = (bz * brickCount + by) * brickCount + bx;
+        const float* values = brick_values(b);
+        if (!values) {
+            return bricks[b].value;
+        }
+        return values[(z * (brickSize + 1) + y) * (brickSize + 1) + x];
+    }
+
+    float sample(int i, int j, int k) const {
+        int bx = brick_of(i), by = brick_of(j), bz = brick_of(k);
+        return brick_sample(bx, by, bz, i - bx * brickSize, j - by * brickSize, k - bz * brickSize);
+    }
+
+    // Slice k of a grid of nsteps^3 cells from min, at the points the active blocks touch.
+    // When the blocks are the bricks, each active one copies its part of the slice from its
+    // own brick, once. Other grids are sampled point by point.
+    long long sample_slice(float gridMin, float gridStepsize, int gridSteps, const MCBlocks& blocks, int k,
+                           float* slice) const
+    {
+        int n = gridSteps + 1;
+        long long written = 0;
+        bool aligned = gridMin == min && gridStepsize == stepsize && gridSteps == nsteps();
+        if (!aligned || blocks.size != brickSize || blocks.count != brickCount) {
+            mc_slice_runs(gridSteps, blocks, k, [&](int j, int i0, int count) {
+                float* row = slice + blocks.slot(i0, j, n);
+                for (int i = i0; i < i0 + count; ++i) {
+                    row[i - i0] = aligned ? sample(i, j, k)
+                                     : (*this)(gridMin + i * gridStepsize, gridMin + j * gridStepsize,
+                                               gridMin + k * gridStepsize);
+                }
+                written += count;
+            });
+            return written;
+        }
+
+        // A slice inside a layer of bricks is copied from that layer. A slice on the face
+        // between two layers is the top of the bricks below and the bottom of those above,
+        // and a brick above is only copied when the one below it is not active. Only the
+        // bricks of the window are copied, as far as they lie in it. Neighbouring bricks
+        // share their sides, so the count written is that of the points of the runs.
+        int stride = brickSize + 1;
+        int xEnd = std::min(blocks.x1, gridSteps), yEnd = std::min(blocks.y1, gridSteps);
+        int bx0 = blocks.x0 / brickSize, bx1 = (xEnd + brickSize - 1) / brickSize;
+        int by0 = blocks.y0 / brickSize, by1 = (yEnd + brickSize - 1) / brickSize;
+        int below = k > 0 && k % brickSize == 0 ? k / brickSize - 1 : -1;
+        for (int bz : { below, k / brickSize }) {
+            int z = k - bz * brickSize;
+            if (bz < 0 || bz >= brickCount) {
+                continue;
+            }
+            for (int by = by0; by < by1; ++by) {
+                for (int bx = bx0; bx < bx1; ++bx) {
+                    bool copied = bz != below && below >= 0 && blocks.is_active(bx, by, below);
+                    if (!blocks.is_active(bx, by, bz) || copied) {
+                        continue;
+                    }
+                    int b = (bz * brickCount + by) * brickCount + bx;
+                    const float* values = brick_values(b);
+                    int xBegin = std::max(0, blocks.x0 - bx * brickSize);
+                    int yBegin = std::max(0, blocks.y0 - by * brickSize);
+                    int width = std::min(brickSize, xEnd - bx * brickSize) + 1 - xBegin;
+                    int height = std::min(brickSize, yEnd - by * brickSize) + 1;
+                    for (int y = yBegin; y < height; ++y) {
+                        float* row = slice + blocks.slot(bx * brickSize + xBegin, by * brickSize + y, n);
+                        if (values) {
+                            const float* from = values + (z * stride + y) * stride + xBegin;
+                            std::copy(from, from + width, row);
+                        } else {
+                            std::fill(row, row + width, bricks[b].value);
+                        }
+                    }
+                }
+            }
+        }
+        mc_slice_runs(gridSteps, blocks, k, [&](int, int, int count) { written += count; });
+        return written;
+    }
+
+    // Trilinear interpolation of the samples, for vertex placements that look between them.
+    // The corners of a cell all lie in the brick holding it.
+    float operator()(float x, float y, float z) const {
+        float p[3] = { x, y, z };
+        int b[3], c[3];
+        float t[3];
+        int last = nsteps();
+        for (int a = 0; a < 3; ++a) {
+            float u = std::min(std::max((p[a] - min) / stepsize, 0.0f), static_cast<float>(last));
+            int cell = std::min(static_cast<int>(u), last - 1);
+            t[a] = u - cell;
+            b[a] = brick_of(cell);
+            c[a] = cell - b[a] * brickSize;
+        }
+        float v[2][2][2];
+        for (int dz = 0; dz < 2; ++dz) {
+            for (int dy = 0; dy < 2; ++dy) {
+                for (int dx = 0; dx < 2; ++dx) {
+                    v[dz][dy][dx] = brick_sample(b[0], b[1], b[2], c[0] + dx, c[1] + dy, c[2] + dz);
+                }
+            }
+        }
+        float y0 = v[0][0][0] + (v[0][0][1] - v[0][0][0]) * t[0];
+        float y1 = v[0][1][0] + (v[0][1][1] - v[0][1][0]) * t[0];
+        float y2 = v[1][0][0] + (v[1][0][1] - v[1][0][0]) * t[0];
+        float y3 = v[1][1][0] + (v[1][1][1] - v[1][1][0]) * t[0];
+        float z0 = y0 + (y1 - y0) * t[1];
+        float z1 = y2 + (y3 - y2) * t[1];
+        return z0 + (z1 - z0) * t[2];
+    }
+
+    // Union of the ranges in the table of the bricks whose cells the box overlaps
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        Interval box[3] = { x, y, z };
+        int b0[3], b1[3];
+        for (int a = 0; a < 3; ++a) {
+            // Boxes of the grid start and end on lattice points, up to rounding
+            int c0 = static_cast<int>(std::floor((box[a].lo - min) / stepsize + 0.001f));
+            int c1 = static_cast<int>(std::ceil((box[a].hi - min) / stepsize - 0.001f));
+            c0 = std::min(std::max(c0, 0), nsteps() - 1);
+            c1 = std::min(std::max(c1, c0 + 1), nsteps());
+            b0[a] = brick_of(c0);
+            b1[a] = brick_of(c1 - 1);
+        }
+        Interval range(INFINITY, -INFINITY);
+        for (int bz = b0[2]; bz <= b1[2]; ++bz) {
+            for (int by = b0[1]; by <= b1[1]; ++by) {
+                for (int bx = b0[0]; bx <= b1[0]; ++bx) {
+                    const MCBrick& brick = bricks[(bz * brickCount + by) * brickCount + bx];
+                    range.lo = std::min(range.lo, brick.lo);
+                    range.hi = std::max(range.hi, brick.hi);
+                }
+            }
+        }
+        return range;
+    }
+};
+
+// Converts a volume to a bricked volume file of brickSize^3 cells per brick, covering the
+// cubic lattice of volume.nsteps() steps. The samples past the volume, where it is not a
+// cube, take its outside value (stored as the nearest value of its type).
+// Returns false when the file cannot be written.
+inline bool mc_write_bricks(const MCVolume& volume, const std::string& path, int brickSize)
+{
+    int nsteps = volume.nsteps();
+    int count = (nsteps + brickSize - 1) / brickSize;
+    int size = static_cast<int>(MCVolume::type_size(volume.type));
+    int stride = brickSize + 1;
+    int brickSamples = stride * stride * stride;
+
+    MCBrickHeader header;
+    memcpy(header.magic, "MCBV", 4);
+    header.type = volume.type;
+    header.samples = nsteps + 1;
+    header.brickSize = brickSize;
+    header.min = volume.min;
+    header.stepsize = volume.stepsize;
+    header.scale = volume.scale;
+    header.offset = volume.offset;
+
+    // Stored sample standing for the outside value
+    uint8_t outside[4];
+    if (volume.type == MCVolume::FLOAT32) {
+        memcpy(outside, &volume.outside, 4);
+    } else {
+        float top = volume.type == MCVolume::UINT8 ? 255.0f : 65535.0f;
+        float s = std::round(std::min(std::max((volume.outside - volume.offset) / volume.scale, 0.0f), top));
+        uint8_t s8 = static_cast<uint8_t>(s);
+        uint16_t s16 = static_cast<uint16_t>(s);
+        if (volume.type == MCVolume::UINT8) {
+            memcpy(outside, &s8, 1);
+        } else {
+            memcpy(outside, &s16, 2);
+        }
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    std::vector<MCBrick> table(static_cast<size_t>(count) * count * count);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(table.data(), sizeof(MCBrick), table.size(), file) == table.size();
+    uint64_t position = sizeof(header) + table.size() * sizeof(MCBrick);
+
+    std::vector<uint8_t> raw(static_cast<size_t>(brickSamples) * size), filtered(raw.size()), compressed;
+    std::vector<float> values(brickSamples);
+    for (int bz = 0; ok && bz < count; ++bz) {
+        for (int by = 0; ok && by < count; ++by) {
+            for (int bx = 0; ok && bx < count; ++bx) {
+                MCBrick& brick = table[(bz * count + by) * count + bx];
+
+                // Samples of the brick, repeating the last ones past the lattice
+                for (int z = 0; z < stride; ++z) {
+                    for (int y = 0; y < stride; ++y) {
+                        for (int x = 0; x < stride; ++x) {
+                            int i = std::min(bx * brickSize + x, nsteps);
+                            int j = std::min(by * brickSize + y, nsteps);
+                            int k = std::min(bz * brickSize + z, nsteps);
+                            const uint8_t* s = outside;
+                            if (i < volume.dims[0] && j < volume.dims[1] && k < volume.dims[2]) {
+                                s = volume.samples + volume.index(i, j, k) * size;
+                            }
+                            memcpy(raw.data() + ((static_cast<size_t>(z) * stride + y) * stride + x) * size, s, size);
+                        }
+                    }
+                }
+                switch (volume.type) {
+                    case MCVolume::UINT8: mc_convert_samples<uint8_t>(raw.data(), brickSamples, volume.scale, volume.offset, values.data()); break;
+                    case MCVolume::UINT16: mc_convert_samples<uint16_t>(raw.data(), brickSamples, volume.scale, volume.offset, values.data()); break;
+                    case MCVolume::FLOAT32: mc_convert_samples<float>(raw.data(), brickSamples, volume.scale, volume.offset, values.data()); break;
+                }
+
+                bool constant = true;
+                for (int s = 1; constant && s < brickSamples; ++s) {
+                    constant = memcmp(raw.data() + s * size, raw.data(), size) == 0;
+                }
+                brick.lo = *std::min_element(values.begin(), values.end());
+                brick.hi = *std::max_element(values.begin(), values.end());
+                brick.value = values[0];
+                brick.offset = position;
+                brick.bytes = 0;
+                if (constant) {
+                    continue;
+                }
+
+                mc_brick_filter(raw.data(), brickSamples, size, volume.type != MCVolume::FLOAT32, filtered.data());
+                compressed.clear();
+                mc_lz_compress(filtered.data(), filtered.size(), compressed);
+                const std::vector<uint8_t>& payload = compressed.size() < filtered.size() ? compressed : filtered;
+                brick.bytes = static_cast<uint32_t>(payload.size());
+                ok = fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+                position += payload.size();
+            }
+        }
+    }
+
+    // The table goes after the header once every brick has its place
+    ok = ok && fseek(file, sizeof(header), SEEK_SET) == 0 &&
+         fwrite(table.data(), sizeof(MCBrick), table.size(), file) == table.size();
+    return fclose(file) == 0 && ok;
+}
+
+#endif
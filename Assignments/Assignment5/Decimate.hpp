@@ -0,0 +1,449 @@
+#ifndef DECIMATE_HPP
+#define DECIMATE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MarchingCubes.hpp"
+
+// Quadric error mesh simplification (Garland and Heckbert) for welded meshes.
+// Every vertex carries the sum of the quadrics of the planes of its original faces, and
+// edges are collapsed cheapest first from a heap whose stale entries are skipped when
+// popped, and dropped all at once when they come to outnumber the rest. A collapse that
+// would fold or tear the surface waits at its two vertices until a collapse next to them
+// changes their neighbourhood, and is then tried again. The face list of a vertex keeps
+// the faces that die around it until the vertex is next visited. Boundary and
+// non-manifold vertices are never moved, so open borders and the edges of the grid stay
+// where they are.
+
+// Symmetric 4x4 matrix of a sum of plane quadrics, upper triangle row by row
+struct Quadric {
+    double q[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    // Quadric of the plane n . x + d = 0 with n a unit vector
+    static Quadric plane(double a, double b, double c, double d) {
+        Quadric r;
+        double p[4] = { a, b, c, d };
+        int k = 0;
+        for (int i = 0; i < 4; ++i) {
+            for (int j = i; j < 4; ++j) {
+                r.q[k++] = p[i] * p[j];
+            }
+        }
+        return r;
+    }
+
+    Quadric& operator+=(const Quadric& o) {
+        for (int i = 0; i < 10; ++i) {
+            q[i] += o.q[i];
+        }
+        return *this;
+    }
+
+    // Sum of squared distances from (x, y, z) to the planes
+    double error(double x, double y, double z) const {
+        return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+             + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+             + q[7] * z * z + 2 * q[8] * z
+             + q[9];
+    }
+
+    // Point of least error, false when the planes do not pin one down
+    bool minimum(double* p) const {
+        double a[3][3] = { { q[0], q[1], q[2] }, { q[1], q[4], q[5] }, { q[2], q[5], q[7] } };
+        double b[3] = { -q[3], -q[6], -q[8] };
+        double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+                   - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+                   + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+        double scale = a[0][0] + a[1][1] + a[2][2];
+        if (std::fabs(det) <= 1e-9 * scale * scale * scale) {
+            return false;
+        }
+        for (int c = 0; c < 3; ++c) {
+            double m[3][3];
+            for (int i = 0; i < 3; ++i) {
+                for (int j = 0; j < 3; ++j) {
+                    m[i][j] = j == c ? b[i] : a[i][j];
+                }
+            }
+            p[c] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                  - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                  + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+        }
+        return true;
+    }
+};
+
+// Candidate collapse of edge (u, v) into u. Vertex versions only grow, so the entry is
+// current while version[u] + version[v] still equals stamp.
+struct DecimateCollapse {
+    float cost;
+    uint32_t u, v;
+    uint32_t stamp;
+
+    // Cheapest first in a std heap
+    bool operator<(const DecimateCollapse& o) const { return cost > o.cost; }
+};
+
+// Simplifies mesh by edge collapses until it has at most targetTriangles triangles or the
+// cheapest collapse would cost more than maxError, the summed squared distance from the
+// merged vertex to the planes of the original faces around it. Collapses that would flip
+// a face or make the surface non-manifold are skipped. Vertex normals, when present, are
+// averaged over the vertices merged into each one.
+inline MCMesh decimate(const MCMesh& mesh, size_t targetTriangles, double maxError = INFINITY)
+{
+    size_t nvertices = mesh.vertices.size() / 3;
+    size_t nfaces = mesh.indices.size() / 3;
+    bool hasNormals = mesh.normals.size() == mesh.vertices.size();
+
+    std::vector<float> position = mesh.vertices;
+    std::vector<float> normal = hasNormals ? mesh.normals : std::vector<float>();
+    std::vector<uint32_t> faces = mesh.indices;
+    std::vector<uint8_t> faceAlive(nfaces, 1);
+    std::vector<uint8_t> vertexAlive(nvertices, 1);
+    std::vector<uint8_t> locked(nvertices, 0);
+    std::vector<uint32_t> version(nvertices, 0);
+    std::vector<std::vector<uint32_t>> vertexFaces(nvertices);
+    std::vector<Quadric> quadric(nvertices);
+
+    std::vector<uint32_t> valence(nvertices, 0);
+    for (uint32_t w : faces) {
+        ++valence[w];
+    }
+    for (size_t w = 0; w < nvertices; ++w) {
+        vertexFaces[w].reserve(valence[w]);
+    }
+    for (size_t f = 0; f < nfaces; ++f)
+    {
+        const uint32_t* t = &faces[3 * f];
+        const float* a = &position[3 * t[0]];
+        const float* b = &position[3 * t[1]];
+        const float* c = &position[3 * t[2]];
+        double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int corner = 0; corner < 3; ++corner) {
+            vertexFaces[t[corner]].push_back(static_cast<uint32_t>(f));
+        }
+        if (length > 0) {
+            Quadric q = Quadric::plane(n[0] / length, n[1] / length, n[2] / length,
+                                       -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]) / length);
+            for (int corner = 0; corner < 3; ++corner) {
+                quadric[t[corner]] += q;
+            }
+        }
+    }
+
+    // Edges used by other than two faces lie on a boundary or a non-manifold seam. Each
+    // edge is counted at its lower vertex over the faces around it.
+    std::vector<uint64_t> edges;
+    edges.reserve(3 * nfaces / 2);
+    std::vector<std::pair<uint32_t, int>> around;
+    for (size_t a = 0; a < nvertices; ++a) {
+        around.clear();
+        const std::vector<uint32_t>& list = vertexFaces[a];
+        for (size_t i = 0; i < list.size(); ++i) {
+            // A face with a repeated corner is listed once per corner
+            if (i > 0 && list[i] == list[i - 1]) {
+                continue;
+            }
+            const uint32_t* t = &faces[3 * list[i]];
+            for (int corner = 0; corner < 3; ++corner) {
+                uint32_t x = t[corner], y = t[(corner + 1) % 3];
+                if (std::min(x, y) != a) {
+                    continue;
+                }
+                uint32_t b = std::max(x, y);
+                auto found = std::find_if(around.begin(), around.end(),
+                                          [&](const std::pair<uint32_t, int>& e) { return e.first == b; });
+                if (found == around.end()) {
+                    around.emplace_back(b, 1);
+                } else {
+                    ++found->second;
+                }
+            }
+        }
+        for (const std::pair<uint32_t, int>& e : around) {
+            if (e.second != 2) {
+                locked[a] = 1;
+                locked[e.first] = 1;
+            }
+            edges.push_back((static_cast<uint64_t>(a) << 32) | e.first);
+        }
+    }
+
+    // Where the collapse of (u, v) into u puts u, and the error there
+    auto place = [&](uint32_t u, uint32_t v, float* p) {
+        Quadric q = quadric[u];
+        q += quadric[v];
+        const float* pu = &position[3 * u];
+        const float* pv = &position[3 * v];
+        double x[3] = { pu[0], pu[1], pu[2] };
+        if (!locked[u] && !q.minimum(x)) {
+            // Best of the two ends and the midpoint
+            double best = INFINITY;
+            for (double t : { 0.0, 0.5, 1.0 }) {
+                double y[3] = { pu[0] + (pv[0] - pu[0]) * t, pu[1] + (pv[1] - pu[1]) * t, pu[2] + (pv[2] - pu[2]) * t };
+                double e = q.error(y[0], y[1], y[2]);
+                if (e < best) {
+                    best = e;
+                    x[0] = y[0], x[1] = y[1], x[2] = y[2];
+                }
+            }
+        }
+        for (int a = 0; a < 3; ++a) {
+            p[a] = static_cast<float>(x[a]);
+        }
+        return static_cast<float>(std::max(0.0, q.error(x[0], x[1], x[2])));
+    };
+
+    std::vector<DecimateCollapse> heap;
+    heap.reserve(edges.size());
+    auto candidate = [&](uint32_t u, uint32_t v, DecimateCollapse& c) {
+        if (locked[u] && locked[v]) {
+            return false;
+        }
+        // A locked vertex stays put, so the edge collapses onto it
+        if (locked[v]) {
+            std::swap(u, v);
+        }
+        float p[3];
+        c.cost = place(u, v, p);
+        c.u = u;
+        c.v = v;
+        c.stamp = version[u] + version[v];
+        return true;
+    };
+    for (uint64_t e : edges) {
+        DecimateCollapse c;
+        if (candidate(static_cast<uint32_t>(e >> 32), static_cast<uint32_t>(e & 0xffffffffu), c)) {
+            heap.push_back(c);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end());
+    std::vector<uint64_t>().swap(edges);
+    size_t pushed = 0;
+    auto push = [&](uint32_t u, uint32_t v) {
+        DecimateCollapse c;
+        if (candidate(u, v, c)) {
+            heap.push_back(c);
+            std::push_heap(heap.begin(), heap.end());
+            ++pushed;
+        }
+    };
+
+    // Other ends of the collapses refused at each vertex, tried again when a collapse
+    // next to the vertex changes its neighbourhood
+    std::vector<std::vector<uint32_t>> waiting(nvertices);
+    auto wait = [&](uint32_t u, uint32_t v) {
+        if (std::find(waiting[u].begin(), waiting[u].end(), v) == waiting[u].end()) {
+            waiting[u].push_back(v);
+            waiting[v].push_back(u);
+        }
+    };
+
+    // Rings of neighbours are gathered by marking vertices with the current round
+    std::vector<uint32_t> mark(nvertices, 0);
+    uint32_t round = 0;
+    std::vector<uint32_t> ring;
+
+    // Whether moving the corner at vertex moved of face f to p keeps the face facing the same way
+    auto keeps_orientation = [&](uint32_t f, uint32_t moved, const float* p) {
+        float before[3][3], after[3][3];
+        for (int corner = 0; corner < 3; ++corner) {
+            uint32_t w = faces[3 * f + corner];
+            for (int a = 0; a < 3; ++a) {
+                before[corner][a] = position[3 * w + a];
+                after[corner][a] = w == moved ? p[a] : position[3 * w + a];
+            }
+        }
+        auto face_normal = [](float t[3][3], double* n) {
+            double e1[3] = { t[1][0] - t[0][0], t[1][1] - t[0][1], t[1][2] - t[0][2] };
+            double e2[3] = { t[2][0] - t[0][0], t[2][1] - t[0][1], t[2][2] - t[0][2] };
+            n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+            n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+            n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        };
+        double n0[3], n1[3];
+        face_normal(before, n0);
+        face_normal(after, n1);
+        double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+        double length0 = n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2];
+        double length1 = n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2];
+        // Allow the face to turn by up to about 80 degrees, and not to collapse to a line
+        return length1 > 1e-12 * length0 && dot > 0.17 * std::sqrt(length0 * length1);
+    };
+
+    std::vector<uint32_t> kept;
+    size_t liveFaces = nfaces;
+    while (liveFaces > targetTriangles && !heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end());
+        DecimateCollapse c = heap.back();
+        heap.pop_back();
+        uint32_t u = c.u, v = c.v;
+        if (!vertexAlive[u] || !vertexAlive[v] || version[u] + version[v] != c.stamp) {
+            continue;
+        }
+        if (c.cost > maxError) {
+            break;
+        }
+        float p[3];
+        place(u, v, p);
+        for (uint32_t w : { u, v }) {
+            std::vector<uint32_t>& list = vertexFaces[w];
+            list.erase(std::remove_if(list.begin(), list.end(), [&](uint32_t f) { return !faceAlive[f]; }), list.end());
+        }
+
+        // Link condition: an interior edge of a manifold shares exactly two neighbours.
+        // Gather the rings of u and v into ring, counting the vertices in both.
+        round += 2;
+        ring.clear();
+        for (uint32_t f : vertexFaces[u]) {
+            for (int corner = 0; corner < 3; ++corner) {
+                uint32_t w = faces[3 * f + corner];
+                if (w != u && w != v && mark[w] != round) {
+                    mark[w] = round;
+                    ring.push_back(w);
+                }
+            }
+        }
+        size_t shared = 0;
+        for (uint32_t f : vertexFaces[v]) {
+            for (int corner = 0; corner < 3; ++corner) {
+                uint32_t w = faces[3 * f + corner];
+                if (w == u || w == v || mark[w] == round + 1) {
+                    continue;
+                }
+                if (mark[w] == round) {
+                    ++shared;
+                } else {
+                    ring.push_back(w);
+                }
+                mark[w] = round + 1;
+            }
+        }
+        if (shared != 2) {
+            wait(u, v);
+            continue;
+        }
+
+        // Faces around u or v that survive must not fold over
+        bool valid = true;
+        for (uint32_t moved : { u, v }) {
+            uint32_t other = moved == u ? v : u;
+            for (uint32_t f : vertexFaces[moved]) {
+                const uint32_t* t = &faces[3 * f];
+                if (t[0] != other && t[1] != other && t[2] != other && !keeps_orientation(f, moved, p)) {
+                    valid = false;
+                    break;
+                }
+            }
+            if (!valid) {
+                break;
+            }
+        }
+        if (!valid) {
+            wait(u, v);
+            continue;
+        }
+
+        // Collapse v into u
+        for (int a = 0; a < 3; ++a) {
+            position[3 * u + a] = p[a];
+        }
+        if (hasNormals) {
+            float* nu = &normal[3 * u];
+            const float* nv = &normal[3 * v];
+            float n[3] = { nu[0] + nv[0], nu[1] + nv[1], nu[2] + nv[2] };
+            float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (length > 0) {
+                nu[0] = n[0] / length, nu[1] = n[1] / length, nu[2] = n[2] / length;
+            }
+        }
+        quadric[u] += quadric[v];
+        vertexAlive[v] = 0;
+        ++version[u];
+
+        kept.clear();
+        for (uint32_t f : vertexFaces[u]) {
+            if (faceAlive[f]) {
+                const uint32_t* t = &faces[3 * f];
+                if (t[0] == v || t[1] == v || t[2] == v) {
+                    // The list of its third vertex drops it when next compacted
+                    faceAlive[f] = 0;
+                    --liveFaces;
+                } else {
+                    kept.push_back(f);
+                }
+            }
+        }
+        for (uint32_t f : vertexFaces[v]) {
+            if (faceAlive[f]) {
+                for (int corner = 0; corner < 3; ++corner) {
+                    if (faces[3 * f + corner] == v) {
+                        faces[3 * f + corner] = u;
+                    }
+                }
+                kept.push_back(f);
+            }
+        }
+        vertexFaces[u].swap(kept);
+        std::vector<uint32_t>().swap(vertexFaces[v]);
+
+        // The edges around the merged vertex have new costs, and the collapses waiting at
+        // its neighbours may have become possible
+        std::vector<uint32_t>().swap(waiting[u]);
+        std::vector<uint32_t>().swap(waiting[v]);
+        for (uint32_t w : ring) {
+            push(u, w);
+            for (uint32_t x : waiting[w]) {
+                std::vector<uint32_t>& other = waiting[x];
+                other.erase(std::remove(other.begin(), other.end(), w), other.end());
+                if (vertexAlive[x] && x != u) {
+                    push(w, x);
+                }
+            }
+            waiting[w].clear();
+        }
+
+        // Drop the stale entries once they are most of the heap. A live face has three
+        // edges, each shared with one other face, so there are about 3 / 2 live entries
+        // per live face. Waiting for as many pushes as live faces between two passes keeps
+        // the cost of a pass to a few operations per push.
+        if (heap.size() > 3 * liveFaces && pushed > liveFaces) {
+            heap.erase(std::remove_if(heap.begin(), heap.end(), [&](const DecimateCollapse& e) {
+                return !vertexAlive[e.u] || !vertexAlive[e.v] || version[e.u] + version[e.v] != e.stamp;
+            }), heap.end());
+            std::make_heap(heap.begin(), heap.end());
+            pushed = 0;
+        }
+    }
+
+    // Compact the surviving vertices and faces
+    MCMesh result;
+    std::vector<uint32_t> remap(nvertices, 0xffffffffu);
+    for (size_t f = 0; f < nfaces; ++f)
+    {
+        if (!faceAlive[f]) {
+            continue;
+        }
+        for (int corner = 0; corner < 3; ++corner) {
+            uint32_t w = faces[3 * f + corner];
+            if (remap[w] == 0xffffffffu) {
+                remap[w] = static_cast<uint32_t>(result.vertices.size() / 3);
+                result.vertices.insert(result.vertices.end(), &position[3 * w], &position[3 * w] + 3);
+                if (hasNormals) {
+                    result.normals.insert(result.normals.end(), &normal[3 * w], &normal[3 * w] + 3);
+                }
+            }
+            result.indices.push_back(remap[w]);
+        }
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,404 @@
+#ifndef DUALCONTOURING_HPP
+#define DUALCONTOURING_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MarchingCubes.hpp"
+#include "SpanSpace.hpp"
+
+// Dual extractors, taking the same inputs as marching_cubes. Instead of triangles inside
+// each cube they put one vertex in every cell the surface passes through and join the four
+// cells around every grid edge with a sign change by a quad, split into two triangles.
+// Surface nets puts the vertex at the mean of the cell's edge crossings. Dual contouring
+// puts it where the planes through the crossings, normal to the field gradient, best
+// meet (the minimiser of their quadric error), which keeps sharp features; the solve is
+// pulled towards the mean by a small weight so flat and degenerate cells stay stable.
+// Both honour MCOptions threads, slabDepth, cull, normals and stats; placement does not
+// apply, crossings are always interpolated linearly.
+
+const uint32_t DC_NONE = 0xffffffffu;
+
+// Weight of the mean of the crossings in the dual contouring solve
+const float DC_MASS_POINT_WEIGHT = 0.05f;
+
+// Position of the vertex of a cell with corner values vals (in the vals[] order of
+// marching_cubes_slab) whose origin is corner. With qef false it is the mean of the edge
+// crossings, otherwise the regularised minimiser of their quadric error.
+template <typename Field>
+void dc_cell_vertex(
+        const Field& f,
+        float isovalue,
+        float stepsize,
+        int cubeindex,
+        const std::array<float, 8>& vals,
+        const float* corner,
+        bool qef,
+        float* p,
+        MCStats& stats)
+{
+    float points[12][3];
+    int count = 0;
+    float mass[3] = { 0, 0, 0 };
+    for (int edge = 0; edge < 12; ++edge)
+    {
+        int c0 = edgeCorners[edge][0];
+        int c1 = edgeCorners[edge][1];
+        if (((cubeindex >> c0) & 1) == ((cubeindex >> c1) & 1)) {
+            continue;
+        }
+        float t = mc_crossing(vals[c0], vals[c1], isovalue);
+        float* q = points[count++];
+        for (int a = 0; a < 3; ++a) {
+            q[a] = corner[a] + edgeOffset[edge][a] * stepsize;
+        }
+        q[edgeAxis[edge]] += t * stepsize;
+        for (int a = 0; a < 3; ++a) {
+            mass[a] += q[a];
+        }
+    }
+    for (int a = 0; a < 3; ++a) {
+        p[a] = mass[a] / count;
+    }
+    if (!qef) {
+        return;
+    }
+
+    // Normal equations of sum (n . (x - q))^2 + w |x - mass|^2, solved for the offset
+    // d = x - mass so that the numbers stay on the scale of a cell
+    float ata[3][3] = { { DC_MASS_POINT_WEIGHT, 0, 0 }, { 0, DC_MASS_POINT_WEIGHT, 0 }, { 0, 0, DC_MASS_POINT_WEIGHT } };
+    float atb[3] = { 0, 0, 0 };
+    for (int c = 0; c < count; ++c)
+    {
+        float normal[3];
+        mc_vertex_normal(f, points[c], stepsize, normal, stats);
+        float distance = 0;
+        for (int a = 0; a < 3; ++a) {
+            distance += normal[a] * (points[c][a] - p[a]);
+        }
+        for (int a = 0; a < 3; ++a) {
+            for (int b = 0; b < 3; ++b) {
+                ata[a][b] += normal[a] * normal[b];
+            }
+            atb[a] += normal[a] * distance;
+        }
+    }
+
+    // Cramer's rule, the weight keeps the determinant positive
+    auto det3 = [](float m[3][3]) {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+             - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+             + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    };
+    float det = det3(ata);
+    if (!(det > 0.0f)) {
+        return;
+    }
+    for (int a = 0; a < 3; ++a)
+    {
+        float m[3][3];
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                m[r][c] = c == a ? atb[r] : ata[r][c];
+            }
+        }
+        // Keep the vertex inside its cell so the quads cannot fold over
+        float x = p[a] + det3(m) / det;
+        p[a] = std::min(std::max(x, corner[a]), corner[a] + stepsize);
+    }
+}
+
+// Welded output of one slab, with the vertex index of every cell of the layer below the
+// slab and of its top layer, used to weld it to its neighbours.
+struct DCSlabOutput {
+    MCMesh mesh;
+    std::vector<uint32_t> firstCells, lastCells;
+};
+
+// Extracts the quads of the grid edges on slices k0..k1-1 and inside layers k0..k1-1.
+// The cells of layer k0 - 1 are computed again for the edges of slice k0 and welded to
+// the slab below afterwards.
+template <typename Field>
+void dual_contouring_slab(
+        const Field& f,
+        float isovalue,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        bool qef,
+        bool normals,
+        int k0,
+        int k1,
+        DCSlabOutput& out,
+        MCStats& stats)
+{
+    int n = nsteps + 1;
+    int m = nsteps;
+    constexpr bool lattice = mc_has_lattice<Field>::value;
+    std::vector<float> lower(lattice ? 0 : n * n);
+    std::vector<float> upper(lattice ? 0 : n * n);
+    MCRow row(min, stepsize, lattice ? 0 : n);
+
+    // Vertex of each cell of the previous and the current layer
+    std::vector<uint32_t> below(m * m, DC_NONE), current(m * m, DC_NONE);
+    MCMesh& mesh = out.mesh;
+
+    // Adds the two triangles of the quad a, b, c, d (counter-clockwise seen from the side
+    // the field increases towards), split along the shorter diagonal
+    auto quad = [&](uint32_t a, uint32_t b, uint32_t c, uint32_t d, bool flip) {
+        if (a == DC_NONE || b == DC_NONE || c == DC_NONE || d == DC_NONE) {
+            return;
+        }
+        if (flip) {
+            std::swap(b, d);
+        }
+        auto distance2 = [&](uint32_t u, uint32_t v) {
+            float s = 0;
+            for (int axis = 0; axis < 3; ++axis) {
+                float e = mesh.vertices[3 * u + axis] - mesh.vertices[3 * v + axis];
+                s += e * e;
+            }
+            return s;
+        };
+        if (distance2(a, c) <= distance2(b, d)) {
+            mesh.indices.insert(mesh.indices.end(), { a, b, c, a, c, d });
+        } else {
+            mesh.indices.insert(mesh.indices.end(), { a, b, d, b, c, d });
+        }
+    };
+
+    int kStart = std::max(0, k0 - 1);
+    const float* lowerValues = mc_load_slice(f, min, stepsize, nsteps, blocks, kStart, row, lower, stats);
+    for (int k = kStart; k < k1; ++k)
+    {
+        const float* upperValues = mc_load_slice(f, min, stepsize, nsteps, blocks, k + 1, row, upper, stats);
+        std::fill(current.begin(), current.end(), DC_NONE);
+        int bz = k / blocks.size;
+
+        // One vertex per cell of the layer that the surface passes through
+        for (int j = 0; j < m; ++j)
+        {
+            const float* lo0 = lowerValues + j * n;
+            const float* lo1 = lo0 + n;
+            const float* up0 = upperValues + j * n;
+            const float* up1 = up0 + n;
+            int by = j / blocks.size;
+
+            for (int bx = 0; bx < blocks.count; ++bx)
+            {
+                if (!blocks.is_active(bx, by, bz)) {
+                    continue;
+                }
+                int iEnd = std::min((bx + 1) * blocks.size, m);
+                for (int i = bx * blocks.size; i < iEnd; ++i)
+                {
+                    std::array<float, 8> vals = {
+                        lo0[i], lo0[i + 1], up0[i + 1], up0[i],
+                        lo1[i], lo1[i + 1], up1[i + 1], up1[i],
+                    };
+                    int cubeindex = 0;
+                    for (int c = 0; c < 8; ++c) {
+                        cubeindex |= (vals[c] < isovalue ? 1 : 0) << c;
+                    }
+                    if (cubeindex == 0 || cubeindex == 255) {
+                        continue;
+                    }
+
+                    float corner[3] = { min + i * stepsize, min + j * stepsize, min + k * stepsize };
+                    float p[3];
+                    dc_cell_vertex(f, isovalue, stepsize, cubeindex, vals, corner, qef, p, stats);
+                    current[j * m + i] = static_cast<uint32_t>(mesh.vertices.size() / 3);
+                    mesh.vertices.insert(mesh.vertices.end(), p, p + 3);
+                    if (normals) {
+                        float normal[3];
+                        mc_vertex_normal(f, p, stepsize, normal, stats);
+                        mesh.normals.insert(mesh.normals.end(), normal, normal + 3);
+                    }
+                }
+            }
+        }
+
+        if (k == k0 - 1) {
+            out.firstCells = current;
+        }
+        else
+        {
+            // Each edge with a sign change is joined by the cell it is the last corner of.
+            // Cells outside the active blocks have no vertex, so only those are walked.
+            for (int j = 0; j < m; ++j)
+            {
+                int by = j / blocks.size;
+                for (int bx = 0; bx < blocks.count; ++bx)
+                {
+                    if (!blocks.is_active(bx, by, bz)) {
+                        continue;
+                    }
+                    int iEnd = std::min((bx + 1) * blocks.size, m);
+                    for (int i = bx * blocks.size; i < iEnd; ++i)
+                    {
+                        uint32_t cell = current[j * m + i];
+                        if (cell == DC_NONE) {
+                            continue;
+                        }
+                        bool inside = lowerValues[j * n + i] < isovalue;
+
+                        // z edge from (i, j, k) to (i, j, k + 1)
+                        if (i > 0 && j > 0 && inside != (upperValues[j * n + i] < isovalue)) {
+                            quad(current[(j - 1) * m + i - 1], current[(j - 1) * m + i], cell, current[j * m + i - 1], !inside);
+                        }
+                        if (k == 0) {
+                            continue;
+                        }
+                        // x edge from (i, j, k) to (i + 1, j, k)
+                        if (j > 0 && inside != (lowerValues[j * n + i + 1] < isovalue)) {
+                            quad(below[(j - 1) * m + i], below[j * m + i], cell, current[(j - 1) * m + i], !inside);
+                        }
+                        // y edge from (i, j, k) to (i, j + 1, k)
+                        if (i > 0 && inside != (lowerValues[(j + 1) * n + i] < isovalue)) {
+                            quad(below[j * m + i - 1], current[j * m + i - 1], cell, below[j * m + i], !inside);
+                        }
+                    }
+                }
+            }
+        }
+
+        std::swap(below, current);
+        std::swap(lower, upper);
+        lowerValues = upperValues;
+    }
+    out.lastCells.swap(below);
+}
+
+// Runs the dual extractor on the given blocks and welds the slabs in z order, so the
+// mesh is identical for every thread count.
+template <typename Field>
+MCMesh dc_extract(
+        const Field& f,
+        float isovalue,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        bool qef,
+        const MCOptions& options,
+        std::vector<MCStats> slabStats)
+{
+    int depth = mc_slab_depth(nsteps, options);
+    int nslabs = (nsteps + depth - 1) / depth;
+    std::vector<DCSlabOutput> slabs(nslabs);
+    size_t first = slabStats.size();
+    slabStats.resize(first + nslabs);
+    mc_run_slabs(nsteps, depth, nslabs, options, [&](int s, int k0, int k1) {
+        dual_contouring_slab(f, isovalue, min, stepsize, nsteps, blocks, qef, options.normals, k0, k1, slabs[s], slabStats[first + s]);
+    });
+    mc_report_stats(slabStats, options);
+
+    if (nslabs == 1) {
+        return std::move(slabs[0].mesh);
+    }
+
+    MCMesh mesh;
+    std::vector<uint32_t> previous;
+    for (int s = 0; s < nslabs; ++s)
+    {
+        DCSlabOutput& slab = slabs[s];
+        std::vector<uint32_t> global(slab.mesh.vertices.size() / 3, DC_NONE);
+
+        // The cells of the layer below the slab are the top layer of the slab below
+        if (s > 0) {
+            const DCSlabOutput& prior = slabs[s - 1];
+            for (size_t c = 0; c < slab.firstCells.size(); ++c) {
+                if (slab.firstCells[c] != DC_NONE && prior.lastCells[c] != DC_NONE) {
+                    global[slab.firstCells[c]] = previous[prior.lastCells[c]];
+                }
+            }
+        }
+
+        for (size_t v = 0; v < global.size(); ++v) {
+            if (global[v] == DC_NONE) {
+                global[v] = static_cast<uint32_t>(mesh.vertices.size() / 3);
+                mesh.vertices.insert(mesh.vertices.end(), slab.mesh.vertices.begin() + 3 * v, slab.mesh.vertices.begin() + 3 * v + 3);
+                if (options.normals) {
+                    mesh.normals.insert(mesh.normals.end(), slab.mesh.normals.begin() + 3 * v, slab.mesh.normals.begin() + 3 * v + 3);
+                }
+            }
+        }
+        for (uint32_t index : slab.mesh.indices) {
+            mesh.indices.push_back(global[index]);
+        }
+
+        if (s > 0) {
+            slabs[s - 1] = DCSlabOutput();
+        }
+        previous.swap(global);
+    }
+    return mesh;
+}
+
+template <typename Field>
+MCMesh dc_extract(Field f, float isovalue, float min, float max, float stepsize, bool qef, const MCOptions& options)
+{
+    int nsteps = static_cast<int>((max - min) / stepsize);
+    if (nsteps <= 0) {
+        mc_report_stats(std::vector<MCStats>(), options);
+        return MCMesh();
+    }
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = mc_make_blocks(f, isovalue, min, stepsize, nsteps, options, slabStats[0]);
+    return dc_extract(f, isovalue, min, stepsize, nsteps, blocks, qef, options, slabStats);
+}
+
+// Surface nets over [min, max]^3: one vertex per cell at the mean of its edge crossings.
+template <typename Field>
+MCMesh surface_nets(
+        Field f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        const MCOptions& options = MCOptions())
+{
+    return dc_extract(f, isovalue, min, max, stepsize, false, options);
+}
+
+// Dual contouring over [min, max]^3: one vertex per cell at the minimiser of the quadric
+// error of its crossing planes.
+template <typename Field>
+MCMesh dual_contouring(
+        Field f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        const MCOptions& options = MCOptions())
+{
+    return dc_extract(f, isovalue, min, max, stepsize, true, options);
+}
+
+// The same from a span space index, visiting only the blocks whose range holds isovalue.
+inline MCMesh dc_extract(const MCSpanIndex& index, float isovalue, bool qef, const MCOptions& options)
+{
+    if (index.nsteps <= 0) {
+        mc_report_stats(std::vector<MCStats>(), options);
+        return MCMesh();
+    }
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = index.active_blocks(isovalue, slabStats[0]);
+    return dc_extract(index, isovalue, index.min, index.stepsize, index.nsteps, blocks, qef, options, slabStats);
+}
+
+inline MCMesh surface_nets(const MCSpanIndex& index, float isovalue, const MCOptions& options = MCOptions())
+{
+    return dc_extract(index, isovalue, false, options);
+}
+
+inline MCMesh dual_contouring(const MCSpanIndex& index, float isovalue, const MCOptions& options = MCOptions())
+{
+    return dc_extract(index, isovalue, true, options);
+}
+
+#endif
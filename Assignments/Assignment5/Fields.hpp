@@ -0,0 +1,147 @@
+#ifndef FIELDS_HPP
+#define FIELDS_HPP
+
+#include <cmath>
+
+#include "FieldSIMD.hpp"
+#include "Interval.hpp"
+
+// The scalar fields used by the assignment. Each one is a function object so that
+// marching_cubes can inline it, and a plain function for code that wants a pointer.
+// eval_row evaluates a row of SoA samples at vector width for the slice sampler, and
+// bounds gives an interval holding every value of the field over a box, which lets
+// marching_cubes skip blocks that cannot contain the isovalue, and gradient gives the
+// analytic gradient used for smooth vertex normals.
+
+struct Field1 {
+    float operator()(float x, float y, float z) const {
+        return x*x + y*y + z*z;
+    }
+
+    void eval_row(const float* x, const float* y, const float* z, float* out, int count) const {
+        simd_eval_row([](SimdFloat x, SimdFloat y, SimdFloat z) {
+            return x * x + y * y + z * z;
+        }, x, y, z, out, count);
+    }
+
+    void gradient(float x, float y, float z, float* g) const {
+        g[0] = 2*x;
+        g[1] = 2*y;
+        g[2] = 2*z;
+    }
+
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        return sqr(x) + sqr(y) + sqr(z);
+    }
+};
+
+struct Field2 {
+    float operator()(float x, float y, float z) const {
+        return sin(x*y*z);
+    }
+
+    void eval_row(const float* x, const float* y, const float* z, float* out, int count) const {
+        simd_eval_row([](SimdFloat x, SimdFloat y, SimdFloat z) {
+            return simd_sin(x * y * z);
+        }, x, y, z, out, count);
+    }
+
+    void gradient(float x, float y, float z, float* g) const {
+        float c = cos(x*y*z);
+        g[0] = c*y*z;
+        g[1] = c*x*z;
+        g[2] = c*x*y;
+    }
+
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        return sin(x * y * z);
+    }
+};
+
+struct Field3 {
+    float operator()(float x, float y, float z) const {
+        return sin(x)*cos(y)*sin(z);
+    }
+
+    void eval_row(const float* x, const float* y, const float* z, float* out, int count) const {
+        simd_eval_row([](SimdFloat x, SimdFloat y, SimdFloat z) {
+            return simd_sin(x) * simd_cos(y) * simd_sin(z);
+        }, x, y, z, out, count);
+    }
+
+    void gradient(float x, float y, float z, float* g) const {
+        g[0] = cos(x)*cos(y)*sin(z);
+        g[1] = -sin(x)*sin(y)*sin(z);
+        g[2] = sin(x)*cos(y)*cos(z);
+    }
+
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        return sin(x) * cos(y) * sin(z);
+    }
+};
+
+struct Field4 {
+    float operator()(float x, float y, float z) const {
+        return y - sin(x)*cos(z);
+    }
+
+    void eval_row(const float* x, const float* y, const float* z, float* out, int count) const {
+        simd_eval_row([](SimdFloat x, SimdFloat y, SimdFloat z) {
+            return y - simd_sin(x) * simd_cos(z);
+        }, x, y, z, out, count);
+    }
+
+    void gradient(float x, float, float z, float* g) const {
+        g[0] = -cos(x)*cos(z);
+        g[1] = 1;
+        g[2] = sin(x)*sin(z);
+    }
+
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        return y - sin(x) * cos(z);
+    }
+};
+
+struct Field5 {
+    float operator()(float x, float y, float z) const {
+        return x*x - y*y - z*z - z;
+    }
+
+    void eval_row(const float* x, const float* y, const float* z, float* out, int count) const {
+        simd_eval_row([](SimdFloat x, SimdFloat y, SimdFloat z) {
+            return x * x - y * y - z * z - z;
+        }, x, y, z, out, count);
+    }
+
+    void gradient(float x, float y, float z, float* g) const {
+        g[0] = 2*x;
+        g[1] = -2*y;
+        g[2] = -2*z - 1;
+    }
+
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        return sqr(x) - sqr(y) - sqr(z) - z;
+    }
+};
+
+inline float f1(float x, float y, float z) {
+    return Field1()(x, y, z);
+}
+
+inline float f2(float x, float y, float z) {
+    return Field2()(x, y, z);
+}
+
+inline float f3(float x, float y, float z) {
+    return Field3()(x, y, z);
+}
+
+inline float f4(float x, float y, float z) {
+    return Field4()(x, y, z);
+}
+
+inline float f5(float x, float y, float z) {
+    return Field5()(x, y, z);
+}
+
+#endif
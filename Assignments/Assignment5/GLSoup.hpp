@@ -0,0 +1,290 @@
+#ifndef GLSOUP_HPP
+#define GLSOUP_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "MarchingCubes.hpp"
+#include "BrickMesher.hpp"
+
+// Triangle soup extracted straight into GL buffers. The counting pass of
+// marching_cubes_into sizes the vertex and normal buffers, which are mapped with
+// glMapBufferRange for the filling pass to write into, so the soup never goes through a
+// std::vector and there is no upload. Storage is only reallocated when a surface outgrows
+// it. Include GL/glew.h (or GL/gl.h and GL/glext.h with GL_GLEXT_PROTOTYPES) first, and
+// call everything on the thread of the GL context.
+struct MCGLSoup {
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint nbo = 0;
+
+    // Bytes of storage in each buffer, and the vertices of the last extraction
+    size_t capacity = 0;
+    GLsizei vertexCount = 0;
+
+    // Where the last extraction mapped the buffers, or null
+    float* vertices = nullptr;
+    float* normals = nullptr;
+
+    // Vertices go to attribute 0 and normals to attribute 1
+    void create() {
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &nbo);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, nbo);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glBindVertexArray(0);
+    }
+
+    void destroy() {
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &nbo);
+        vao = vbo = nbo = 0;
+        capacity = 0;
+        vertexCount = 0;
+    }
+
+    // Maps room for the given triangles in both buffers, growing them by half again when
+    // they are too small so a surface that keeps growing does not reallocate every time.
+    // Leaves the pointers null when there is nothing to map or mapping fails.
+    void map(size_t triangles, float*& v, float*& n) {
+        size_t bytes = triangles * 9 * sizeof(float);
+        vertexCount = static_cast<GLsizei>(3 * triangles);
+        vertices = normals = nullptr;
+        if (bytes == 0) {
+            return;
+        }
+        bool grow = bytes > capacity;
+        if (grow) {
+            capacity = std::max(bytes, capacity + capacity / 2);
+        }
+        GLuint buffers[2] = { vbo, nbo };
+        float* mapped[2] = { nullptr, nullptr };
+        for (int b = 0; b < 2; ++b) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[b]);
+            if (grow) {
+                glBufferData(GL_ARRAY_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
+            }
+            // invalidating lets the driver hand out fresh storage while the last surface is
+            // still being drawn from the old
+            mapped[b] = static_cast<float*>(
+                glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        }
+        vertices = mapped[0];
+        normals = mapped[1];
+        if (!vertices || !normals) {
+            unmap();
+            return;
+        }
+        v = vertices;
+        n = normals;
+    }
+
+    // Unmaps the buffers. Returns false when either lost its contents while mapped, which
+    // GL allows on events such as a mode switch, or was never mapped.
+    bool unmap() {
+        bool ok = vertices && normals;
+        GLuint buffers[2] = { vbo, nbo };
+        float* mapped[2] = { vertices, normals };
+        for (int b = 0; b < 2; ++b) {
+            if (mapped[b]) {
+                glBindBuffer(GL_ARRAY_BUFFER, buffers[b]);
+                ok = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE && ok;
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        vertices = normals = nullptr;
+        return ok;
+    }
+
+    // Runs extract(allocate), where extract calls marching_cubes_into with allocate, so the
+    // soup lands in the buffers. Returns false and draws nothing when the buffers could not
+    // be mapped or lost their contents.
+    template <typename Extract>
+    bool update(Extract extract) {
+        bool mapped = false;
+        extract([&](size_t triangles, float*& v, float*& n) {
+            map(triangles, v, n);
+            mapped = vertices != nullptr;
+        });
+        if (!mapped) {
+            bool empty = vertexCount == 0;
+            vertexCount = 0;
+            return empty;
+        }
+        if (!unmap()) {
+            vertexCount = 0;
+            return false;
+        }
+        return true;
+    }
+
+    void draw() const {
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+        glBindVertexArray(0);
+    }
+};
+
+// Soup of an MCBrickMesher in one pair of GL buffers holding a range of vertices per brick,
+// so after an edit only the bricks update extracted again are uploaded, each into its own
+// range with glBufferSubData. A brick that outgrows its range moves to the free space at
+// the end of the buffers. When that runs out, or half of the buffers is left behind by
+// moved bricks, every brick is laid out again with a quarter more room than it needs and
+// the whole soup is uploaded at once. The bricks are drawn with one glMultiDrawArrays.
+// Include GL as for MCGLSoup; normals are uploaded when the mesher extracts them.
+struct MCGLBrickSoup {
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint nbo = 0;
+
+    // Vertices the buffers have room for, the end of the last range, and the vertices of
+    // ranges left behind by bricks that moved
+    GLint capacity = 0;
+    GLint end = 0;
+    GLint unused = 0;
+
+    // Range of each brick: the first vertex, the vertices in use and the room
+    std::vector<GLint> first;
+    std::vector<GLsizei> count;
+    std::vector<GLsizei> room;
+
+    // Ranges of the bricks with triangles, as glMultiDrawArrays takes them
+    std::vector<GLint> drawFirst;
+    std::vector<GLsizei> drawCount;
+
+    // Vertices uploaded by the last update, and whether it laid the buffers out again
+    size_t uploaded = 0;
+    bool relaid = false;
+
+    void create() {
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &nbo);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, nbo);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glBindVertexArray(0);
+    }
+
+    void destroy() {
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &nbo);
+        vao = vbo = nbo = 0;
+        capacity = end = unused = 0;
+        first.clear();
+        count.clear();
+        room.clear();
+        drawFirst.clear();
+        drawCount.clear();
+    }
+
+    // Uploads the bricks the last mesher.update extracted, or every brick after a reset
+    void update(const MCBrickMesher& mesher) {
+        uploaded = 0;
+        relaid = first.size() != mesher.bricks.size();
+        for (size_t c = 0; c < mesher.changed.size() && !relaid; ++c) {
+            int b = mesher.changed[c];
+            const MCBrickMesher::Brick& brick = mesher.bricks[b];
+            GLsizei n = static_cast<GLsizei>(brick.vertices.size() / 3);
+            if (n > room[b]) {
+                GLsizei grown = n + n / 4;
+                if (end + grown > capacity) {
+                    relaid = true;
+                    break;
+                }
+                unused += room[b];
+                first[b] = end;
+                room[b] = grown;
+                end += grown;
+            }
+            count[b] = n;
+            upload(brick, first[b]);
+        }
+        if (relaid || unused > capacity / 2) {
+            layout(mesher);
+        }
+
+        drawFirst.clear();
+        drawCount.clear();
+        for (size_t b = 0; b < count.size(); ++b) {
+            if (count[b] > 0) {
+                drawFirst.push_back(first[b]);
+                drawCount.push_back(count[b]);
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    size_t triangles() const {
+        size_t total = 0;
+        for (GLsizei n : drawCount) {
+            total += n / 3;
+        }
+        return total;
+    }
+
+    void draw() const {
+        glBindVertexArray(vao);
+        glMultiDrawArrays(GL_TRIANGLES, drawFirst.data(), drawCount.data(), static_cast<GLsizei>(drawFirst.size()));
+        glBindVertexArray(0);
+    }
+
+private:
+    void upload(const MCBrickMesher::Brick& brick, GLint at) {
+        if (brick.vertices.empty()) {
+            return;
+        }
+        GLintptr offset = static_cast<GLintptr>(at) * 3 * sizeof(float);
+        GLsizeiptr bytes = brick.vertices.size() * sizeof(float);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, brick.vertices.data());
+        if (brick.normals.size() == brick.vertices.size()) {
+            glBindBuffer(GL_ARRAY_BUFFER, nbo);
+            glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, brick.normals.data());
+        }
+        uploaded += brick.vertices.size() / 3;
+    }
+
+    // Gives every brick a quarter more room than it needs, leaves half of that total free
+    // at the end for bricks that grow, and uploads them all
+    void layout(const MCBrickMesher& mesher) {
+        size_t bricks = mesher.bricks.size();
+        first.assign(bricks, 0);
+        count.assign(bricks, 0);
+        room.assign(bricks, 0);
+        end = 0;
+        for (size_t b = 0; b < bricks; ++b) {
+            GLsizei n = static_cast<GLsizei>(mesher.bricks[b].vertices.size() / 3);
+            first[b] = end;
+            count[b] = n;
+            room[b] = n + n / 4;
+            end += room[b];
+        }
+        capacity = std::max(end + end / 2, 3 * 1024);
+        unused = 0;
+        relaid = true;
+        uploaded = 0;
+        for (GLuint buffer : { vbo, nbo }) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(capacity) * 3 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+        }
+        for (size_t b = 0; b < bricks; ++b) {
+            upload(mesher.bricks[b], first[b]);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,710 @@
+#ifndef LEVELOFDETAIL_HPP
+#define LEVELOFDETAIL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "MarchingCubes.hpp"
+
+// View-dependent marching cubes. The grid is covered by an octree of blocks of
+// blockSize^3 cells, where a block at level l has cells 2^l steps wide, and blocks are split
+// while the viewpoint is near them. The tree is balanced so that blocks touching across a
+// face, edge or corner differ by at most one level.
+//
+// Seams between levels are closed in the spirit of Transvoxel transition cells. On the
+// fine side, samples on the boundary shared with a coarser block are replaced by the
+// linear interpolation of the coarse lattice, so the two sides find the same crossings on
+// every coarse edge and weld them into one vertex. What is left between the fine contour
+// across each coarse cell face and the coarse cell's own contour is a flat loop in the
+// face, which is triangulated by ear clipping.
+
+// Octree node: its level, its first lattice point in steps of the finest grid, and the
+// first of its eight children or -1 for a leaf
+struct MCLodNode {
+    int level;
+    int origin[3];
+    int child;
+};
+
+struct MCLodTree {
+    int blockSize = 0;
+    std::vector<MCLodNode> nodes;
+
+    // Width of a node in finest steps
+    int width(int node) const {
+        return blockSize << nodes[node].level;
+    }
+
+    void split(int node) {
+        int half = width(node) / 2;
+        nodes[node].child = static_cast<int>(nodes.size());
+        for (int octant = 0; octant < 8; ++octant) {
+            MCLodNode c = nodes[node];
+            c.level--;
+            c.child = -1;
+            for (int a = 0; a < 3; ++a) {
+                c.origin[a] += ((octant >> a) & 1) * half;
+            }
+            nodes.push_back(c);
+        }
+    }
+
+    // Leaf holding the point q / 2 in finest steps, or -1 outside the root
+    int locate(const long long q[3]) const {
+        long long root = 2LL * width(0);
+        for (int a = 0; a < 3; ++a) {
+            if (q[a] < 0 || q[a] >= root) {
+                return -1;
+            }
+        }
+        int node = 0;
+        while (nodes[node].child >= 0) {
+            long long half = width(node);
+            int octant = 0;
+            for (int a = 0; a < 3; ++a) {
+                octant |= (q[a] >= 2LL * nodes[node].origin[a] + half ? 1 : 0) << a;
+            }
+            node = nodes[node].child + octant;
+        }
+        return node;
+    }
+
+    // Leaf just past the node in direction d, each component -1, 0 or 1
+    int neighbour(int node, const int d[3]) const {
+        long long q[3];
+        for (int a = 0; a < 3; ++a) {
+            q[a] = 2LL * nodes[node].origin[a] + width(node) + d[a] * (width(node) + 1LL);
+        }
+        return locate(q);
+    }
+};
+
+// Direction d of region r in 0..26, each component -1, 0 or 1. Region r of a block is its
+// lattice points with index 0 on the axes where d is -1 and blockSize where d is 1, and
+// lies against the neighbour in direction d; r = 13 is the block itself.
+inline void mc_lod_direction(int r, int d[3]) {
+    d[0] = r % 3 - 1;
+    d[1] = r / 3 % 3 - 1;
+    d[2] = r / 9 - 1;
+}
+
+// Builds the balanced octree of a root block at level levels, refined towards viewpoint.
+inline MCLodTree mc_lod_tree(float min, float stepsize, int levels, int blockSize, const float viewpoint[3], float detail)
+{
+    MCLodTree tree;
+    tree.blockSize = blockSize;
+    tree.nodes.push_back(MCLodNode{ levels, { 0, 0, 0 }, -1 });
+
+    std::vector<int> stack(1, 0);
+    while (!stack.empty())
+    {
+        int node = stack.back();
+        stack.pop_back();
+        if (tree.nodes[node].level == 0) {
+            continue;
+        }
+        float extent = tree.width(node) * stepsize;
+        float d2 = 0;
+        for (int a = 0; a < 3; ++a) {
+            float lo = min + tree.nodes[node].origin[a] * stepsize;
+            float d = std::max(std::max(lo - viewpoint[a], viewpoint[a] - (lo + extent)), 0.0f);
+            d2 += d * d;
+        }
+        if (d2 < detail * extent * detail * extent) {
+            tree.split(node);
+            for (int octant = 0; octant < 8; ++octant) {
+                stack.push_back(tree.nodes[node].child + octant);
+            }
+        }
+    }
+
+    // Split leaves more than one level coarser than a leaf they touch until none are left
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+        for (int node = 0; node < static_cast<int>(tree.nodes.size()); ++node)
+        {
+            if (tree.nodes[node].child >= 0) {
+                continue;
+            }
+            for (int r = 0; r < 27; ++r) {
+                int d[3];
+                mc_lod_direction(r, d);
+                int other = r == 13 ? -1 : tree.neighbour(node, d);
+                if (other >= 0 && tree.nodes[other].level > tree.nodes[node].level + 1) {
+                    tree.split(other);
+                    changed = true;
+                }
+            }
+        }
+    }
+    return tree;
+}
+
+// Samples of one leaf block, indexed by (k * (blockSize + 1) + j) * (blockSize + 1) + i,
+// and the boundary regions it shares with coarser leaves. The leaf's cells are meshed on
+// their own into mesh, with the edge keys of the vertices on its boundary, which other
+// leaves may share, in shared.
+struct MCLodLeaf {
+    int node;
+    int level;
+    int origin[3];
+    bool active = true;
+    bool coarse[27] = {};
+    bool anyCoarse = false;
+    std::vector<float> values;
+    MCMesh mesh;
+    std::vector<std::pair<uint64_t, uint32_t>> shared;
+};
+
+// Samples a leaf's lattice, unless culling shows the isovalue is not in its box. Points
+// are at min + index * stepsize with index on the finest grid, and every row goes through
+// eval_row padded to whole vectors, so a point shared by two leaves gets the same value in
+// both.
+template <typename Field>
+void mc_lod_sample(const Field& f, float isovalue, float min, float stepsize, int blockSize,
+                   const MCOptions& options, MCLodLeaf& leaf, MCStats& stats)
+{
+    int n = blockSize + 1;
+    int step = 1 << leaf.level;
+    if (options.cull) {
+        float lo[3], hi[3];
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = min + leaf.origin[a] * stepsize;
+            hi[a] = min + (leaf.origin[a] + blockSize * step) * stepsize;
+        }
+        Interval range;
+        if (mc_field_range(f, lo, hi, options, range, stats)) {
+            float pad = 1e-5f * (1.0f + std::fabs(range.lo) + std::fabs(range.hi));
+            if (range.hi < isovalue - pad || range.lo > isovalue + pad) {
+                leaf.active = false;
+                stats.cellsSkipped += static_cast<long long>(blockSize) * blockSize * blockSize;
+                return;
+            }
+        }
+    }
+
+    int padded = (n + SimdFloat::width - 1) / SimdFloat::width * SimdFloat::width;
+    std::vector<float> x(padded), y(padded), z(padded), out(padded);
+    for (int i = 0; i < padded; ++i) {
+        x[i] = min + (leaf.origin[0] + std::min(i, n - 1) * step) * stepsize;
+    }
+    leaf.values.resize(static_cast<size_t>(n) * n * n);
+    for (int k = 0; k < n; ++k) {
+        for (int j = 0; j < n; ++j) {
+            std::fill(y.begin(), y.end(), min + (leaf.origin[1] + j * step) * stepsize);
+            std::fill(z.begin(), z.end(), min + (leaf.origin[2] + k * step) * stepsize);
+            mc_eval_row(f, x.data(), y.data(), z.data(), out.data(), padded);
+            std::copy(out.begin(), out.begin() + n, leaf.values.begin() + (static_cast<size_t>(k) * n + j) * n);
+        }
+    }
+    stats.fieldEvaluations += static_cast<long long>(n) * n * n;
+}
+
+// Replaces the samples of each boundary region shared with a coarser leaf by the linear
+// interpolation of the coarse lattice, which is every other point of this one.
+inline void mc_lod_coarsen(int blockSize, MCLodLeaf& leaf)
+{
+    int n = blockSize + 1;
+    auto at = [&](int i, int j, int k) -> float& {
+        return leaf.values[(static_cast<size_t>(k) * n + j) * n + i];
+    };
+    for (int r = 0; r < 27; ++r)
+    {
+        if (!leaf.coarse[r]) {
+            continue;
+        }
+        int d[3];
+        mc_lod_direction(r, d);
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = d[a] == 1 ? blockSize : 0;
+            hi[a] = d[a] == -1 ? 0 : blockSize;
+        }
+        for (int k = lo[2]; k <= hi[2]; ++k) {
+            for (int j = lo[1]; j <= hi[1]; ++j) {
+                for (int i = lo[0]; i <= hi[0]; ++i) {
+                    int odd[3] = { i & 1, j & 1, k & 1 };
+                    if (!odd[0] && !odd[1] && !odd[2]) {
+                        continue;
+                    }
+                    // Mean of the coarse points at the ends of the odd axes
+                    float sum = 0;
+                    int count = 0;
+                    for (int c = 0; c < 8; ++c) {
+                        if ((c & ~(odd[0] | odd[1] << 1 | odd[2] << 2)) != 0) {
+                            continue;
+                        }
+                        int p[3] = { i, j, k };
+                        for (int a = 0; a < 3; ++a) {
+                            if (odd[a]) {
+                                p[a] += (c >> a) & 1 ? 1 : -1;
+                            }
+                        }
+                        sum += at(p[0], p[1], p[2]);
+                        ++count;
+                    }
+                    at(i, j, k) = sum / count;
+                }
+            }
+        }
+    }
+}
+
+// Grid edge of a leaf's cube edge, as a key unique over the finest grid, and its ends in
+// lattice points of the leaf. Edges on a coarse lattice line of a coarsened region stand
+// for the coarse edge they are half of, so the leaves on both sides key it the same.
+inline uint64_t mc_lod_edge(const MCLodLeaf& leaf, int blockSize, int i, int j, int k, int edge, int start[3], int& length)
+{
+    int axis = edgeAxis[edge];
+    start[0] = i + edgeOffset[edge][0];
+    start[1] = j + edgeOffset[edge][1];
+    start[2] = k + edgeOffset[edge][2];
+    length = 1;
+    if (leaf.anyCoarse)
+    {
+        for (int r = 0; r < 27 && length == 1; ++r) {
+            int d[3];
+            mc_lod_direction(r, d);
+            if (!leaf.coarse[r] || d[axis] != 0) {
+                continue;
+            }
+            bool inside = true;
+            for (int a = 0; a < 3; ++a) {
+                if (a != axis) {
+                    inside = inside && (d[a] == -1 ? start[a] == 0 : d[a] == 1 ? start[a] == blockSize : start[a] % 2 == 0);
+                }
+            }
+            if (inside) {
+                start[axis] &= ~1;
+                length = 2;
+            }
+        }
+    }
+    uint64_t key = 0;
+    for (int a = 0; a < 3; ++a) {
+        key |= static_cast<uint64_t>(leaf.origin[a] + (start[a] << leaf.level)) << (19 * a);
+    }
+    int scale = leaf.level + (length == 2 ? 1 : 0);
+    return key | static_cast<uint64_t>(axis) << 57 | static_cast<uint64_t>(scale) << 59;
+}
+
+// Index in leaf.mesh of the vertex on a leaf's cube edge, adding it the first time it is
+// seen. slots holds the index of the vertex on each edge of the leaf's lattice by axis and
+// first point, as MCIndexedOutput does for slices; an edge of a coarsened region has the
+// slot of its even end.
+template <typename Field>
+uint32_t mc_lod_vertex(const Field& f, float isovalue, float min, float stepsize, int blockSize,
+                       const MCOptions& options, MCLodLeaf& leaf, int i, int j, int k, int edge,
+                       std::vector<uint32_t>& slots, MCStats& stats)
+{
+    int n = blockSize + 1;
+    int axis = edgeAxis[edge];
+    int start[3] = { i + edgeOffset[edge][0], j + edgeOffset[edge][1], k + edgeOffset[edge][2] };
+    int length = 1;
+
+    // Only an edge in a face of the leaf can be shared or stand for a coarse edge, and
+    // needs its key
+    bool boundary = false;
+    for (int a = 0; a < 3; ++a) {
+        boundary = boundary || (a != axis && (start[a] == 0 || start[a] == blockSize));
+    }
+    uint64_t key = boundary ? mc_lod_edge(leaf, blockSize, i, j, k, edge, start, length) : 0;
+    uint32_t& slot = slots[((static_cast<size_t>(axis) * n + start[2]) * n + start[1]) * n + start[0]];
+    if (slot != MCIndexedOutput::NONE) {
+        return slot;
+    }
+
+    int end[3] = { start[0], start[1], start[2] };
+    end[axis] += length;
+    float v0 = leaf.values[(static_cast<size_t>(start[2]) * n + start[1]) * n + start[0]];
+    float v1 = leaf.values[(static_cast<size_t>(end[2]) * n + end[1]) * n + end[0]];
+    float t = mc_crossing(v0, v1, isovalue);
+
+    float p[3];
+    for (int a = 0; a < 3; ++a) {
+        p[a] = min + (leaf.origin[a] + (start[a] << leaf.level)) * stepsize;
+    }
+    p[axis] = min + (leaf.origin[axis] + (start[axis] << leaf.level) + t * (length << leaf.level)) * stepsize;
+
+    MCMesh& mesh = leaf.mesh;
+    uint32_t index = static_cast<uint32_t>(mesh.vertices.size() / 3);
+    mesh.vertices.insert(mesh.vertices.end(), p, p + 3);
+    if (options.normals) {
+        float normal[3];
+        mc_vertex_normal(f, p, stepsize * (1 << leaf.level), normal, stats);
+        mesh.normals.insert(mesh.normals.end(), normal, normal + 3);
+    }
+    if (boundary) {
+        leaf.shared.emplace_back(key, index);
+    }
+    slot = index;
+    return index;
+}
+
+// Cube index of a leaf's cell (i, j, k), corners numbered as in marching_cubes_slab.
+inline int mc_lod_cube(const MCLodLeaf& leaf, int blockSize, float isovalue, int i, int j, int k)
+{
+    int n = blockSize + 1;
+    static const int corner[8][3] = {
+        {0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1},
+        {0, 1, 0}, {1, 1, 0}, {1, 1, 1}, {0, 1, 1},
+    };
+    int cubeindex = 0;
+    for (int c = 0; c < 8; ++c) {
+        float v = leaf.values[(static_cast<size_t>(k + corner[c][2]) * n + j + corner[c][1]) * n + i + corner[c][0]];
+        cubeindex |= v < isovalue ? 1 << c : 0;
+    }
+    return cubeindex;
+}
+
+// Meshes the cells of a leaf into leaf.mesh. slots has room for the 3 (blockSize + 1)^3
+// edges of the leaf's lattice.
+template <typename Field>
+void mc_lod_mesh(const Field& f, float isovalue, float min, float stepsize, int blockSize,
+                 const MCOptions& options, MCLodLeaf& leaf, std::vector<uint32_t>& slots, MCStats& stats)
+{
+    int n = blockSize + 1;
+    std::fill(slots.begin(), slots.end(), MCIndexedOutput::NONE);
+    for (int k = 0; k < blockSize; ++k) {
+        for (int j = 0; j < blockSize; ++j) {
+            // rows of the cells' corners, in the order of mc_lod_cube
+            const float* lo0 = leaf.values.data() + (static_cast<size_t>(k) * n + j) * n;
+            const float* lo1 = lo0 + n;
+            const float* up0 = lo0 + n * n;
+            const float* up1 = up0 + n;
+            for (int i = 0; i < blockSize; ++i) {
+                int cubeindex = (lo0[i] < isovalue) | (lo0[i + 1] < isovalue) << 1 | (up0[i + 1] < isovalue) << 2 |
+                                (up0[i] < isovalue) << 3 | (lo1[i] < isovalue) << 4 | (lo1[i + 1] < isovalue) << 5 |
+                                (up1[i + 1] < isovalue) << 6 | (up1[i] < isovalue) << 7;
+                if (cubeindex == 0 || cubeindex == 255) {
+                    continue;
+                }
+                for (int l = 0; marching_cubes_lut[cubeindex][l] != -1; ++l) {
+                    leaf.mesh.indices.push_back(mc_lod_vertex(f, isovalue, min, stepsize, blockSize, options, leaf,
+                                                              i, j, k, marching_cubes_lut[cubeindex][l], slots, stats));
+                }
+            }
+        }
+    }
+}
+
+// Appends to segments the pieces of the contour of cell (i, j, k) on its face at
+// coordinate side (0 or 1) along axis, as directed pairs of edge keys in the order the
+// cell's triangles run along them.
+inline void mc_lod_face_contour(const MCLodLeaf& leaf, int blockSize, float isovalue, int i, int j, int k,
+                                int axis, int side, std::vector<std::pair<uint64_t, uint64_t>>& segments)
+{
+    int cubeindex = mc_lod_cube(leaf, blockSize, isovalue, i, j, k);
+    auto on_face = [&](int edge) {
+        return edgeAxis[edge] != axis && edgeOffset[edge][axis] == side;
+    };
+    auto key = [&](int edge) {
+        int start[3], length;
+        return mc_lod_edge(leaf, blockSize, i, j, k, edge, start, length);
+    };
+
+    size_t first = segments.size();
+    const int* lut = marching_cubes_lut[cubeindex];
+    for (int l = 0; lut[l] != -1; l += 3) {
+        for (int c = 0; c < 3; ++c) {
+            int from = lut[l + c], to = lut[l + (c + 1) % 3];
+            if (!on_face(from) || !on_face(to)) {
+                continue;
+            }
+            // An edge between two triangles of the cell runs both ways and is not contour
+            std::pair<uint64_t, uint64_t> segment(key(from), key(to));
+            auto twin = std::find(segments.begin() + first, segments.end(),
+                                  std::make_pair(segment.second, segment.first));
+            if (twin != segments.end()) {
+                segments.erase(twin);
+            } else {
+                segments.push_back(segment);
+            }
+        }
+    }
+}
+
+// Triangulates a loop of mesh vertices in the plane of axes u and v by ear clipping,
+// keeping its winding. A loop lies between the contour of a coarse cell face and the finer
+// contour across the same face, which can bend back into it, so it need not be convex and
+// a fan could fold over. A loop with no ear left is degenerate, its points collinear, and
+// the rest of it is fanned.
+inline void mc_lod_fill(const MCMesh& mesh, const std::vector<uint32_t>& loop, int u, int v, std::vector<uint32_t>& indices)
+{
+    const float* p = mesh.vertices.data();
+    auto cross = [&](uint32_t a, uint32_t b, uint32_t c) {
+        return (p[3 * b + u] - p[3 * a + u]) * (p[3 * c + v] - p[3 * a + v]) -
+               (p[3 * b + v] - p[3 * a + v]) * (p[3 * c + u] - p[3 * a + u]);
+    };
+    float area = 0;
+    for (size_t i = 0; i < loop.size(); ++i) {
+        area += cross(loop[0], loop[i], loop[(i + 1) % loop.size()]);
+    }
+    float sign = area < 0 ? -1.0f : 1.0f;
+
+    std::vector<uint32_t> rest(loop);
+    while (rest.size() > 3) {
+        size_t m = rest.size(), ear = m;
+        for (size_t i = 0; i < m && ear == m; ++i) {
+            uint32_t a = rest[(i + m - 1) % m], b = rest[i], c = rest[(i + 1) % m];
+            if (sign * cross(a, b, c) <= 0) {
+                continue;
+            }
+            bool empty = true;
+            for (size_t q = 0; q < m && empty; ++q) {
+                uint32_t o = rest[q];
+                empty = o == a || o == b || o == c || sign * cross(a, b, o) < 0 || sign * cross(b, c, o) < 0 ||
+                        sign * cross(c, a, o) < 0;
+            }
+            if (empty) {
+                ear = i;
+            }
+        }
+        if (ear == m) {
+            break;
+        }
+        indices.push_back(rest[(ear + m - 1) % m]);
+        indices.push_back(rest[ear]);
+        indices.push_back(rest[(ear + 1) % m]);
+        rest.erase(rest.begin() + ear);
+    }
+    for (size_t t = 1; t + 1 < rest.size(); ++t) {
+        indices.push_back(rest[0]);
+        indices.push_back(rest[t]);
+        indices.push_back(rest[t + 1]);
+    }
+}
+
+// Fills the gaps between the fine leaf and the coarser leaf across its face in direction
+// (axis, side) with triangles of mesh in the plane of the face, welded maps the edge keys
+// of the leaves' boundary vertices to their index in mesh.
+inline void mc_lod_stitch(const MCLodTree& tree, const MCLodLeaf& fine, const MCLodLeaf& coarse, float isovalue,
+                          int axis, int side, const std::unordered_map<uint64_t, uint32_t>& welded, MCMesh& mesh)
+{
+    int blockSize = tree.blockSize;
+    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    int offset[3];
+    for (int a = 0; a < 3; ++a) {
+        offset[a] = (fine.origin[a] - coarse.origin[a]) >> coarse.level;
+    }
+
+    std::vector<std::pair<uint64_t, uint64_t>> segments;
+    std::vector<uint32_t> loop;
+    for (int cv = 0; cv < blockSize / 2; ++cv)
+    {
+        for (int cu = 0; cu < blockSize / 2; ++cu)
+        {
+            segments.clear();
+            int c[3], f[3];
+            c[axis] = side > 0 ? 0 : blockSize - 1;
+            c[u] = offset[u] + cu;
+            c[v] = offset[v] + cv;
+            mc_lod_face_contour(coarse, blockSize, isovalue, c[0], c[1], c[2], axis, side > 0 ? 0 : 1, segments);
+            if (segments.empty()) {
+                continue;
+            }
+            size_t coarseCount = segments.size();
+            for (int q = 0; q < 4; ++q) {
+                f[axis] = side > 0 ? blockSize - 1 : 0;
+                f[u] = 2 * cu + (q & 1);
+                f[v] = 2 * cv + (q >> 1);
+                mc_lod_face_contour(fine, blockSize, isovalue, f[0], f[1], f[2], axis, side > 0 ? 1 : 0, segments);
+            }
+            if (segments.size() == coarseCount) {
+                continue;
+            }
+
+            // Both contours run against the fill, so reversed they chain into closed loops
+            std::vector<bool> used(segments.size(), false);
+            for (size_t s = 0; s < segments.size(); ++s)
+            {
+                if (used[s]) {
+                    continue;
+                }
+                used[s] = true;
+                uint64_t begin = segments[s].second, at = segments[s].first;
+                std::vector<uint64_t> keys(1, begin);
+                bool closed = true;
+                while (at != begin) {
+                    keys.push_back(at);
+                    size_t next = 0;
+                    while (next < segments.size() && (used[next] || segments[next].second != at)) {
+                        ++next;
+                    }
+                    if (next == segments.size()) {
+                        closed = false;
+                        break;
+                    }
+                    used[next] = true;
+                    at = segments[next].first;
+                }
+                if (!closed || keys.size() < 3) {
+                    continue;
+                }
+
+                loop.clear();
+                for (uint64_t key : keys) {
+                    auto found = welded.find(key);
+                    if (found == welded.end()) {
+                        break;
+                    }
+                    loop.push_back(found->second);
+                }
+                if (loop.size() == keys.size()) {
+                    mc_lod_fill(mesh, loop, u, v, mesh.indices);
+                }
+            }
+        }
+    }
+}
+
+// Runs marching cubes over [min, max]^3 at full resolution near viewpoint and coarser
+// away from it, returning a welded mesh without cracks between levels. Blocks are
+// options.blockSize^3 cells (rounded up to even), and a block is split while the viewpoint
+// is nearer than options.lodDetail times its width. The finest cells are at most stepsize
+// wide, narrowed so that [min, max] is a whole root block. Vertices are placed linearly on
+// the lattice values; the leaves are sampled on options.threads workers and meshed in order.
+template <typename Field>
+MCMesh marching_cubes_lod(
+        Field f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        const float viewpoint[3],
+        const MCOptions& options = MCOptions())
+{
+    MCMesh mesh;
+    int nsteps = static_cast<int>((max - min) / stepsize);
+    if (nsteps <= 0) {
+        mc_report_stats(std::vector<MCStats>(), options);
+        return mesh;
+    }
+    int blockSize = std::max(2, (options.blockSize + 1) / 2 * 2);
+    int levels = 0;
+    while ((static_cast<long long>(blockSize) << levels) < nsteps) {
+        ++levels;
+    }
+    stepsize = (max - min) / (blockSize << levels);
+    MCLodTree tree = mc_lod_tree(min, stepsize, levels, blockSize, viewpoint, options.lodDetail);
+
+    std::vector<MCLodLeaf> leaves;
+    std::vector<int> leafOf(tree.nodes.size(), -1);
+    for (int node = 0; node < static_cast<int>(tree.nodes.size()); ++node) {
+        if (tree.nodes[node].child >= 0) {
+            continue;
+        }
+        MCLodLeaf leaf;
+        leaf.node = node;
+        leaf.level = tree.nodes[node].level;
+        for (int a = 0; a < 3; ++a) {
+            leaf.origin[a] = tree.nodes[node].origin[a];
+        }
+        for (int r = 0; r < 27; ++r) {
+            int d[3];
+            mc_lod_direction(r, d);
+            int other = r == 13 ? -1 : tree.neighbour(node, d);
+            leaf.coarse[r] = other >= 0 && tree.nodes[other].level > leaf.level;
+            leaf.anyCoarse = leaf.anyCoarse || leaf.coarse[r];
+        }
+        leafOf[node] = static_cast<int>(leaves.size());
+        leaves.push_back(leaf);
+    }
+
+    // Each leaf is sampled, coarsened and meshed on its own on the workers
+    int count = static_cast<int>(leaves.size());
+    int threads = std::max(1, std::min(mc_thread_count(options), count));
+    std::vector<MCStats> leafStats(threads);
+    std::atomic<int> next(0);
+    auto leafWorker = [&](int t) {
+        int n = blockSize + 1;
+        std::vector<uint32_t> slots(3 * static_cast<size_t>(n) * n * n);
+        for (int l = next++; l < count; l = next++) {
+            mc_lod_sample(f, isovalue, min, stepsize, blockSize, options, leaves[l], leafStats[t]);
+            if (leaves[l].active) {
+                mc_lod_coarsen(blockSize, leaves[l]);
+                mc_lod_mesh(f, isovalue, min, stepsize, blockSize, options, leaves[l], slots, leafStats[t]);
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(leafWorker, t);
+    }
+    leafWorker(0);
+    for (std::thread& t : pool) {
+        t.join();
+    }
+
+    // The leaves' meshes are joined in leaf order, each boundary vertex welded to the one of
+    // the first leaf that has it, so the mesh is the same as meshing the leaves in turn
+    // through one map of edges would make it
+    size_t sharedCount = 0;
+    for (const MCLodLeaf& leaf : leaves) {
+        sharedCount += leaf.shared.size();
+    }
+    std::unordered_map<uint64_t, uint32_t> welded;
+    welded.reserve(sharedCount);
+    std::vector<uint32_t> global;
+    for (MCLodLeaf& leaf : leaves)
+    {
+        if (!leaf.active) {
+            continue;
+        }
+        global.assign(leaf.mesh.vertices.size() / 3, MCIndexedOutput::NONE);
+        for (const std::pair<uint64_t, uint32_t>& s : leaf.shared) {
+            auto found = welded.find(s.first);
+            if (found != welded.end()) {
+                global[s.second] = found->second;
+            }
+        }
+        for (size_t v = 0; v < global.size(); ++v) {
+            if (global[v] != MCIndexedOutput::NONE) {
+                continue;
+            }
+            global[v] = static_cast<uint32_t>(mesh.vertices.size() / 3);
+            mesh.vertices.insert(mesh.vertices.end(), &leaf.mesh.vertices[3 * v], &leaf.mesh.vertices[3 * v] + 3);
+            if (options.normals) {
+                mesh.normals.insert(mesh.normals.end(), &leaf.mesh.normals[3 * v], &leaf.mesh.normals[3 * v] + 3);
+            }
+        }
+        for (const std::pair<uint64_t, uint32_t>& s : leaf.shared) {
+            welded.emplace(s.first, global[s.second]);
+        }
+        for (uint32_t index : leaf.mesh.indices) {
+            mesh.indices.push_back(global[index]);
+        }
+        leaf.mesh = MCMesh();
+        std::vector<std::pair<uint64_t, uint32_t>>().swap(leaf.shared);
+    }
+
+    // Transition fill on every face of a leaf whose neighbour is one level coarser
+    for (const MCLodLeaf& leaf : leaves)
+    {
+        if (!leaf.active) {
+            continue;
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int side = -1; side <= 1; side += 2) {
+                int d[3] = { 0, 0, 0 };
+                d[axis] = side;
+                int other = tree.neighbour(leaf.node, d);
+                if (other < 0 || tree.nodes[other].level != leaf.level + 1 || !leaves[leafOf[other]].active) {
+                    continue;
+                }
+                mc_lod_stitch(tree, leaf, leaves[leafOf[other]], isovalue, axis, side, welded, mesh);
+            }
+        }
+    }
+
+    mc_report_stats(leafStats, options);
+    return mesh;
+}
+
+#endif
@@ -0,0 +1,786 @@
+// Headless benchmarks for the marching cubes extractor.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Fields.hpp"
+#include "MarchingCubes.hpp"
+#include "DualContouring.hpp"
+#include "Decimate.hpp"
+#include "LevelOfDetail.hpp"
+#include "SpanSpace.hpp"
+#include "Volume.hpp"
+#include "BrickVolume.hpp"
+#include "AsyncExtraction.hpp"
+#include "Expression.hpp"
+#include "SDF.hpp"
+#include "BrickMesher.hpp"
+#include "NestedSurfaces.hpp"
+
+// Best of a few runs, in milliseconds
+template <typename Run>
+double time_ms(Run run, int repeats = 3) {
+    double best = 1e30;
+    for (int r = 0; r < repeats; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+// Set by a check whose results differ, so that main exits with 1
+bool failed = false;
+
+// Prints as the verdict of a check, recording a failure
+const char* verdict(bool same) {
+    failed = failed || !same;
+    return same ? "same" : "DIFFERENT";
+}
+
+// Re-extraction at a few isovalues as a render loop sees it: blocking, the loop stalls for
+// the whole extraction; through the worker, it only pays for request and poll each frame
+// while it waits out the mesh generation latency.
+template <typename Field>
+void bench_async(const char* name, Field field, float stepsize, std::vector<float> isovalues) {
+    MCOptions options;
+    options.cull = true;
+    options.normals = true;
+    double blockingMs = 0;
+    for (float isovalue : isovalues) {
+        blockingMs += time_ms([&]() {
+            marching_cubes_indexed(field, isovalue, -5, 5, stepsize, options);
+        }, 1) / isovalues.size();
+    }
+
+    MCAsyncExtractor extractor;
+    double callMs = 0;
+    double latencySum = 0;
+    int frames = 0;
+    for (float isovalue : isovalues) {
+        MCMesh mesh;
+        double latency = 0;
+        bool done = false;
+        callMs = std::max(callMs, time_ms([&]() {
+            extractor.request([=]() { return marching_cubes_indexed(field, isovalue, -5, 5, stepsize, options); });
+        }, 1));
+        while (!done) {
+            // a frame of other work while the worker runs
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            callMs = std::max(callMs, time_ms([&]() { done = extractor.poll(mesh, &latency); }, 1));
+            ++frames;
+        }
+        latencySum += latency;
+    }
+    printf("%-4s %12.2f %12.4f %12.2f %8d\n", name, blockingMs, callMs, latencySum / isovalues.size(), frames);
+}
+
+// A field compiled into the program against the same field as an expression: ns per
+// sample of eval_row over rows of a slice, and a whole extraction. Checks that the
+// expression gives each sample of a row the same value one sample at a time. The soups of
+// the two can differ by a few triangles, as the expression fuses products into
+// multiply-adds and so rounds differently from the compiled field.
+template <typename Field>
+void bench_expression(const char* name, Field field, const char* text, float isovalue, float stepsize) {
+    MCExpression expression;
+    expression.compile(text);
+    int n = 257;
+    std::vector<float> x(n), y(n, 0.3f), z(n, -1.7f), out(n);
+    for (int i = 0; i < n; ++i) {
+        x[i] = -5 + i * 10.0f / (n - 1);
+    }
+    int rows = 2000;
+    double fieldMs = time_ms([&]() {
+        for (int r = 0; r < rows; ++r) {
+            y[0] = r * 1e-3f;
+            field.eval_row(x.data(), y.data(), z.data(), out.data(), n);
+        }
+    });
+    double expressionMs = time_ms([&]() {
+        for (int r = 0; r < rows; ++r) {
+            y[0] = r * 1e-3f;
+            expression.eval_row(x.data(), y.data(), z.data(), out.data(), n);
+        }
+    });
+
+    MCOptions options;
+    options.cull = true;
+    std::vector<float> fieldSoup, expressionSoup;
+    double fieldExtractMs = time_ms([&]() { fieldSoup = marching_cubes(field, isovalue, -5, 5, stepsize, options); });
+    double expressionExtractMs = time_ms([&]() {
+        expressionSoup = marching_cubes(expression, isovalue, -5, 5, stepsize, options);
+    });
+    bool single = true;
+    for (int i = 0; i < n; ++i) {
+        single = single && expression(x[i], y[i], z[i]) == out[i];
+    }
+    double samples = static_cast<double>(rows) * n;
+    printf("%-4s %8.2f %8.2f %6.2fx %10.2f %10.2f %6.2fx %10zu %10zu  %s  %s\n", name, fieldMs * 1e6 / samples,
+           expressionMs * 1e6 / samples, expressionMs / fieldMs, fieldExtractMs, expressionExtractMs,
+           expressionExtractMs / fieldExtractMs, fieldSoup.size() / 9, expressionSoup.size() / 9, verdict(single), text);
+}
+
+// Scene of count primitives of every kind, rotated and scattered over [-4, 4]^3, some
+// blended with a sphere, cut by one or clipped by a box
+int sdf_scene(MCSdfScene& scene, int count) {
+    unsigned seed = 7;
+    auto random = [&](float lo, float hi) {
+        seed = seed * 1664525u + 1013904223u;
+        return lo + (hi - lo) * (seed >> 8) * (1.0f / 16777216.0f);
+    };
+    std::vector<int> parts;
+    for (int i = 0; i < count; ++i) {
+        int n;
+        switch (i % 4) {
+            case 0: n = scene.sphere(random(0.15f, 0.45f)); break;
+            case 1: n = scene.box(random(0.1f, 0.35f), random(0.1f, 0.35f), random(0.1f, 0.35f)); break;
+            case 2: n = scene.torus(random(0.2f, 0.4f), random(0.05f, 0.12f)); break;
+            default: n = scene.capsule(-0.3f, 0, 0, 0.3f, 0.1f, 0, random(0.08f, 0.2f)); break;
+        }
+        n = scene.rotate(n, random(-1, 1), random(-1, 1), random(0.1f, 1), random(0, 6.28f));
+        if (i % 10 == 0) {
+            n = scene.smooth_unite(n, scene.translate(scene.sphere(0.2f), 0.25f, 0, 0), 0.2f);
+        } else if (i % 10 == 5) {
+            n = scene.subtract(n, scene.sphere(0.15f));
+        } else if (i % 20 == 7) {
+            n = scene.intersect(n, scene.box(0.25f, 0.25f, 0.25f));
+        }
+        parts.push_back(scene.translate(n, random(-4, 4), random(-4, 4), random(-4, 4)));
+    }
+    return scene.unite(parts);
+}
+
+// Every primitive at every sample against only those within a cell diagonal of each
+// chunk, with the primitives per chunk the pruned program evaluates on average
+void bench_sdf(int count, float stepsize) {
+    MCSdfScene scene;
+    int root = sdf_scene(scene, count);
+    MCSdf pruned(scene, root, stepsize), full = pruned;
+    full.margin = std::numeric_limits<float>::infinity();
+
+    int nsteps = static_cast<int>(10.0f / stepsize);
+    long long near = 0, chunks = 0;
+    for (int k = 0; k <= nsteps; ++k) {
+        for (int j = 0; j <= nsteps; ++j) {
+            for (int i = 0; i <= nsteps; i += MCSdf::chunk) {
+                int last = std::min(i + MCSdf::chunk - 1, nsteps);
+                float lo[3] = { -5 + i * stepsize, -5 + j * stepsize, -5 + k * stepsize };
+                float hi[3] = { -5 + last * stepsize, lo[1], lo[2] };
+                near += pruned.primitives_near(lo, hi);
+                ++chunks;
+            }
+        }
+    }
+
+    MCOptions options;
+    options.cull = true;
+    std::vector<float> fullSoup, prunedSoup;
+    double fullMs = time_ms([&]() { fullSoup = marching_cubes(full, 0.0f, -5, 5, stepsize, options); }, 1);
+    double prunedMs = time_ms([&]() { prunedSoup = marching_cubes(pruned, 0.0f, -5, 5, stepsize, options); });
+    printf("%10d %10.1f %10.1f %8.1fx %10.2f %10zu  %s\n", count, fullMs, prunedMs, fullMs / prunedMs,
+           static_cast<double>(near) / chunks, prunedSoup.size() / 9, verdict(fullSoup == prunedSoup));
+}
+
+// Triangles of a soup sorted, to compare soups made in a different order
+std::vector<std::array<float, 9>> sorted_triangles(const std::vector<float>& soup) {
+    std::vector<std::array<float, 9>> triangles(soup.size() / 9);
+    for (size_t t = 0; t < triangles.size(); ++t) {
+        std::copy(soup.begin() + 9 * t, soup.begin() + 9 * t + 9, triangles[t].begin());
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+// Sculpting f5 over [-half, half]^3: every edit extracted again in full against only the
+// 16^3 cell bricks it reaches, for edits of a few radii on the surface
+void bench_sculpt(float half, float stepsize) {
+    MCOptions options;
+    options.cull = true;
+    options.placement = MCOptions::LINEAR;
+    MCSculptedField<Field5> field;
+    MCBrickMesher mesher;
+    mesher.reset(-1.5f, -half, half, stepsize, options);
+    mesher.update(field);
+
+    // points of x^2 = y^2 + z^2 + z - 1.5 spread over the domain
+    const float points[][2] = { { 1.0f, 1.0f }, { -2.0f, 0.5f }, { 0.3f, -2.5f }, { 2.5f, 2.0f }, { -1.0f, -1.5f } };
+    for (float radius : { 0.25f, 0.5f, 1.0f }) {
+        double bricksMs = 0;
+        int bricks = 0;
+        for (int e = 0; e < 5; ++e) {
+            float y = points[e][0], z = points[e][1];
+            float lo[3], hi[3];
+            field.add(std::sqrt(y * y + z * z + z - 1.5f), y, z, radius, e % 2 ? 1.0f : -1.0f, lo, hi);
+            mesher.mark(lo, hi);
+            bricksMs += time_ms([&]() { bricks += mesher.update(field); }, 1);
+        }
+        std::vector<float> full;
+        double fullMs = time_ms([&]() { full = marching_cubes(field, -1.5f, -half, half, stepsize, options); }, 1);
+        bool same = sorted_triangles(full) == sorted_triangles(mesher.soup());
+        printf("%4g^3 %7.2f %10.1f %10.2f %8d %10zu  %s\n", 2 * half, radius, fullMs, bricksMs / 5, bricks / 5,
+               full.size() / 9, verdict(same));
+    }
+}
+
+// f5 extracted brick by brick in calls of budgetMs each, as a viewer spreads an extraction
+// over frames: how many calls it takes, the median and longest, and the total against one
+// call without a budget
+void bench_progressive(float stepsize, float budgetMs) {
+    MCOptions options;
+    options.cull = true;
+    options.placement = MCOptions::LINEAR;
+    MCBrickMesher mesher;
+    mesher.reset(-1.5f, -5, 5, stepsize, options);
+    double blockingMs = time_ms([&]() { mesher.update(Field5()); }, 1);
+    std::vector<float> whole = mesher.soup();
+
+    mesher.reset(-1.5f, -5, 5, stepsize, options);
+    std::vector<double> calls;
+    double totalMs = 0;
+    while (mesher.pending() > 0) {
+        calls.push_back(time_ms([&]() { mesher.update(Field5(), budgetMs); }, 1));
+        totalMs += calls.back();
+    }
+    std::sort(calls.begin(), calls.end());
+    std::vector<float> soup = mesher.soup();
+    printf("%8g %7g %10.1f %6zu %8.2f %8.2f %10.1f %10zu  %s\n", stepsize, budgetMs, blockingMs, calls.size(),
+           calls[calls.size() / 2], calls.back(), totalMs, soup.size() / 9, verdict(soup == whole));
+}
+
+// Nested shells of one field: a marching_cubes call per isovalue against one pass over the
+// lattice for all of them, with the field evaluations each makes
+template <typename Field>
+void bench_levels(const char* name, Field field, std::vector<float> isovalues, float stepsize, bool cull) {
+    MCOptions options;
+    options.cull = cull;
+    MCStats stats;
+    options.stats = &stats;
+    std::vector<std::vector<float>> separate(isovalues.size());
+    long long separateEvaluations = 0;
+    double separateMs = time_ms([&]() {
+        separateEvaluations = 0;
+        for (size_t l = 0; l < isovalues.size(); ++l) {
+            separate[l] = marching_cubes(field, isovalues[l], -5, 5, stepsize, options);
+            separateEvaluations += stats.fieldEvaluations;
+        }
+    }, 2);
+    std::vector<std::vector<float>> levels;
+    double levelsMs = time_ms([&]() { levels = marching_cubes_levels(field, isovalues, -5, 5, stepsize, options); }, 2);
+    size_t triangles = 0;
+    for (const std::vector<float>& soup : levels) {
+        triangles += soup.size() / 9;
+    }
+    printf("%-4s %6zu %4s %10.1f %10.1f %7.2fx %12lld %12lld %10zu  %s\n", name, isovalues.size(), cull ? "on" : "off",
+           separateMs, levelsMs, separateMs / levelsMs, separateEvaluations, stats.fieldEvaluations, triangles,
+           verdict(levels == separate));
+}
+
+// Compares the std::function wrapper against the templated extractor for one field.
+template <typename Field>
+void bench_dispatch(const char* name, Field field, float isovalue, float stepsize) {
+    std::function<float(float, float, float)> wrapped = field;
+
+    double soup = time_ms([&]() {
+        marching_cubes(wrapped, isovalue, -5, 5, stepsize);
+    });
+    double templ = time_ms([&]() {
+        marching_cubes(field, isovalue, -5, 5, stepsize);
+    });
+
+    printf("%-4s %10.2f %10.2f %8.2fx\n", name, soup, templ, soup / templ);
+}
+
+// Times sampling every slice of an n^3 lattice with the field's eval_row against the same
+// field called one point at a time.
+template <typename Field>
+void bench_batch(const char* name, Field field, int nsteps) {
+    auto scalar = [field](float x, float y, float z) { return field(x, y, z); };
+    int n = nsteps + 1;
+    float stepsize = 10.0f / nsteps;
+    std::vector<float> slice(n * n);
+    MCRow row(-5, stepsize, n);
+    MCStats stats;
+    MCBlocks blocks = mc_make_blocks(field, 0.0f, -5, stepsize, nsteps, MCOptions(), stats);
+
+    double lane = time_ms([&]() {
+        for (int k = 0; k < n; ++k) {
+            mc_sample_slice(scalar, -5, stepsize, nsteps, blocks, k, row, slice.data());
+        }
+    });
+    double batch = time_ms([&]() {
+        for (int k = 0; k < n; ++k) {
+            mc_sample_slice(field, -5, stepsize, nsteps, blocks, k, row, slice.data());
+        }
+    });
+    printf("%-4s %10.2f %10.2f %8.2fx\n", name, lane, batch, lane / batch);
+}
+
+// Distance of the vertices of the sphere f1 = r^2 from its true radius, for each way of
+// placing vertices on the cube edges.
+void bench_placement(float radius) {
+    const char* names[] = { "midpoint", "linear", "secant" };
+    MCOptions::VertexPlacement placements[] = { MCOptions::MIDPOINT, MCOptions::LINEAR, MCOptions::SECANT };
+    float stepsizes[] = { 0.5f, 0.25f, 0.1f, 0.05f };
+
+    printf("%-8s %9s %12s %12s %12s\n", "step", "placement", "max error", "mean error", "evaluations");
+    for (float stepsize : stepsizes) {
+        for (int p = 0; p < 3; ++p) {
+            MCStats stats;
+            MCOptions options;
+            options.placement = placements[p];
+            options.stats = &stats;
+            std::vector<float> vertices = marching_cubes(Field1(), radius * radius, -5, 5, stepsize, options);
+
+            double maxError = 0, sumError = 0;
+            for (size_t v = 0; v < vertices.size(); v += 3) {
+                double r = std::sqrt(double(vertices[v]) * vertices[v] + double(vertices[v + 1]) * vertices[v + 1] +
+                                     double(vertices[v + 2]) * vertices[v + 2]);
+                maxError = std::max(maxError, std::fabs(r - radius));
+                sumError += std::fabs(r - radius);
+            }
+            printf("%-8g %9s %12.3e %12.3e %12lld\n", stepsize, names[p], maxError,
+                   sumError / std::max<size_t>(1, vertices.size() / 3), stats.fieldEvaluations);
+        }
+    }
+}
+
+// Re-extracts the welded surface of a field at several isovalues from a span space index,
+// against extracting it from the field with interval culling, checking that both give the
+// same vertices and indices.
+template <typename Field>
+void bench_span(const char* name, Field field, int nsteps, std::vector<float> isovalues) {
+    float stepsize = 10.0f / nsteps;
+    MCOptions options;
+    options.placement = MCOptions::LINEAR;
+    MCSpanIndex index;
+    double build = time_ms([&]() {
+        index = mc_build_span_index(field, -5, 5, stepsize, options);
+    }, 1);
+    printf("%-4s build %.2f ms\n", name, build);
+
+    MCOptions culled = options;
+    culled.cull = true;
+    for (float isovalue : isovalues) {
+        MCMesh fromField, fromIndex;
+        double direct = time_ms([&]() {
+            fromField = marching_cubes_indexed(field, isovalue, -5, 5, stepsize, culled);
+        });
+        double indexed = time_ms([&]() {
+            fromIndex = marching_cubes_indexed(index, isovalue, options);
+        });
+        bool same = fromIndex.vertices == fromField.vertices && fromIndex.indices == fromField.indices;
+        printf("%-4s %8g %10.2f %10.2f %8.2fx  %s\n", name, isovalue, direct, indexed, direct / indexed, verdict(same));
+    }
+}
+
+// Fraction of the triangles of a mesh with an angle under 10 degrees
+double sliver_fraction(const MCMesh& mesh) {
+    const std::vector<float>& v = mesh.vertices;
+    long long slivers = 0;
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        for (int c = 0; c < 3; ++c) {
+            const float* p = &v[3 * mesh.indices[t + c]];
+            const float* q = &v[3 * mesh.indices[t + (c + 1) % 3]];
+            const float* r = &v[3 * mesh.indices[t + (c + 2) % 3]];
+            double dot = 0, lq = 0, lr = 0;
+            for (int a = 0; a < 3; ++a) {
+                dot += double(q[a] - p[a]) * (r[a] - p[a]);
+                lq += double(q[a] - p[a]) * (q[a] - p[a]);
+                lr += double(r[a] - p[a]) * (r[a] - p[a]);
+            }
+            // cos of the angle at p above cos(10 degrees), or a degenerate corner
+            if (lq == 0 || lr == 0 || dot > 0.98480775 * std::sqrt(lq * lr)) {
+                ++slivers;
+                break;
+            }
+        }
+    }
+    return mesh.indices.empty() ? 0 : double(slivers) / (mesh.indices.size() / 3);
+}
+
+// Compares the soup grown slab by slab with the two-pass extraction into an exactly sized
+// buffer, on one thread and on every hardware thread.
+template <typename Field>
+void bench_exact(const char* name, Field field, float isovalue, float stepsize) {
+    for (int threads : { 1, 0 }) {
+        MCOptions options;
+        options.placement = MCOptions::LINEAR;
+        options.cull = true;
+        options.threads = threads;
+        if (threads == 0 && mc_thread_count(options) == 1) {
+            continue;
+        }
+        std::vector<float> grown, exact;
+        MCStats grownStats, exactStats;
+        double grownMs = time_ms([&]() {
+            options.stats = &grownStats;
+            grown = marching_cubes(field, isovalue, -5, 5, stepsize, options);
+        });
+        options.exactOutput = true;
+        double exactMs = time_ms([&]() {
+            options.stats = &exactStats;
+            exact = marching_cubes(field, isovalue, -5, 5, stepsize, options);
+        });
+        printf("%-4s %7d %6s %10.2f %12.1f %12lld\n", name, mc_thread_count(options), "grown", grownMs,
+               grown.capacity() * sizeof(float) / 1e6, grownStats.fieldEvaluations);
+        printf("%-4s %7d %6s %10.2f %12.1f %12lld %s\n", name, mc_thread_count(options), "exact", exactMs,
+               exact.capacity() * sizeof(float) / 1e6, exactStats.fieldEvaluations,
+               verdict(exact == grown));
+    }
+}
+
+// Writes the lattice of f5 to volume files of each sample type and extracts them from the
+// mapping, against extracting the field itself on the same lattice. Each volume is checked
+// against a field reading its samples point by point, which quantises f5 as it does.
+void bench_volume(int nsteps) {
+    MCOptions options;
+    options.placement = MCOptions::LINEAR;
+    float stepsize = 10.0f / nsteps;
+    std::vector<float> field;
+    double fieldMs = time_ms([&]() {
+        field = marching_cubes(Field5(), -1.5f, -5, 5, stepsize, options);
+    });
+    printf("%-8s %10s %10.2f %10zu\n", "field", "", fieldMs, field.size() / 9);
+
+    const char* names[] = { "uint8", "uint16", "float32" };
+    for (int type = MCVolume::UINT8; type <= MCVolume::FLOAT32; ++type) {
+        std::string path = "/tmp/MCBench_f5_" + std::string(names[type]) + ".vol";
+        if (!mc_write_volume(path, Field5(), -5, stepsize, nsteps, static_cast<MCVolume::Type>(type), -10, 10)) {
+            printf("%-8s cannot write %s  %s\n", names[type], path.c_str(), verdict(false));
+            continue;
+        }
+        MCVolume volume;
+        bool opened = false;
+        double openMs = time_ms([&]() {
+            volume = MCVolume();
+            opened = volume.open(path);
+        });
+        if (!opened) {
+            printf("%-8s cannot open %s  %s\n", names[type], path.c_str(), verdict(false));
+            remove(path.c_str());
+            continue;
+        }
+        std::vector<float> vertices;
+        double ms = time_ms([&]() {
+            vertices = marching_cubes(volume, -1.5f, volume.min, volume.max(), volume.stepsize, options);
+        });
+        auto samples = [&](float x, float y, float z) {
+            return volume.sample(static_cast<int>(std::lround((x + 5) / stepsize)),
+                                 static_cast<int>(std::lround((y + 5) / stepsize)),
+                                 static_cast<int>(std::lround((z + 5) / stepsize)));
+        };
+        std::vector<float> reference = marching_cubes(samples, -1.5f, -5, 5, stepsize, options);
+        printf("%-8s %10.3f %10.2f %10zu  %s\n", names[type], openMs, ms, vertices.size() / 9,
+               verdict(vertices == reference));
+        remove(path.c_str());
+    }
+}
+
+// Converts a uint16 volume of f5, clamped to [-3, 0] so that it is constant away from the
+// surface like the empty space of a scan, to bricks of each size and extracts f5 = -1.5
+// from the bricks and from the raw volume. Reports the size of the bricked file and the
+// fraction of bricks never decompressed, and checks that every brick decompresses to the
+// samples of the raw volume, that the two soups are the same, that exactly the bricks
+// whose samples straddle the isovalue were decompressed and that the bricks take no more
+// field evaluations than the raw volume culled by the same blocks.
+void bench_bricks(int nsteps) {
+    std::string rawPath = "/tmp/MCBench_f5_clamped.vol";
+    std::string brickPath = "/tmp/MCBench_f5_clamped.bricks";
+    MCVolume volume;
+    if (!mc_write_volume(rawPath, Field5(), -5, 10.0f / nsteps, nsteps, MCVolume::UINT16, -3, 0) ||
+        !volume.open(rawPath)) {
+        printf("cannot write %s  %s\n", rawPath.c_str(), verdict(false));
+        return;
+    }
+    MCOptions options;
+    options.placement = MCOptions::LINEAR;
+    std::vector<float> raw;
+    double rawMs = time_ms([&]() {
+        raw = marching_cubes(volume, -1.5f, volume.min, volume.max(), volume.stepsize, options);
+    });
+    size_t rawBytes = static_cast<size_t>(nsteps + 1) * (nsteps + 1) * (nsteps + 1) * 2;
+    printf("%-6s %10.1f %10s %10.2f %10s\n", "raw", rawBytes / 1e6, "", rawMs, "");
+
+    for (int brickSize : { 8, 16, 32 }) {
+        char name[16];
+        snprintf(name, sizeof(name), "%d^3", brickSize);
+        MCBrickVolume bricked;
+        if (!mc_write_bricks(volume, brickPath, brickSize) || !bricked.open(brickPath)) {
+            printf("%-6s cannot write %s  %s\n", name, brickPath.c_str(), verdict(false));
+            continue;
+        }
+        FILE* file = fopen(brickPath.c_str(), "rb");
+        fseek(file, 0, SEEK_END);
+        long bytes = ftell(file);
+        fclose(file);
+
+        // Every brick against the raw samples at its corners, and the bricks culling must
+        // decompress: those not constant whose range reaches the isovalue, padded as
+        // mc_cull_blocks pads it
+        bool roundTrip = true;
+        long long straddling = 0;
+        int count = bricked.brickCount;
+        int stride = brickSize + 1;
+        std::vector<float> values(bricked.brick_samples());
+        for (int b = 0; b < count * count * count; ++b) {
+            int bx = b % count, by = b / count % count, bz = b / (count * count);
+            bricked.decode(b, values.data());
+            float lo = INFINITY, hi = -INFINITY;
+            for (int s = 0; s < bricked.brick_samples(); ++s) {
+                int i = std::min(bx * brickSize + s % stride, nsteps);
+                int j = std::min(by * brickSize + s / stride % stride, nsteps);
+                int k = std::min(bz * brickSize + s / (stride * stride), nsteps);
+                float v = volume.sample(i, j, k);
+                roundTrip = roundTrip && values[s] == v;
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+            }
+            float pad = 1e-5f * (1.0f + std::fabs(lo) + std::fabs(hi));
+            straddling += lo < hi && lo - pad <= -1.5f && -1.5f <= hi + pad;
+        }
+
+        // Reopened for every run, so none of them finds the bricks of the last in the cache
+        std::vector<float> vertices;
+        MCStats stats;
+        double ms = time_ms([&]() {
+            bricked = MCBrickVolume();
+            bricked.open(brickPath);
+            MCOptions brickOptions = bricked.options(options);
+            stats = MCStats();
+            brickOptions.stats = &stats;
+            vertices = marching_cubes(bricked, -1.5f, bricked.min, bricked.max(), bricked.stepsize, brickOptions);
+        });
+        MCStats rawStats;
+        MCOptions rawOptions = bricked.options(options);
+        rawOptions.stats = &rawStats;
+        marching_cubes(volume, -1.5f, volume.min, volume.max(), volume.stepsize, rawOptions);
+        long long decoded = *bricked.decoded;
+        long long total = static_cast<long long>(count) * count * count;
+        printf("%-6s %10.1f %9.1f%% %10.2f %9.1f%%  codec %s, soup %s, skipped %s, evaluations %s\n", name,
+               bytes / 1e6, 100.0 * bytes / rawBytes, ms, 100.0 * (total - decoded) / total, verdict(roundTrip),
+               verdict(vertices == raw), verdict(decoded == straddling),
+               verdict(stats.fieldEvaluations <= rawStats.fieldEvaluations));
+    }
+    remove(rawPath.c_str());
+    remove(brickPath.c_str());
+}
+
+// Compares marching cubes with surface nets and dual contouring on one field.
+template <typename Field>
+void bench_method(const char* name, Field field, float isovalue, float stepsize) {
+    MCOptions options;
+    options.placement = MCOptions::LINEAR;
+    options.cull = true;
+    const char* methods[] = { "mc", "nets", "dc" };
+    for (int method = 0; method < 3; ++method) {
+        MCMesh mesh;
+        double ms = time_ms([&]() {
+            if (method == 0) {
+                mesh = marching_cubes_indexed(field, isovalue, -5, 5, stepsize, options);
+            } else if (method == 1) {
+                mesh = surface_nets(field, isovalue, -5, 5, stepsize, options);
+            } else {
+                mesh = dual_contouring(field, isovalue, -5, 5, stepsize, options);
+            }
+        });
+        printf("%-4s %6s %10.2f %10zu %10zu %9.1f%%\n", name, methods[method], ms, mesh.indices.size() / 3,
+               mesh.vertices.size() / 3, 100 * sliver_fraction(mesh));
+    }
+}
+
+// Decimates the welded sphere f1 = radius^2 to fractions of its triangles, measuring the
+// distance of the remaining vertices from the sphere.
+void bench_decimate(float radius, float stepsize) {
+    MCOptions options;
+    options.placement = MCOptions::LINEAR;
+    options.cull = true;
+    MCMesh mesh = marching_cubes_indexed(Field1(), radius * radius, -5, 5, stepsize, options);
+    size_t triangles = mesh.indices.size() / 3;
+
+    printf("%-8s %10s %10s %12s %12s\n", "keep", "ms", "triangles", "max error", "mean error");
+    for (double keep : { 1.0, 0.5, 0.1, 0.02 }) {
+        MCMesh result;
+        double ms = keep == 1.0 ? 0 : time_ms([&]() { result = decimate(mesh, static_cast<size_t>(keep * triangles)); }, 1);
+        const MCMesh& m = keep == 1.0 ? mesh : result;
+        double maxError = 0, sumError = 0;
+        for (size_t v = 0; v < m.vertices.size(); v += 3) {
+            double r = std::sqrt(double(m.vertices[v]) * m.vertices[v] + double(m.vertices[v + 1]) * m.vertices[v + 1] +
+                                 double(m.vertices[v + 2]) * m.vertices[v + 2]);
+            maxError = std::max(maxError, std::fabs(r - radius));
+            sumError += std::fabs(r - radius);
+        }
+        printf("%-8g %10.1f %10zu %12.3e %12.3e\n", keep, ms, m.indices.size() / 3, maxError,
+               sumError / std::max<size_t>(1, m.vertices.size() / 3));
+    }
+}
+
+// Edges of the mesh used by one triangle only, not counting those on the faces of the box
+// [lo, hi]^3 where the grid ends. A crack between blocks shows up as such edges.
+long long open_edges(const MCMesh& mesh, float lo, float hi) {
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        for (int c = 0; c < 3; ++c) {
+            uint32_t a = mesh.indices[t + c], b = mesh.indices[t + (c + 1) % 3];
+            edges.emplace_back(std::min(a, b), std::max(a, b));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    auto inside = [&](uint32_t v) {
+        for (int a = 0; a < 3; ++a) {
+            float x = mesh.vertices[3 * v + a];
+            if (x <= lo + 1e-4f || x >= hi - 1e-4f) {
+                return false;
+            }
+        }
+        return true;
+    };
+    long long open = 0;
+    for (size_t e = 0; e < edges.size(); ) {
+        size_t end = e;
+        while (end < edges.size() && edges[end] == edges[e]) {
+            ++end;
+        }
+        if (end - e == 1 && (inside(edges[e].first) || inside(edges[e].second))) {
+            ++open;
+        }
+        e = end;
+    }
+    return open;
+}
+
+// Full resolution marching cubes against level of detail extraction around a viewpoint with
+// cells at most as wide, over the domain and over one ten times as wide.
+template <typename Field>
+void bench_lod(const char* name, Field field, float isovalue, float stepsize, float half) {
+    MCOptions options;
+    options.placement = MCOptions::LINEAR;
+    options.cull = true;
+    MCOptions lodOptions = options;
+    lodOptions.blockSize = 16;
+    float viewpoint[3] = { 0, 0, 0 };
+
+    MCMesh mesh;
+    double ms = time_ms([&]() { mesh = marching_cubes_indexed(field, isovalue, -half, half, stepsize, options); });
+    printf("%-4s %8g %6s %10.2f %10zu %10lld\n", name, 2 * half, "full", ms, mesh.indices.size() / 3,
+           open_edges(mesh, -half, half));
+    for (float scale : { 1.0f, 10.0f }) {
+        float h = scale * half;
+        ms = time_ms([&]() { mesh = marching_cubes_lod(field, isovalue, -h, h, stepsize, viewpoint, lodOptions); });
+        printf("%-4s %8g %6s %10.2f %10zu %10lld\n", name, 2 * h, "lod", ms, mesh.indices.size() / 3,
+               open_edges(mesh, -h, h));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    float stepsize = argc > 1 ? atof(argv[1]) : 0.05f;
+
+    printf("std::function vs templated field, [-5, 5]^3 at stepsize %g (ms)\n", stepsize);
+    printf("%-4s %10s %10s %9s\n", "f", "function", "template", "speedup");
+    bench_dispatch("f1", Field1(), 4.0f, stepsize);
+    bench_dispatch("f5", Field5(), -1.5f, stepsize);
+
+    int nsteps = static_cast<int>(10.0f / stepsize);
+    printf("\nSlice sampling, one lane vs eval_row at %d-wide SIMD, %d^3 lattice (ms)\n", SimdFloat::width, nsteps + 1);
+    printf("%-4s %10s %10s %9s\n", "f", "scalar", "batch", "speedup");
+    bench_batch("f1", Field1(), nsteps);
+    bench_batch("f2", Field2(), nsteps);
+    bench_batch("f3", Field3(), nsteps);
+    bench_batch("f4", Field4(), nsteps);
+    bench_batch("f5", Field5(), nsteps);
+
+    printf("\nVertex placement on the sphere f1 = 4, distance from radius 2\n");
+    bench_placement(2.0f);
+
+    printf("\nRe-extraction at a new isovalue, %d^3 cells, culled field vs span space index (ms)\n", 256);
+    printf("%-4s %8s %10s %10s %9s\n", "f", "isovalue", "field", "index", "speedup");
+    bench_span("f3", Field3(), 256, { -0.5f, 0.0f, 0.5f });
+    bench_span("f5", Field5(), 256, { -3.0f, -1.5f, 0.0f, 2.0f });
+
+    printf("\nCompiled fields vs the same fields as expressions, eval_row ns per sample and extraction at stepsize %g (ms)\n", stepsize);
+    printf("%-4s %8s %8s %7s %10s %10s %7s %10s %10s\n", "f", "field", "expr", "ratio", "field", "expr", "ratio",
+           "triangles", "expr tris");
+    bench_expression("f1", Field1(), "x*x + y*y + z*z", 4.0f, stepsize);
+    bench_expression("f2", Field2(), "sin(x*y*z)", 0.0f, stepsize);
+    bench_expression("f3", Field3(), "sin(x)*cos(y)*sin(z)", 0.0f, stepsize);
+    bench_expression("f4", Field4(), "y - sin(x)*cos(z)", 0.0f, stepsize);
+    bench_expression("f5", Field5(), "x^2 - y^2 - z^2 - z", -1.5f, stepsize);
+
+    printf("\nSDF scenes at stepsize 0.1, every primitive at every sample vs pruned to each chunk's (ms)\n");
+    printf("%10s %10s %10s %9s %10s %10s\n", "primitives", "all", "pruned", "speedup", "per chunk", "triangles");
+    bench_sdf(100, 0.1f);
+    bench_sdf(500, 0.1f);
+    bench_sdf(2000, 0.1f);
+
+    printf("\nSculpting f5 at stepsize 0.05, per edit: full re-extraction vs the 16^3 cell bricks it reaches (ms)\n");
+    printf("%-6s %7s %10s %10s %8s %10s\n", "domain", "radius", "full", "bricks", "bricks", "triangles");
+    bench_sculpt(5.0f, 0.05f);
+    bench_sculpt(10.0f, 0.05f);
+
+    std::vector<float> shells5, shells3;
+    for (int l = 0; l < 10; ++l) {
+        shells5.push_back(-6.0f + 1.2f * l);
+    }
+    for (int l = 0; l < 6; ++l) {
+        shells3.push_back(-0.75f + 0.3f * l);
+    }
+    MCExpression expression5;
+    expression5.compile("x^2 - y^2 - z^2 - z");
+    printf("\nNested shells at stepsize %g, a marching_cubes call per isovalue vs marching_cubes_levels\n", stepsize);
+    printf("%-4s %6s %4s %10s %10s %8s %12s %12s %10s\n", "f", "levels", "cull", "separate", "one pass", "speedup",
+           "evaluations", "one pass", "triangles");
+    bench_levels("f3", Field3(), shells3, stepsize, false);
+    bench_levels("f3", Field3(), shells3, stepsize, true);
+    bench_levels("f5", Field5(), shells5, stepsize, false);
+    bench_levels("f5", Field5(), shells5, stepsize, true);
+    bench_levels("e5", expression5, shells5, stepsize, true);
+
+    printf("\nf5 in 16^3 cell bricks over calls with a time budget vs in one call (ms)\n");
+    printf("%8s %7s %10s %6s %8s %8s %10s %10s\n", "stepsize", "budget", "one call", "calls", "median", "longest",
+           "total", "triangles");
+    bench_progressive(0.02f, 4.0f);
+    bench_progressive(0.02f, 16.0f);
+    bench_progressive(0.01f, 4.0f);
+
+    printf("\nSoup grown per slab vs counted then filled at its exact size, stepsize %g\n", stepsize / 2);
+    printf("%-4s %7s %6s %10s %12s %12s\n", "f", "threads", "output", "ms", "buffer MB", "evaluations");
+    bench_exact("f3", Field3(), 0.0f, stepsize / 2);
+    bench_exact("f5", Field5(), -1.5f, stepsize / 2);
+
+    printf("\nRe-extraction blocking the render loop vs on the worker, welded mesh at stepsize %g (ms)\n", stepsize);
+    printf("%-4s %12s %12s %12s %8s\n", "f", "blocking", "worst call", "latency", "frames");
+    bench_async("f3", Field3(), stepsize, { -0.5f, 0.0f, 0.5f });
+    bench_async("f5", Field5(), stepsize, { -3.0f, -1.5f, 0.0f });
+
+    printf("\nf5 from memory-mapped volume files of %d^3 samples vs the field on their lattice (ms)\n", nsteps + 1);
+    printf("%-8s %10s %10s %10s\n", "source", "open", "extract", "triangles");
+    bench_volume(nsteps);
+
+    printf("\nf5 = -1.5 from a %d^3 uint16 volume of f5 clamped to [-3, 0], raw vs bricked\n", nsteps + 1);
+    printf("%-6s %10s %10s %10s %10s\n", "bricks", "MB", "of raw", "ms", "skipped");
+    bench_bricks(nsteps);
+
+    printf("\nMarching cubes vs surface nets vs dual contouring at stepsize %g, welded meshes\n", stepsize);
+    printf("%-4s %6s %10s %10s %10s %10s\n", "f", "method", "ms", "triangles", "vertices", "< 10 deg");
+    bench_method("f1", Field1(), 4.0f, stepsize);
+    bench_method("f3", Field3(), 0.0f, stepsize);
+    bench_method("f5", Field5(), -1.5f, stepsize);
+
+    printf("\nQuadric decimation of the sphere f1 = 20.25 at stepsize 0.025, distance from radius 4.5\n");
+    bench_decimate(4.5f, 0.025f);
+
+    printf("\nFull resolution vs level of detail around the origin at stepsize 0.05, 16^3 cell blocks\n");
+    printf("%-4s %8s %6s %10s %10s %10s\n", "f", "width", "mode", "ms", "triangles", "open edges");
+    bench_lod("f3", Field3(), 0.0f, 0.05f, 5.0f);
+    bench_lod("f5", Field5(), -1.5f, 0.05f, 5.0f);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,67 @@
+// Converts a volume to the bricked, compressed format of BrickVolume.hpp.
+// Usage: ./MCConvert [volume file] [bricked file] [brick size]
+//        ./MCConvert [raw file] [bricked file] [brick size] [uint8|uint16|float32] [nx] [ny] [nz] [header bytes]
+// The first form reads a file written by mc_write_volume, the second a headerless dump of
+// nx * ny * nz samples, x fastest, after the given number of header bytes.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <string>
+
+#include "Volume.hpp"
+#include "BrickVolume.hpp"
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s volume bricked [brick size] [uint8|uint16|float32 nx ny nz [header bytes]]\n", argv[0]);
+        return 1;
+    }
+    std::string input = argv[1];
+    std::string output = argv[2];
+    int brickSize = argc > 3 ? atoi(argv[3]) : 16;
+
+    MCVolume volume;
+    bool opened;
+    if (argc > 7) {
+        MCVolume::Type type = strcmp(argv[4], "uint8") == 0    ? MCVolume::UINT8
+                              : strcmp(argv[4], "uint16") == 0 ? MCVolume::UINT16
+                                                               : MCVolume::FLOAT32;
+        size_t headerBytes = argc > 8 ? strtoull(argv[8], nullptr, 10) : 0;
+        opened = volume.open_raw(input, type, atoi(argv[5]), atoi(argv[6]), atoi(argv[7]), headerBytes);
+    } else {
+        opened = volume.open(input);
+    }
+    if (!opened) {
+        fprintf(stderr, "cannot read the volume %s\n", input.c_str());
+        return 1;
+    }
+    if (brickSize < 1) {
+        fprintf(stderr, "brick size must be at least 1\n");
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!mc_write_bricks(volume, output, brickSize)) {
+        fprintf(stderr, "cannot write %s\n", output.c_str());
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    MCBrickVolume bricked;
+    bricked.open(output);
+    int total = bricked.brickCount * bricked.brickCount * bricked.brickCount;
+    int constant = 0;
+    for (int b = 0; b < total; ++b) {
+        constant += bricked.bricks[b].bytes == 0;
+    }
+    struct stat in, out;
+    stat(input.c_str(), &in);
+    stat(output.c_str(), &out);
+    printf("%d^3 samples in %d bricks of %d^3 cells, %d constant, %lld bytes from %lld (%.1f%%) in %.2f s\n",
+           bricked.samples, total, brickSize, constant, static_cast<long long>(out.st_size),
+           static_cast<long long>(in.st_size), 100.0 * out.st_size / in.st_size, seconds);
+    return 0;
+}
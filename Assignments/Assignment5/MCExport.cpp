@@ -0,0 +1,100 @@
+// Writes the isosurface of one of the fields to a PLY file without opening a window.
+// Usage: ./MCExport [field 1-5] [stepsize] [file] [min] [max] [keep]
+// With keep below 1 the welded mesh is extracted in memory and decimated to that fraction
+// of its triangles before it is written.
+// Usage: ./MCExport [volume file] [isovalue] [file] extracts a volume written by
+// mc_write_volume or mc_write_bricks on its own lattice instead (see Volume.hpp and
+// BrickVolume.hpp).
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "Fields.hpp"
+#include "MarchingCubes.hpp"
+#include "MeshUtils.hpp"
+#include "Decimate.hpp"
+#include "Volume.hpp"
+#include "BrickVolume.hpp"
+
+int main(int argc, char* argv[]) {
+    MCVolume volume;
+    MCBrickVolume bricked;
+    if (argc > 1 && (volume.open(argv[1]) || bricked.open(argv[1]))) {
+        float isovalue = argc > 2 ? atof(argv[2]) : 0;
+        std::string fileName = argc > 3 ? argv[3] : "volume.ply";
+        MCOptions options;
+        options.threads = 0;
+        options.placement = MCOptions::LINEAR;
+        options.cull = true;
+        size_t triangles = 0;
+        bool written;
+        if (bricked.bricks) {
+            options = bricked.options(options);
+            written = writePLYStreaming(bricked, isovalue, bricked.min, bricked.max(), bricked.stepsize, fileName,
+                                        options, &triangles);
+        } else {
+            written = writePLYStreaming(volume, isovalue, volume.min, volume.max(), volume.stepsize, fileName,
+                                        options, &triangles);
+        }
+        if (!written) {
+            fprintf(stderr, "cannot write %s\n", fileName.c_str());
+            return 1;
+        }
+        printf("wrote %zu triangles to %s\n", triangles, fileName.c_str());
+        return 0;
+    }
+
+    int field = argc > 1 ? atoi(argv[1]) : 5;
+    float stepsize = argc > 2 ? atof(argv[2]) : 0.05f;
+    std::string fileName = argc > 3 ? argv[3] : "F" + std::to_string(field) + ".ply";
+    float min = argc > 4 ? atof(argv[4]) : -5;
+    float max = argc > 5 ? atof(argv[5]) : 5;
+    double keep = argc > 6 ? atof(argv[6]) : 1;
+
+    MCOptions options;
+    options.threads = 0;
+    options.placement = MCOptions::LINEAR;
+    options.cull = true;
+
+    if (field < 1 || field > 5) {
+        fprintf(stderr, "field must be 1 to 5\n");
+        return 1;
+    }
+
+    if (keep < 1) {
+        options.normals = true;
+        MCMesh mesh;
+        switch (field) {
+            case 1: mesh = marching_cubes_indexed(Field1(), 4.0f, min, max, stepsize, options); break;
+            case 2: mesh = marching_cubes_indexed(Field2(), 0.0f, min, max, stepsize, options); break;
+            case 3: mesh = marching_cubes_indexed(Field3(), 0.0f, min, max, stepsize, options); break;
+            case 4: mesh = marching_cubes_indexed(Field4(), 0.0f, min, max, stepsize, options); break;
+            case 5: mesh = marching_cubes_indexed(Field5(), -1.5f, min, max, stepsize, options); break;
+        }
+        size_t extracted = mesh.indices.size() / 3;
+        mesh = decimate(mesh, static_cast<size_t>(keep * extracted));
+        if (!writePLY(mesh, mesh.normals, fileName)) {
+            fprintf(stderr, "cannot write %s\n", fileName.c_str());
+            return 1;
+        }
+        printf("wrote %zu of %zu triangles to %s\n", mesh.indices.size() / 3, extracted, fileName.c_str());
+        return 0;
+    }
+
+    size_t triangles = 0;
+    bool written = false;
+    switch (field) {
+        case 1: written = writePLYStreaming(Field1(), 4.0f, min, max, stepsize, fileName, options, &triangles); break;
+        case 2: written = writePLYStreaming(Field2(), 0.0f, min, max, stepsize, fileName, options, &triangles); break;
+        case 3: written = writePLYStreaming(Field3(), 0.0f, min, max, stepsize, fileName, options, &triangles); break;
+        case 4: written = writePLYStreaming(Field4(), 0.0f, min, max, stepsize, fileName, options, &triangles); break;
+        case 5: written = writePLYStreaming(Field5(), -1.5f, min, max, stepsize, fileName, options, &triangles); break;
+    }
+    if (!written) {
+        fprintf(stderr, "cannot write %s\n", fileName.c_str());
+        return 1;
+    }
+    printf("wrote %zu triangles to %s\n", triangles, fileName.c_str());
+    return 0;
+}
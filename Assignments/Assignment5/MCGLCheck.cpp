@@ -0,0 +1,208 @@
+// Headless check of extraction straight into mapped GL buffers, on an EGL context without
+// a window (Mesa's llvmpipe works, so no GPU or display is needed).
+// Usage: ./MCGLCheck [stepsize]
+// For f1 to f5 it extracts the soup with normals into an MCGLSoup, reads the buffers back
+// and compares them with marching_cubes, and times both against the path A5 used before:
+// extracting into vectors and uploading them into fresh buffers with glBufferData.
+// It then sculpts f5 with a few edits, splicing the bricks each one extracts again into an
+// MCGLBrickSoup, checks every brick's range against the mesher, and times the splice
+// against uploading the whole soup. Last it moves the isovalue and extracts every brick
+// again in calls of a 2 ms budget, splicing each call's bricks, and checks the final ranges.
+// Exits with 1 when a buffer differs or no context can be made.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <chrono>
+#include <vector>
+
+#include "Fields.hpp"
+#include "BrickMesher.hpp"
+#include "MarchingCubes.hpp"
+#include "GLSoup.hpp"
+
+// Makes a desktop GL 3.3 context current on the surfaceless platform, or on the default
+// display where that is missing
+bool make_context() {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = getPlatformDisplay
+                             ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+                             : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config;
+    EGLint configs = 0;
+    eglChooseConfig(display, configAttributes, &config, 1, &configs);
+    EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3, EGL_NONE };
+    EGLContext context = eglCreateContext(display, configs ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT,
+                                          contextAttributes);
+    return context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+// Best of a few runs, in milliseconds
+template <typename Run>
+double time_ms(Run run, int repeats = 3) {
+    double best = 1e30;
+    for (int r = 0; r < repeats; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        glFinish();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+template <typename Field>
+bool check(const char* name, Field field, float isovalue, float stepsize, const MCOptions& options) {
+    std::vector<float> vertices, normals;
+    double vectorMs = time_ms([&]() {
+        vertices = marching_cubes(field, isovalue, -5, 5, stepsize, normals, options);
+        GLuint buffers[2];
+        glGenBuffers(2, buffers);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+        glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), normals.data(), GL_DYNAMIC_DRAW);
+        glFinish();
+        glDeleteBuffers(2, buffers);
+    });
+
+    MCGLSoup soup;
+    soup.create();
+    bool updated = true;
+    double mappedMs = time_ms([&]() {
+        updated = soup.update([&](auto allocate) {
+            return marching_cubes_into(field, isovalue, -5, 5, stepsize, allocate, options);
+        }) && updated;
+    });
+
+    std::vector<float> mappedVertices(3 * soup.vertexCount), mappedNormals(3 * soup.vertexCount);
+    glBindBuffer(GL_ARRAY_BUFFER, soup.vbo);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, mappedVertices.size() * sizeof(float), mappedVertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, soup.nbo);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, mappedNormals.size() * sizeof(float), mappedNormals.data());
+    soup.destroy();
+
+    bool same = updated && glGetError() == GL_NO_ERROR && mappedVertices == vertices && mappedNormals == normals;
+    printf("%-4s %10zu %12.2f %12.2f  %s\n", name, vertices.size() / 9, vectorMs, mappedMs, same ? "same" : "DIFFERENT");
+    return same;
+}
+
+// Reads the range of every brick back from the buffers and compares it with the mesher
+bool same_bricks(const MCGLBrickSoup& soup, const MCBrickMesher& mesher) {
+    std::vector<float> data;
+    for (size_t b = 0; b < mesher.bricks.size(); ++b) {
+        const MCBrickMesher::Brick& brick = mesher.bricks[b];
+        if (soup.count[b] * 3 != static_cast<GLsizei>(brick.vertices.size())) {
+            return false;
+        }
+        GLuint buffers[2] = { soup.vbo, soup.nbo };
+        const std::vector<float>* expected[2] = { &brick.vertices, &brick.normals };
+        for (int i = 0; i < 2 && !brick.vertices.empty(); ++i) {
+            data.resize(brick.vertices.size());
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+            glGetBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(soup.first[b]) * 3 * sizeof(float),
+                               data.size() * sizeof(float), data.data());
+            if (data != *expected[i]) {
+                return false;
+            }
+        }
+    }
+    return glGetError() == GL_NO_ERROR;
+}
+
+bool check_bricks(float stepsize, const MCOptions& options) {
+    MCSculptedField<Field5> field;
+    MCOptions brickOptions = options;
+    brickOptions.normals = true;
+    MCBrickMesher mesher;
+    mesher.reset(-1.5f, -5, 5, stepsize, brickOptions);
+    mesher.update(field);
+    MCGLBrickSoup soup;
+    soup.create();
+    soup.update(mesher);
+    bool same = same_bricks(soup, mesher);
+
+    // edits on the surface x^2 = y^2 + z^2 + z - 1.5, alternately adding and carving
+    const float points[][2] = { { 1.0f, 1.0f }, { -2.0f, 0.5f }, { 0.3f, -2.5f }, { 2.5f, 2.0f }, { -1.0f, -1.5f } };
+    double spliceMs = 0, wholeMs = 0;
+    size_t spliced = 0;
+    for (int e = 0; e < 5; ++e) {
+        float y = points[e][0], z = points[e][1];
+        float lo[3], hi[3];
+        field.add(std::sqrt(y * y + z * z + z - 1.5f), y, z, 0.5f, e % 2 ? 1.0f : -1.0f, lo, hi);
+        mesher.mark(lo, hi);
+        mesher.update(field);
+        spliceMs += time_ms([&]() { soup.update(mesher); }, 1);
+        spliced += soup.uploaded;
+        same = same_bricks(soup, mesher) && same;
+
+        std::vector<float> normals;
+        std::vector<float> vertices = mesher.soup(&normals);
+        wholeMs += time_ms([&]() {
+            GLuint buffers[2];
+            glGenBuffers(2, buffers);
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+            glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), normals.data(), GL_DYNAMIC_DRAW);
+            glFinish();
+            glDeleteBuffers(2, buffers);
+        }, 1);
+    }
+    printf("f5   %10zu %12.2f %12.2f %12zu  %s\n", mesher.triangles(), wholeMs / 5, spliceMs / 5, spliced / 15,
+           same ? "same" : "DIFFERENT");
+
+    // bricks not reached yet keep their last surface, so only the end is compared
+    mesher.reset(-1.0f, -5, 5, stepsize, brickOptions);
+    int calls = 0;
+    while (mesher.pending() > 0) {
+        mesher.update(field, 2.0);
+        soup.update(mesher);
+        ++calls;
+    }
+    bool progressive = same_bricks(soup, mesher);
+    printf("f5 = -1 in %d calls of 2 ms, %zu triangles  %s\n", calls, mesher.triangles(),
+           progressive ? "same" : "DIFFERENT");
+    same = same && progressive;
+    soup.destroy();
+    return same;
+}
+
+int main(int argc, char* argv[]) {
+    float stepsize = argc > 1 ? atof(argv[1]) : 0.05f;
+    if (!make_context()) {
+        fprintf(stderr, "cannot make a headless GL context\n");
+        return 1;
+    }
+    printf("%s, GL %s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+
+    MCOptions options;
+    options.threads = 0;
+    options.cull = true;
+    options.placement = MCOptions::LINEAR;
+
+    printf("Soup with normals at stepsize %g, vectors uploaded with glBufferData vs mapped buffers (ms)\n", stepsize);
+    printf("%-4s %10s %12s %12s\n", "f", "triangles", "vectors", "mapped");
+    bool ok = check("f1", Field1(), 4.0f, stepsize, options);
+    ok = check("f2", Field2(), 0.0f, stepsize, options) && ok;
+    ok = check("f3", Field3(), 0.0f, stepsize, options) && ok;
+    ok = check("f4", Field4(), 0.0f, stepsize, options) && ok;
+    ok = check("f5", Field5(), -1.5f, stepsize, options) && ok;
+
+    printf("\nSculpting f5 in 16^3 cell bricks, per edit: whole soup uploaded vs changed bricks spliced (ms)\n");
+    printf("%-4s %10s %12s %12s %12s\n", "f", "triangles", "whole", "spliced", "triangles");
+    ok = check_bricks(stepsize, options) && ok;
+    return ok ? 0 : 1;
+}
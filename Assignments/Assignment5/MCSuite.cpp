@@ -0,0 +1,150 @@
+// Benchmark suite for marching_cubes over f1 to f5, grid sizes and thread counts, printed as
+// CSV or JSON so results can be compared across commits.
+// Usage: ./MCSuite [csv|json] [largest grid] [repeats] [exact]
+// Each run happens in a child process, so its peak RSS is not hidden by an earlier run.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Fields.hpp"
+#include "MarchingCubes.hpp"
+
+struct SuiteResult {
+    double ms = 0;
+    long long triangles = 0;
+    long long fieldEvaluations = 0;
+    long long cellsSkipped = 0;
+};
+
+// Best of repeats extractions of the field's surface on an nsteps^3 grid over [-5, 5]^3
+template <typename Field>
+SuiteResult run_field(Field field, float isovalue, int nsteps, int threads, int repeats, bool exact) {
+    MCOptions options;
+    options.threads = threads;
+    options.exactOutput = exact;
+    options.placement = MCOptions::LINEAR;
+    options.cull = true;
+
+    SuiteResult result;
+    result.ms = 1e30;
+    for (int r = 0; r < repeats; ++r) {
+        MCStats stats;
+        options.stats = &stats;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<float> vertices = marching_cubes(field, isovalue, -5, 5, 10.0f / nsteps, options);
+        auto end = std::chrono::steady_clock::now();
+        result.ms = std::min(result.ms, std::chrono::duration<double, std::milli>(end - start).count());
+        result.triangles = vertices.size() / 9;
+        result.fieldEvaluations = stats.fieldEvaluations;
+        result.cellsSkipped = stats.cellsSkipped;
+    }
+    return result;
+}
+
+SuiteResult run(int field, int nsteps, int threads, int repeats, bool exact) {
+    switch (field) {
+        case 1: return run_field(Field1(), 4.0f, nsteps, threads, repeats, exact);
+        case 2: return run_field(Field2(), 0.0f, nsteps, threads, repeats, exact);
+        case 3: return run_field(Field3(), 0.0f, nsteps, threads, repeats, exact);
+        case 4: return run_field(Field4(), 0.0f, nsteps, threads, repeats, exact);
+        default: return run_field(Field5(), -1.5f, nsteps, threads, repeats, exact);
+    }
+}
+
+// Runs one configuration in a child process and collects its result and peak RSS in KiB
+bool run_isolated(int field, int nsteps, int threads, int repeats, bool exact, SuiteResult& result, long& peakKiB) {
+    int channel[2];
+    if (pipe(channel) != 0) {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(channel[0]);
+        close(channel[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(channel[0]);
+        SuiteResult r = run(field, nsteps, threads, repeats, exact);
+        ssize_t written = write(channel[1], &r, sizeof(r));
+        _exit(written == static_cast<ssize_t>(sizeof(r)) ? 0 : 1);
+    }
+    close(channel[1]);
+    ssize_t got = read(channel[0], &result, sizeof(result));
+    close(channel[0]);
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return false;
+    }
+    peakKiB = usage.ru_maxrss;
+    return got == static_cast<ssize_t>(sizeof(result));
+}
+
+int main(int argc, char* argv[]) {
+    bool json = argc > 1 && strcmp(argv[1], "json") == 0;
+    int largest = argc > 2 ? atoi(argv[2]) : 512;
+    int repeats = argc > 3 ? std::max(1, atoi(argv[3])) : 3;
+    bool exact = argc > 4 && strcmp(argv[4], "exact") == 0;
+
+    // 64^3 cells doubling up to the largest grid, 1 thread doubling up to every hardware thread
+    std::vector<int> sizes;
+    for (int n = 64; n <= largest; n *= 2) {
+        sizes.push_back(n);
+    }
+    int hw = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    std::vector<int> threadCounts;
+    for (int t = 1; t < hw; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(hw);
+
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("field,nsteps,cells,threads,ms,ns_per_cell,triangles,triangles_per_s,field_evaluations,cells_skipped,peak_rss_kib\n");
+    }
+    bool first = true;
+    for (int field = 1; field <= 5; ++field) {
+        for (int nsteps : sizes) {
+            for (int threads : threadCounts) {
+                fprintf(stderr, "f%d %d^3 %d threads\n", field, nsteps, threads);
+                SuiteResult r;
+                long peakKiB = 0;
+                if (!run_isolated(field, nsteps, threads, repeats, exact, r, peakKiB)) {
+                    fprintf(stderr, "run failed\n");
+                    return 1;
+                }
+                long long cells = static_cast<long long>(nsteps) * nsteps * nsteps;
+                double nsPerCell = r.ms * 1e6 / cells;
+                double trianglesPerSecond = r.ms > 0 ? r.triangles / (r.ms / 1000) : 0;
+                if (json) {
+                    printf("%s  {\"field\": \"f%d\", \"nsteps\": %d, \"cells\": %lld, \"threads\": %d, \"ms\": %.3f, "
+                           "\"ns_per_cell\": %.3f, \"triangles\": %lld, \"triangles_per_s\": %.0f, "
+                           "\"field_evaluations\": %lld, \"cells_skipped\": %lld, \"peak_rss_kib\": %ld}",
+                           first ? "" : ",\n", field, nsteps, cells, threads, r.ms, nsPerCell, r.triangles,
+                           trianglesPerSecond, r.fieldEvaluations, r.cellsSkipped, peakKiB);
+                } else {
+                    printf("f%d,%d,%lld,%d,%.3f,%.3f,%lld,%.0f,%lld,%lld,%ld\n", field, nsteps, cells, threads, r.ms,
+                           nsPerCell, r.triangles, trianglesPerSecond, r.fieldEvaluations, r.cellsSkipped, peakKiB);
+                }
+                fflush(stdout);
+                first = false;
+            }
+        }
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+    return 0;
+}
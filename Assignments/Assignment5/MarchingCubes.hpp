@@ -0,0 +1,1199 @@
+#ifndef MARCHINGCUBES_HPP
+#define MARCHINGCUBES_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Interval.hpp"
+#include "TriTable.hpp"
+
+// Counters filled in by marching_cubes when MCOptions::stats is set.
+struct MCStats {
+    // Number of calls made to the scalar field
+    long long fieldEvaluations = 0;
+
+    // Number of cells in blocks that culling proved empty and never visited
+    long long cellsSkipped = 0;
+};
+
+// Settings for marching_cubes. The defaults reproduce the single threaded extractor.
+struct MCOptions {
+    // Number of worker threads, 0 uses every hardware thread
+    int threads = 1;
+
+    // Depth of each z-slab in cells, 0 picks one from the thread count
+    int slabDepth = 0;
+
+    // Receives the extraction counters when not null
+    MCStats* stats = nullptr;
+
+    // Skip blocks of cells that provably cannot contain the isovalue. The domain is split
+    // as an octree down to blocks of blockSize^3 cells, and a block is dropped when the
+    // field's bounds() interval or the Lipschitz bound below keeps it off the isovalue.
+    bool cull = false;
+    int blockSize = 8;
+
+    // Upper bound on |grad f| for fields without bounds(), 0 when unknown
+    float lipschitz = 0;
+
+    // Where a vertex is put on a cube edge that crosses the isovalue: at the midpoint of the
+    // edge, where the line through the two corner values crosses it, or at that point
+    // refined by one secant step with one more sample of the field
+    enum VertexPlacement { MIDPOINT, LINEAR, SECANT };
+    VertexPlacement placement = MIDPOINT;
+
+    // Give marching_cubes_indexed meshes a unit normal per vertex, taken from the field
+    // gradient while extracting. The soup overload of marching_cubes with a normals
+    // argument always computes them.
+    bool normals = false;
+
+    // Build the soup of marching_cubes in two passes: the first classifies the cells and
+    // counts the triangles of each slab, the second samples the lattice again and writes
+    // every slab straight to its offset in a buffer allocated once at the exact size.
+    // Halves the peak memory of large meshes at the cost of sampling the field twice.
+    bool exactOutput = false;
+
+    // marching_cubes_lod refines the octree of blocks around the viewpoint while a block is
+    // nearer to it than lodDetail times its width (see LevelOfDetail.hpp)
+    float lodDetail = 2.0f;
+};
+
+// Welded triangle mesh: xyz positions and three indices per triangle, and an xyz normal
+// per vertex when MCOptions::normals is set.
+struct MCMesh {
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<float> normals;
+};
+
+// Grid edge that each of the 12 cube edges lies on, as the axis it runs along and the
+// offset of its first lattice point from the cube origin.
+const int edgeAxis[12] = { 0, 2, 0, 2, 0, 2, 0, 2, 1, 1, 1, 1 };
+const int edgeOffset[12][3] = {
+    {0, 0, 0}, {1, 0, 0}, {0, 0, 1}, {0, 0, 0},
+    {0, 1, 0}, {1, 1, 0}, {0, 1, 1}, {0, 1, 0},
+    {0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1},
+};
+
+// Cube corners at the start and the end of each edge, in the order of vals[] in marching_cubes_slab
+const int edgeCorners[12][2] = {
+    {0, 1}, {1, 2}, {3, 2}, {0, 3},
+    {4, 5}, {5, 6}, {7, 6}, {4, 7},
+    {0, 4}, {1, 5}, {2, 6}, {3, 7},
+};
+
+inline int mc_thread_count(const MCOptions& options) {
+    if (options.threads > 0) {
+        return options.threads;
+    }
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    return hw > 0 ? hw : 1;
+}
+
+// Batch field interface. A field may provide
+//     void eval_row(const float* x, const float* y, const float* z, float* out, int count) const
+// to evaluate count samples given as SoA arrays in one call (see Fields.hpp). Fields without
+// it are sampled one point at a time through operator().
+template <typename Field, typename = void>
+struct mc_has_eval_row : std::false_type {};
+
+template <typename Field>
+struct mc_has_eval_row<Field, decltype(std::declval<const Field&>().eval_row(
+        (const float*)0, (const float*)0, (const float*)0, (float*)0, 0))> : std::true_type {};
+
+template <typename Field>
+void mc_eval_row(const Field& f, const float* x, const float* y, const float* z, float* out, int count) {
+    if constexpr (mc_has_eval_row<Field>::value) {
+        f.eval_row(x, y, z, out, count);
+    } else {
+        for (int i = 0; i < count; ++i) {
+            out[i] = f(x[i], y[i], z[i]);
+        }
+    }
+}
+
+// A field may provide its gradient,
+//     void gradient(float x, float y, float z, float* g) const
+// which is used for vertex normals. Other fields are differenced numerically.
+template <typename Field, typename = void>
+struct mc_has_gradient : std::false_type {};
+
+template <typename Field>
+struct mc_has_gradient<Field, decltype(std::declval<const Field&>().gradient(0.0f, 0.0f, 0.0f, (float*)0))> : std::true_type {};
+
+template <typename Field, typename = void>
+struct mc_has_bounds : std::false_type {};
+
+template <typename Field>
+struct mc_has_bounds<Field, decltype((void)std::declval<const Field&>().bounds(
+        Interval(), Interval(), Interval()))> : std::true_type {};
+
+// Fields already sampled on the lattice of the grid may provide
+//     const float* lattice_slice(int k) const
+// returning the (nsteps + 1)^2 row-major values of slice k, which marching_cubes_slab then
+// reads in place instead of sampling the field (see SpanSpace.hpp).
+template <typename Field, typename = void>
+struct mc_has_lattice : std::false_type {};
+
+template <typename Field>
+struct mc_has_lattice<Field, decltype((void)std::declval<const Field&>().lattice_slice(0))> : std::true_type {};
+
+// Coordinates of one row of lattice points, laid out for mc_eval_row.
+struct MCRow {
+    std::vector<float> x, y, z;
+
+    MCRow(float min, float stepsize, int n) : x(n), y(n), z(n) {
+        for (int i = 0; i < n; ++i) {
+            x[i] = min + i * stepsize;
+        }
+    }
+};
+
+// The grid split into count^3 blocks of size^3 cells (the last ones may be smaller) and
+// which of them may hold part of the surface. Without culling it is a single active block.
+struct MCBlocks {
+    int size;
+    int count;
+    std::vector<uint8_t> active;
+
+    // Columns of cells [x0, x1) x [y0, y1) that a walk is working on, such as a brick of
+    // MCBrickMesher. Sampling and the walk stay inside them, and the defaults cover the
+    // whole grid.
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = std::numeric_limits<int>::max();
+    int y1 = std::numeric_limits<int>::max();
+
+    // Row length of slice buffers holding only the points of the window. 0 when they hold
+    // whole slices.
+    int stride = 0;
+
+    // Offset of lattice point (i, j) in the slice buffers, for a grid of n^2 points a slice
+    size_t slot(int i, int j, int n) const {
+        return stride > 0 ? static_cast<size_t>(j - y0) * stride + (i - x0) : static_cast<size_t>(j) * n + i;
+    }
+
+    bool is_active(int bx, int by, int bz) const {
+        return active[(bz * count + by) * count + bx] != 0;
+    }
+};
+
+// Fields stored on a lattice of their own, such as volumes read from disk, may provide
+//     long long sample_slice(float min, float stepsize, int nsteps, const MCBlocks& blocks,
+//                            int k, float* slice) const
+// writing at least the values of slice k that mc_sample_slice would sample, in its layout,
+// and returning how many it wrote. mc_sample_slice then calls it instead of sampling the
+// field (see Volume.hpp and BrickVolume.hpp).
+template <typename Field, typename = void>
+struct mc_has_sample_slice : std::false_type {};
+
+template <typename Field>
+struct mc_has_sample_slice<Field, decltype((void)std::declval<const Field&>().sample_slice(
+        0.0f, 0.0f, 0, std::declval<const MCBlocks&>(), 0, (float*)0))> : std::true_type {};
+
+// Range of f over the box [lo, hi], from its bounds() and/or a Lipschitz bound.
+// Returns false when neither is available.
+template <typename Field>
+bool mc_field_range(const Field& f, const float lo[3], const float hi[3], const MCOptions& options,
+                    Interval& range, MCStats& stats)
+{
+    bool known = false;
+    if constexpr (mc_has_bounds<Field>::value) {
+        range = f.bounds(Interval(lo[0], hi[0]), Interval(lo[1], hi[1]), Interval(lo[2], hi[2]));
+        known = true;
+    }
+    if (options.lipschitz > 0) {
+        // |f(p) - f(c)| <= L |p - c| <= L r, with c the centre and r the half diagonal
+        float c[3], r2 = 0;
+        for (int a = 0; a < 3; ++a) {
+            c[a] = 0.5f * (lo[a] + hi[a]);
+            r2 += (hi[a] - c[a]) * (hi[a] - c[a]);
+        }
+        float fc = f(c[0], c[1], c[2]);
+        stats.fieldEvaluations++;
+        float d = options.lipschitz * std::sqrt(r2);
+        Interval lipschitz(fc - d, fc + d);
+        range = known ? intersect(range, lipschitz) : lipschitz;
+        known = true;
+    }
+    return known;
+}
+
+// Marks the blocks in [b0, b1) that may hold the surface of one of the count isovalues,
+// given in increasing order, splitting the range in halves along every axis until it is a
+// single block, and counts the cells of the dropped ones.
+template <typename Field>
+void mc_cull_blocks(const Field& f, const float* isovalues, int count, float min, float stepsize, int nsteps,
+                    const MCOptions& options, MCBlocks& blocks, const int b0[3], const int b1[3],
+                    MCStats& stats)
+{
+    float lo[3], hi[3];
+    long long cells = 1;
+    for (int a = 0; a < 3; ++a) {
+        int c0 = b0[a] * blocks.size;
+        int c1 = std::min(b1[a] * blocks.size, nsteps);
+        lo[a] = min + c0 * stepsize;
+        hi[a] = min + c1 * stepsize;
+        cells *= c1 - c0;
+    }
+
+    Interval range;
+    mc_field_range(f, lo, hi, options, range, stats);
+
+    // Leave room for rounding in the samples and in the interval arithmetic itself
+    float pad = 1e-5f * (1.0f + std::fabs(range.lo) + std::fabs(range.hi));
+    const float* level = std::lower_bound(isovalues, isovalues + count, range.lo - pad);
+    if (level == isovalues + count || *level > range.hi + pad) {
+        stats.cellsSkipped += cells;
+        return;
+    }
+
+    if (b1[0] - b0[0] == 1 && b1[1] - b0[1] == 1 && b1[2] - b0[2] == 1) {
+        blocks.active[(b0[2] * blocks.count + b0[1]) * blocks.count + b0[0]] = 1;
+        return;
+    }
+
+    int mid[3];
+    for (int a = 0; a < 3; ++a) {
+        mid[a] = (b0[a] + b1[a] + 1) / 2;
+    }
+    for (int octant = 0; octant < 8; ++octant) {
+        int c0[3], c1[3];
+        bool empty = false;
+        for (int a = 0; a < 3; ++a) {
+            bool upper = (octant >> a) & 1;
+            c0[a] = upper ? mid[a] : b0[a];
+            c1[a] = upper ? b1[a] : mid[a];
+            empty = empty || c0[a] == c1[a];
+        }
+        if (!empty) {
+            mc_cull_blocks(f, isovalues, count, min, stepsize, nsteps, options, blocks, c0, c1, stats);
+        }
+    }
+}
+
+// Blocks that may hold the surface of one of the count isovalues, in increasing order
+template <typename Field>
+MCBlocks mc_make_blocks(const Field& f, const float* isovalues, int count, float min, float stepsize, int nsteps,
+                        const MCOptions& options, MCStats& stats)
+{
+    MCBlocks blocks;
+    bool bounded = mc_has_bounds<Field>::value || options.lipschitz > 0;
+    if (!options.cull || !bounded || options.blockSize <= 0 || options.blockSize >= nsteps) {
+        blocks.size = nsteps;
+        blocks.count = 1;
+        blocks.active.assign(1, 1);
+        return blocks;
+    }
+
+    blocks.size = options.blockSize;
+    blocks.count = (nsteps + blocks.size - 1) / blocks.size;
+    blocks.active.assign(blocks.count * blocks.count * blocks.count, 0);
+    int b0[3] = { 0, 0, 0 };
+    int b1[3] = { blocks.count, blocks.count, blocks.count };
+    mc_cull_blocks(f, isovalues, count, min, stepsize, nsteps, options, blocks, b0, b1, stats);
+    return blocks;
+}
+
+template <typename Field>
+MCBlocks mc_make_blocks(const Field& f, float isovalue, float min, float stepsize, int nsteps,
+                        const MCOptions& options, MCStats& stats)
+{
+    return mc_make_blocks(f, &isovalue, 1, min, stepsize, nsteps, options, stats);
+}
+
+// Calls run(j, i0, count) for the lattice points of slice k that the active blocks touch,
+// as runs of count points from (i0, j) along x. Consecutive active blocks along a row make
+// one run. Only the points of the cells in the window of blocks are visited.
+template <typename Run>
+void mc_slice_runs(int nsteps, const MCBlocks& blocks, int k, Run run)
+{
+    int size = blocks.size;
+    int xEnd = std::min(blocks.x1, nsteps);
+    int yEnd = std::min(blocks.y1, nsteps);
+    int bx0 = blocks.x0 / size, bx1 = (xEnd + size - 1) / size;
+    int by0 = blocks.y0 / size, by1 = (yEnd + size - 1) / size;
+    int width = bx1 - bx0;
+
+    // Blocks of the layers below and above the slice, merged into one column mask per block
+    // row. The masks are kept per thread, as MCBrickMesher comes here for every brick.
+    int bz0 = k > 0 ? (k - 1) / size : -1;
+    int bz1 = k < nsteps ? k / size : -1;
+    static thread_local std::vector<uint8_t> columns, needed;
+    columns.assign(static_cast<size_t>(by1 - by0) * width, 0);
+    for (int bz : { bz0, bz1 }) {
+        if (bz < 0) {
+            continue;
+        }
+        for (int by = by0; by < by1; ++by) {
+            const uint8_t* layer = blocks.active.data() + (bz * blocks.count + by) * blocks.count + bx0;
+            uint8_t* mask = columns.data() + (by - by0) * width;
+            for (int b = 0; b < width; ++b) {
+                mask[b] |= layer[b];
+            }
+        }
+    }
+
+    // Likewise for the block rows before and after each lattice row
+    needed.resize(width);
+    int neededBy0 = -2, neededBy1 = -2;
+
+    for (int j = blocks.y0; j <= yEnd; ++j)
+    {
+        int rowBy0 = j > blocks.y0 ? (j - 1) / size : -1;
+        int rowBy1 = j < yEnd ? j / size : -1;
+        if (rowBy0 != neededBy0 || rowBy1 != neededBy1) {
+            std::fill(needed.begin(), needed.end(), 0);
+            for (int by : { rowBy0, rowBy1 }) {
+                for (int b = 0; by >= 0 && b < width; ++b) {
+                    needed[b] |= columns[(by - by0) * width + b];
+                }
+            }
+            neededBy0 = rowBy0;
+            neededBy1 = rowBy1;
+        }
+
+        for (int b = 0; b < width; )
+        {
+            if (!needed[b]) {
+                ++b;
+                continue;
+            }
+            int start = b;
+            while (b < width && needed[b]) {
+                ++b;
+            }
+            int i0 = std::max((bx0 + start) * size, blocks.x0);
+            run(j, i0, std::min((bx0 + b) * size, xEnd) - i0 + 1);
+        }
+    }
+}
+
+// Samples the lattice points of slice k into a (nsteps + 1)^2 row-major array indexed by j * (nsteps + 1) + i,
+// or into the smaller array of the window when the blocks give it a stride (see MCBlocks::slot).
+// Only points on active blocks are sampled, each run of consecutive active blocks along a
+// row being handed to the field in one batch. Returns the number of samples taken.
+template <typename Field>
+long long mc_sample_slice(
+        const Field& f,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        int k,
+        MCRow& row,
+        float* slice)
+{
+    if constexpr (mc_has_sample_slice<Field>::value) {
+        return f.sample_slice(min, stepsize, nsteps, blocks, k, slice);
+    }
+
+    int n = nsteps + 1;
+    long long evaluations = 0;
+    mc_slice_runs(nsteps, blocks, k, [&](int j, int i0, int count) {
+        // Only the runs are filled in, as a window covers a small part of the row
+        std::fill(row.y.begin() + i0, row.y.begin() + i0 + count, min + j * stepsize);
+        std::fill(row.z.begin() + i0, row.z.begin() + i0 + count, min + k * stepsize);
+        mc_eval_row(f, row.x.data() + i0, row.y.data() + i0, row.z.data() + i0, slice + blocks.slot(i0, j, n), count);
+        evaluations += count;
+    });
+    return evaluations;
+}
+
+// Values of slice k, read in place from lattice fields and otherwise sampled into slice,
+// which then holds (nsteps + 1)^2 values.
+template <typename Field>
+const float* mc_load_slice(
+        const Field& f,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        int k,
+        MCRow& row,
+        std::vector<float>& slice,
+        MCStats& stats)
+{
+    if constexpr (mc_has_lattice<Field>::value) {
+        return f.lattice_slice(k);
+    } else {
+        stats.fieldEvaluations += mc_sample_slice(f, min, stepsize, nsteps, blocks, k, row, slice.data());
+        return slice.data();
+    }
+}
+
+// Fraction of the way from v0 to v1 at which a linear function crosses the isovalue.
+inline float mc_crossing(float v0, float v1, float isovalue) {
+    if (v0 == v1) {
+        return 0.5f;
+    }
+    float t = (isovalue - v0) / (v1 - v0);
+    return std::min(1.0f, std::max(0.0f, t));
+}
+
+// Position of the vertex on edge of cube (i, j, k) whose corner values are vals.
+template <typename Field>
+void mc_place_vertex(
+        const Field& f,
+        float isovalue,
+        float min,
+        float stepsize,
+        MCOptions::VertexPlacement placement,
+        int edge,
+        int i,
+        int j,
+        int k,
+        const std::array<float, 8>& vals,
+        float* p,
+        MCStats& stats)
+{
+    int axis = edgeAxis[edge];
+    float t = 0.5f;
+    if (placement != MCOptions::MIDPOINT)
+    {
+        float v0 = vals[edgeCorners[edge][0]];
+        float v1 = vals[edgeCorners[edge][1]];
+        t = mc_crossing(v0, v1, isovalue);
+
+        if (placement == MCOptions::SECANT)
+        {
+            float q[3] = {
+                min + (i + edgeOffset[edge][0]) * stepsize,
+                min + (j + edgeOffset[edge][1]) * stepsize,
+                min + (k + edgeOffset[edge][2]) * stepsize,
+            };
+            q[axis] += t * stepsize;
+            float fq = f(q[0], q[1], q[2]);
+            stats.fieldEvaluations++;
+
+            // Keep the half of the edge that still brackets the crossing
+            if ((fq < isovalue) == (v0 < isovalue)) {
+                t += (1.0f - t) * mc_crossing(fq, v1, isovalue);
+            } else {
+                t *= mc_crossing(v0, fq, isovalue);
+            }
+        }
+    }
+
+    int index[3] = { i + edgeOffset[edge][0], j + edgeOffset[edge][1], k + edgeOffset[edge][2] };
+    p[0] = min + index[0] * stepsize;
+    p[1] = min + index[1] * stepsize;
+    p[2] = min + index[2] * stepsize;
+    p[axis] = min + (index[axis] + t) * stepsize;
+}
+
+// Unit normal of the surface at p, along the gradient of the field, which is the side
+// the triangles of marching_cubes_slab face. Fields without a gradient() are differenced
+// over half a step around p.
+template <typename Field>
+void mc_vertex_normal(const Field& f, const float* p, float stepsize, float* n, MCStats& stats)
+{
+    if constexpr (mc_has_gradient<Field>::value) {
+        f.gradient(p[0], p[1], p[2], n);
+    } else {
+        float h = 0.5f * stepsize;
+        n[0] = f(p[0] + h, p[1], p[2]) - f(p[0] - h, p[1], p[2]);
+        n[1] = f(p[0], p[1] + h, p[2]) - f(p[0], p[1] - h, p[2]);
+        n[2] = f(p[0], p[1], p[2] + h) - f(p[0], p[1], p[2] - h);
+        stats.fieldEvaluations += 6;
+    }
+    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length > 0.0f) {
+        float scale = 1.0f / length;
+        n[0] *= scale;
+        n[1] *= scale;
+        n[2] *= scale;
+    }
+}
+
+// Triangle soup output: three xyz vertices per triangle, and their normals when
+// withNormals is set. place(p, n) writes the position of the vertex into p and, when n
+// is not null, its normal into n.
+struct MCSoupOutput {
+    bool withNormals = false;
+    std::vector<float> vertices;
+    std::vector<float> normals;
+
+    void begin_layer(int) {}
+    void end_layer() {}
+
+    template <typename Place>
+    void vertex(int, int, int, int, Place place) {
+        float p[3], n[3];
+        place(p, withNormals ? n : nullptr);
+        vertices.insert(vertices.end(), p, p + 3);
+        if (withNormals) {
+            normals.insert(normals.end(), n, n + 3);
+        }
+    }
+};
+
+// Number of triangles marching_cubes_lut holds for each cube index.
+inline const std::array<uint8_t, 256>& mc_triangle_counts() {
+    static const std::array<uint8_t, 256> counts = [] {
+        std::array<uint8_t, 256> c;
+        for (int cubeindex = 0; cubeindex < 256; ++cubeindex) {
+            int l = 0;
+            while (marching_cubes_lut[cubeindex][l] != -1) {
+                ++l;
+            }
+            c[cubeindex] = static_cast<uint8_t>(l / 3);
+        }
+        return c;
+    }();
+    return counts;
+}
+
+// Output of the counting pass of MCOptions::exactOutput. marching_cubes_slab stops at the
+// cube index and adds its triangle count instead of placing any vertex.
+struct MCCountOutput {
+    size_t triangles = 0;
+
+    void begin_layer(int) {}
+    void end_layer() {}
+
+    template <typename Place>
+    void vertex(int, int, int, int, Place) {}
+};
+
+// Output of the filling pass of MCOptions::exactOutput: places each vertex in place at the
+// next position of a buffer sized by the counting pass, and its normal when normals is set.
+struct MCFillOutput {
+    float* vertices = nullptr;
+    float* normals = nullptr;
+
+    void begin_layer(int) {}
+    void end_layer() {}
+
+    template <typename Place>
+    void vertex(int, int, int, int, Place place) {
+        place(vertices, normals);
+        vertices += 3;
+        if (normals) {
+            normals += 3;
+        }
+    }
+};
+
+// Indexed output that welds vertices by grid edge. The vertex indices of the x and y edges
+// on the slices below and above the current layer and of the z edges between them are kept
+// in rolling arrays, so each crossing is emitted once however many cubes share it.
+struct MCIndexedOutput {
+    static constexpr uint32_t NONE = 0xffffffffu;
+
+    int n = 0;
+    bool withNormals = false;
+    MCMesh mesh;
+
+    // Edge slots of the current layer, indexed by the lattice point the edge starts at
+    std::vector<uint32_t> xLower, yLower, xUpper, yUpper, zEdges;
+
+    // The slots each of those has filled, so that rolling a layer resets only them
+    std::vector<int> xLowerFilled, yLowerFilled, xUpperFilled, yUpperFilled, zFilled;
+
+    // Slots of the first slice of the slab, used to weld it to the slab below
+    std::vector<uint32_t> xBottom, yBottom;
+    bool firstLayer = true;
+
+    MCIndexedOutput() {}
+    MCIndexedOutput(int nsteps, bool withNormals_)
+        : n(nsteps + 1), withNormals(withNormals_),
+          xLower(n * n, NONE), yLower(n * n, NONE), xUpper(n * n, NONE),
+          yUpper(n * n, NONE), zEdges(n * n, NONE) {}
+
+    void begin_layer(int) {}
+
+    void end_layer() {
+        if (firstLayer) {
+            xBottom = xLower;
+            yBottom = yLower;
+            firstLayer = false;
+        }
+        std::swap(xLower, xUpper);
+        std::swap(yLower, yUpper);
+        std::swap(xLowerFilled, xUpperFilled);
+        std::swap(yLowerFilled, yUpperFilled);
+        reset(xUpper, xUpperFilled);
+        reset(yUpper, yUpperFilled);
+        reset(zEdges, zFilled);
+    }
+
+    template <typename Place>
+    void vertex(int edge, int i, int j, int, Place place) {
+        int slot = (j + edgeOffset[edge][1]) * n + i + edgeOffset[edge][0];
+        std::vector<uint32_t>* slots;
+        std::vector<int>* filled;
+        if (edgeAxis[edge] == 2) {
+            slots = &zEdges;
+            filled = &zFilled;
+        } else if (edgeOffset[edge][2] == 0) {
+            slots = edgeAxis[edge] == 0 ? &xLower : &yLower;
+            filled = edgeAxis[edge] == 0 ? &xLowerFilled : &yLowerFilled;
+        } else {
+            slots = edgeAxis[edge] == 0 ? &xUpper : &yUpper;
+            filled = edgeAxis[edge] == 0 ? &xUpperFilled : &yUpperFilled;
+        }
+
+        uint32_t& index = (*slots)[slot];
+        if (index == NONE) {
+            filled->push_back(slot);
+            float p[3], normal[3];
+            place(p, withNormals ? normal : nullptr);
+            index = static_cast<uint32_t>(mesh.vertices.size() / 3);
+            mesh.vertices.insert(mesh.vertices.end(), p, p + 3);
+            if (withNormals) {
+                mesh.normals.insert(mesh.normals.end(), normal, normal + 3);
+            }
+        }
+        mesh.indices.push_back(index);
+    }
+
+private:
+    static void reset(std::vector<uint32_t>& slots, std::vector<int>& filled) {
+        for (int slot : filled) {
+            slots[slot] = NONE;
+        }
+        filled.clear();
+    }
+};
+
+// Extracts the triangles of the cubes with k0 <= k < k1 in the window of blocks into out,
+// rolling the slices lower and upper upwards (see marching_cubes_slab).
+template <typename Field, typename Output>
+void mc_walk_window(
+        const Field& f,
+        float isovalue,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& window,
+        MCOptions::VertexPlacement placement,
+        int k0,
+        int k1,
+        std::vector<float>& lower,
+        std::vector<float>& upper,
+        MCRow& row,
+        Output& out,
+        MCStats& stats)
+{
+    int n = nsteps + 1;
+    const float* lowerValues = mc_load_slice(f, min, stepsize, nsteps, window, k0, row, lower, stats);
+    int xEnd = std::min(window.x1, nsteps);
+    int yEnd = std::min(window.y1, nsteps);
+
+    // Lattice fields hand out whole slices, and the buffers of the others may hold the window only
+    bool whole = mc_has_lattice<Field>::value || window.stride == 0;
+    int stride = whole ? n : window.stride;
+    int x0 = whole ? 0 : window.x0;
+    int y0 = whole ? 0 : window.y0;
+
+    for (int k = k0; k < k1; ++k)
+    {
+        const float* upperValues = mc_load_slice(f, min, stepsize, nsteps, window, k + 1, row, upper, stats);
+        out.begin_layer(k);
+        int bz = k / window.size;
+
+        for (int j = window.y0; j < yEnd; ++j)
+        {
+            // Rows of the slices, indexed by i - x0
+            const float* lo0 = lowerValues + (j - y0) * stride;
+            const float* lo1 = lo0 + stride;
+            const float* up0 = upperValues + (j - y0) * stride;
+            const float* up1 = up0 + stride;
+            int by = j / window.size;
+
+            for (int bx = window.x0 / window.size; bx * window.size < xEnd; ++bx)
+            {
+                if (!window.is_active(bx, by, bz)) {
+                    continue;
+                }
+                // Cube index bits of the four corners on lattice column i, as the left face
+                // of a cube. Each column is tested once and shifted into place when it
+                // becomes the right face of the cube before it.
+                auto column = [&](int x) {
+                    return (lo0[x] < isovalue ? 1 : 0) | (up0[x] < isovalue ? 8 : 0) |
+                           (lo1[x] < isovalue ? 16 : 0) | (up1[x] < isovalue ? 128 : 0);
+                };
+
+                int iBegin = std::max(bx * window.size, window.x0);
+                int iEnd = std::min((bx + 1) * window.size, xEnd);
+                int left = column(iBegin - x0);
+                for (int i = iBegin; i < iEnd; ++i)
+                {
+                    int x = i - x0;
+                    int right = column(x + 1);
+                    int cubeindex = left | ((right & 0x11) << 1) | ((right & 0x88) >> 1);
+                    left = right;
+                    if (cubeindex == 0 || cubeindex == 255) {
+                        continue;
+                    }
+                    if constexpr (std::is_same<Output, MCCountOutput>::value) {
+                        out.triangles += mc_triangle_counts()[cubeindex];
+                        continue;
+                    }
+
+                    // Look up the corner values of the current cube from the cached slices
+                    std::array<float, 8> vals;
+                    vals[0] = lo0[x];
+                    vals[1] = lo0[x + 1];
+                    vals[2] = up0[x + 1];
+                    vals[3] = up0[x];
+                    vals[4] = lo1[x];
+                    vals[5] = lo1[x + 1];
+                    vals[6] = up1[x + 1];
+                    vals[7] = up1[x];
+
+                    // Use the LUTs to generate the vertices for the current cube
+                    for (int l = 0; marching_cubes_lut[cubeindex][l] != -1; ++l)
+                    {
+                        int edge = marching_cubes_lut[cubeindex][l];
+                        out.vertex(edge, i, j, k, [&](float* p, float* normal) {
+                            mc_place_vertex(f, isovalue, min, stepsize, placement, edge, i, j, k, vals, p, stats);
+                            if (normal) {
+                                mc_vertex_normal(f, p, stepsize, normal, stats);
+                            }
+                        });
+                    }
+                }
+            }
+        }
+
+        out.end_layer();
+        std::swap(lower, upper);
+        lowerValues = upperValues;
+    }
+}
+
+// Extracts the triangles of every cube with k0 <= k < k1 into out.
+// The grid is walked z-major so that concatenating slabs in order gives the serial result.
+// Two slices of corner values are kept and rolled upwards, so every lattice point of the
+// slab is sampled exactly once instead of once per cube touching it.
+template <typename Field, typename Output>
+void marching_cubes_slab(
+        const Field& f,
+        float isovalue,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        MCOptions::VertexPlacement placement,
+        int k0,
+        int k1,
+        Output& out,
+        MCStats& stats)
+{
+    int n = nsteps + 1;
+    constexpr bool lattice = mc_has_lattice<Field>::value;
+    std::vector<float> lower(lattice ? 0 : static_cast<size_t>(n) * n);
+    std::vector<float> upper(lattice ? 0 : static_cast<size_t>(n) * n);
+    MCRow row(min, stepsize, lattice ? 0 : n);
+    mc_walk_window(f, isovalue, min, stepsize, nsteps, blocks, placement, k0, k1, lower, upper, row, out, stats);
+}
+
+// Depth in cells of the z-slabs the grid is split into.
+inline int mc_slab_depth(int nsteps, const MCOptions& options) {
+    if (options.slabDepth > 0) {
+        return options.slabDepth;
+    }
+    // A few slabs per worker keeps the pool busy when the surface is unevenly spread
+    int threads = std::min(mc_thread_count(options), nsteps);
+    return threads <= 1 ? nsteps : std::max(1, nsteps / (threads * 4));
+}
+
+// Runs extract(s, k0, k1) for each of the nslabs z-slabs of depth cells on a pool of workers.
+template <typename Extract>
+void mc_run_slabs(int nsteps, int depth, int nslabs, const MCOptions& options, Extract extract)
+{
+    int threads = std::min(mc_thread_count(options), nslabs);
+
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int s = next++; s < nslabs; s = next++) {
+            int k0 = s * depth;
+            extract(s, k0, std::min(nsteps, k0 + depth));
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+}
+
+inline void mc_report_stats(const std::vector<MCStats>& slabStats, const MCOptions& options) {
+    if (options.stats) {
+        MCStats stats;
+        for (const MCStats& slab : slabStats) {
+            stats.fieldEvaluations += slab.fieldEvaluations;
+            stats.cellsSkipped += slab.cellsSkipped;
+        }
+        *options.stats = stats;
+    }
+}
+
+// Extracts the soup of the given blocks in two passes straight into memory the caller
+// provides. Each slab counts its triangles from the cube indices alone, the counts are
+// prefix-summed into the offset of every slab, and allocate(triangles, vertices, normals) is
+// called on the calling thread to point vertices at room for 9 * triangles floats and, for
+// normals to be written too, normals at as many. The slabs are then extracted again straight
+// into that memory. Both passes sample the same blocks in the same batches, so they see the
+// same values and the second fills exactly the triangles the first counted, without locks
+// or a merge. Leaving vertices null skips the second pass. Returns the triangle count.
+template <typename Field, typename Allocate>
+size_t mc_extract_soup_into(
+        const Field& f,
+        float isovalue,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        const MCOptions& options,
+        std::vector<MCStats> slabStats,
+        Allocate allocate)
+{
+    int depth = mc_slab_depth(nsteps, options);
+    int nslabs = (nsteps + depth - 1) / depth;
+    size_t first = slabStats.size();
+    slabStats.resize(first + nslabs);
+
+    std::vector<size_t> offsets(nslabs + 1, 0);
+    mc_run_slabs(nsteps, depth, nslabs, options, [&](int s, int k0, int k1) {
+        MCCountOutput count;
+        marching_cubes_slab(f, isovalue, min, stepsize, nsteps, blocks, options.placement, k0, k1, count, slabStats[first + s]);
+        offsets[s + 1] = count.triangles;
+    });
+    for (int s = 0; s < nslabs; ++s) {
+        offsets[s + 1] += offsets[s];
+    }
+
+    float* vertices = nullptr;
+    float* normals = nullptr;
+    allocate(offsets[nslabs], vertices, normals);
+    if (vertices) {
+        mc_run_slabs(nsteps, depth, nslabs, options, [&](int s, int k0, int k1) {
+            MCFillOutput fill;
+            fill.vertices = vertices + 9 * offsets[s];
+            fill.normals = normals ? normals + 9 * offsets[s] : nullptr;
+            marching_cubes_slab(f, isovalue, min, stepsize, nsteps, blocks, options.placement, k0, k1, fill, slabStats[first + s]);
+        });
+    }
+    mc_report_stats(slabStats, options);
+    return offsets[nslabs];
+}
+
+// Soup of mc_extract_soup built in two passes for MCOptions::exactOutput, into one buffer of
+// its exact size.
+template <typename Field>
+std::vector<float> mc_extract_soup_exact(
+        const Field& f,
+        float isovalue,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        const MCOptions& options,
+        std::vector<MCStats> slabStats,
+        std::vector<float>* normals)
+{
+    std::vector<float> vertices;
+    mc_extract_soup_into(f, isovalue, min, stepsize, nsteps, blocks, options, slabStats,
+                         [&](size_t triangles, float*& v, float*& n) {
+        vertices.resize(9 * triangles);
+        v = vertices.data();
+        if (normals) {
+            normals->assign(vertices.size(), 0.0f);
+            n = normals->data();
+        }
+    });
+    return vertices;
+}
+
+// Extracts the soup of the given blocks on the worker pool and merges the slabs in order,
+// along with the vertex normals when normals is not null.
+// slabStats holds the counters gathered so far and is reported along with the slabs'.
+template <typename Field>
+std::vector<float> mc_extract_soup(
+        const Field& f,
+        float isovalue,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        const MCOptions& options,
+        std::vector<MCStats> slabStats,
+        std::vector<float>* normals = nullptr)
+{
+    if (options.exactOutput) {
+        return mc_extract_soup_exact(f, isovalue, min, stepsize, nsteps, blocks, options, slabStats, normals);
+    }
+
+    int depth = mc_slab_depth(nsteps, options);
+    int nslabs = (nsteps + depth - 1) / depth;
+    std::vector<MCSoupOutput> slabs(nslabs);
+    size_t first = slabStats.size();
+    slabStats.resize(first + nslabs);
+    mc_run_slabs(nsteps, depth, nslabs, options, [&](int s, int k0, int k1) {
+        slabs[s].withNormals = normals != nullptr;
+        marching_cubes_slab(f, isovalue, min, stepsize, nsteps, blocks, options.placement, k0, k1, slabs[s], slabStats[first + s]);
+    });
+    mc_report_stats(slabStats, options);
+
+    if (nslabs == 1) {
+        if (normals) {
+            *normals = std::move(slabs[0].normals);
+        }
+        return std::move(slabs[0].vertices);
+    }
+
+    // Merge the slab buffers in z order
+    size_t total = 0;
+    for (int s = 0; s < nslabs; ++s) {
+        total += slabs[s].vertices.size();
+    }
+    std::vector<float> vertices;
+    vertices.reserve(total);
+    if (normals) {
+        normals->clear();
+        normals->reserve(total);
+    }
+    for (int s = 0; s < nslabs; ++s) {
+        vertices.insert(vertices.end(), slabs[s].vertices.begin(), slabs[s].vertices.end());
+        std::vector<float>().swap(slabs[s].vertices);
+        if (normals) {
+            normals->insert(normals->end(), slabs[s].normals.begin(), slabs[s].normals.end());
+            std::vector<float>().swap(slabs[s].normals);
+        }
+    }
+    return vertices;
+}
+
+// Runs marching cubes over [min, max]^3. The field is a callable type such as Field5 or a
+// lambda, so it is inlined into the sampling loop. With options.threads != 1 the grid is
+// split into z-slabs that are extracted by a pool of workers into their own buffers and
+// then merged in slab order, so the output is identical for every thread count.
+// f is called concurrently from the workers and must be safe to share between threads.
+// Each slab samples its lattice once, so the only repeated evaluations are the slices
+// shared by neighbouring slabs.
+template <typename Field>
+std::vector<float> marching_cubes(
+        Field f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        const MCOptions& options = MCOptions())
+{
+    // Compute the number of steps in each direction
+    int nsteps = static_cast<int>((max - min) / stepsize);
+    if (nsteps <= 0) {
+        mc_report_stats(std::vector<MCStats>(), options);
+        return std::vector<float>();
+    }
+
+    // The first entry counts the culling pass, the others one slab each
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = mc_make_blocks(f, isovalue, min, stepsize, nsteps, options, slabStats[0]);
+    return mc_extract_soup(f, isovalue, min, stepsize, nsteps, blocks, options, slabStats);
+}
+
+// Runs marching cubes over [min, max]^3 like the overload above and also returns a unit
+// normal per vertex in normals, taken from the field gradient at the vertex.
+template <typename Field>
+std::vector<float> marching_cubes(
+        Field f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        std::vector<float>& normals,
+        const MCOptions& options = MCOptions())
+{
+    int nsteps = static_cast<int>((max - min) / stepsize);
+    normals.clear();
+    if (nsteps <= 0) {
+        mc_report_stats(std::vector<MCStats>(), options);
+        return std::vector<float>();
+    }
+
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = mc_make_blocks(f, isovalue, min, stepsize, nsteps, options, slabStats[0]);
+    return mc_extract_soup(f, isovalue, min, stepsize, nsteps, blocks, options, slabStats, &normals);
+}
+
+// Runs marching cubes over [min, max]^3 like marching_cubes, but writes the soup into
+// memory the caller provides once the triangles are counted, such as a mapped GPU buffer.
+// allocate(size_t triangles, float*& vertices, float*& normals) is called once on the
+// calling thread between the passes, as in mc_extract_soup_into, and the return value is
+// the triangle count.
+template <typename Field, typename Allocate>
+size_t marching_cubes_into(
+        Field f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        Allocate allocate,
+        const MCOptions& options = MCOptions())
+{
+    int nsteps = static_cast<int>((max - min) / stepsize);
+    if (nsteps <= 0) {
+        float* vertices = nullptr;
+        float* normals = nullptr;
+        allocate(0, vertices, normals);
+        mc_report_stats(std::vector<MCStats>(), options);
+        return 0;
+    }
+
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = mc_make_blocks(f, isovalue, min, stepsize, nsteps, options, slabStats[0]);
+    return mc_extract_soup_into(f, isovalue, min, stepsize, nsteps, blocks, options, slabStats, allocate);
+}
+
+// Extracts the welded mesh of the given blocks on the worker pool and welds the slabs in order.
+template <typename Field>
+MCMesh mc_extract_indexed(
+        const Field& f,
+        float isovalue,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        const MCOptions& options,
+        std::vector<MCStats> slabStats)
+{
+    int depth = mc_slab_depth(nsteps, options);
+    int nslabs = (nsteps + depth - 1) / depth;
+    std::vector<MCIndexedOutput> slabs(nslabs);
+    size_t first = slabStats.size();
+    slabStats.resize(first + nslabs);
+    mc_run_slabs(nsteps, depth, nslabs, options, [&](int s, int k0, int k1) {
+        slabs[s] = MCIndexedOutput(nsteps, options.normals);
+        marching_cubes_slab(f, isovalue, min, stepsize, nsteps, blocks, options.placement, k0, k1, slabs[s], slabStats[first + s]);
+    });
+    mc_report_stats(slabStats, options);
+
+    if (nslabs == 1) {
+        return std::move(slabs[0].mesh);
+    }
+
+    MCMesh mesh;
+    size_t vertexCount = 0, indexCount = 0;
+    for (int s = 0; s < nslabs; ++s) {
+        vertexCount += slabs[s].mesh.vertices.size();
+        indexCount += slabs[s].mesh.indices.size();
+    }
+    mesh.vertices.reserve(vertexCount);
+    mesh.indices.reserve(indexCount);
+    if (options.normals) {
+        mesh.normals.reserve(vertexCount);
+    }
+
+    // Global index of every local vertex of the previous slab
+    std::vector<uint32_t> previous;
+    for (int s = 0; s < nslabs; ++s) {
+        MCIndexedOutput& slab = slabs[s];
+        std::vector<uint32_t> global(slab.mesh.vertices.size() / 3, MCIndexedOutput::NONE);
+
+        // Crossings on the slice shared with the slab below were already emitted there.
+        // After its last layer is rolled, the top slice of a slab is left in xLower/yLower.
+        if (s > 0) {
+            const MCIndexedOutput& below = slabs[s - 1];
+            for (size_t p = 0; p < slab.xBottom.size(); ++p) {
+                if (slab.xBottom[p] != MCIndexedOutput::NONE && below.xLower[p] != MCIndexedOutput::NONE) {
+                    global[slab.xBottom[p]] = previous[below.xLower[p]];
+                }
+                if (slab.yBottom[p] != MCIndexedOutput::NONE && below.yLower[p] != MCIndexedOutput::NONE) {
+                    global[slab.yBottom[p]] = previous[below.yLower[p]];
+                }
+            }
+        }
+
+        for (size_t v = 0; v < global.size(); ++v) {
+            if (global[v] == MCIndexedOutput::NONE) {
+                global[v] = static_cast<uint32_t>(mesh.vertices.size() / 3);
+                mesh.vertices.insert(mesh.vertices.end(),
+                                     slab.mesh.vertices.begin() + 3 * v,
+                                     slab.mesh.vertices.begin() + 3 * v + 3);
+                if (options.normals) {
+                    mesh.normals.insert(mesh.normals.end(),
+                                        slab.mesh.normals.begin() + 3 * v,
+                                        slab.mesh.normals.begin() + 3 * v + 3);
+                }
+            }
+        }
+        for (uint32_t index : slab.mesh.indices) {
+            mesh.indices.push_back(global[index]);
+        }
+
+        // The slab below is no longer needed once this one is welded to it
+        if (s > 0) {
+            slabs[s - 1] = MCIndexedOutput();
+        }
+        previous.swap(global);
+    }
+    return mesh;
+}
+
+// Runs marching cubes over [min, max]^3 and returns a welded, indexed mesh. Vertices are
+// keyed by the grid edge they lie on, so neighbouring cubes share them instead of each
+// emitting its own copy. Slabs are welded along the slices they share in z order, which
+// keeps the vertex and index order identical for every thread count.
+template <typename Field>
+MCMesh marching_cubes_indexed(
+        Field f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        const MCOptions& options = MCOptions())
+{
+    int nsteps = static_cast<int>((max - min) / stepsize);
+    if (nsteps <= 0) {
+        mc_report_stats(std::vector<MCStats>(), options);
+        return MCMesh();
+    }
+
+    // The first entry counts the culling pass, the others one slab each
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = mc_make_blocks(f, isovalue, min, stepsize, nsteps, options, slabStats[0]);
+    return mc_extract_indexed(f, isovalue, min, stepsize, nsteps, blocks, options, slabStats);
+}
+
+// Field chosen at run time. Every sample goes through the std::function, so prefer passing
+// the callable itself where the field is known at compile time.
+inline std::vector<float> marching_cubes(
+        std::function<float(float, float, float)> f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        const MCOptions& options = MCOptions())
+{
+    return marching_cubes<std::function<float(float, float, float)>>(f, isovalue, min, max, stepsize, options);
+}
+
+inline MCMesh marching_cubes_indexed(
+        std::function<float(float, float, float)> f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        const MCOptions& options = MCOptions())
+{
+    return marching_cubes_indexed<std::function<float(float, float, float)>>(f, isovalue, min, max, stepsize, options);
+}
+
+#endif
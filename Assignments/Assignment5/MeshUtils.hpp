@@ -0,0 +1,212 @@
+#ifndef MESHUTILS_HPP
+#define MESHUTILS_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "MarchingCubes.hpp"
+
+// Flat normals for a triangle soup, one copy of the face normal per vertex.
+inline std::vector<float> compute_normals(const std::vector<float>& vertices) {
+    std::vector<float> normals(vertices.size(), 0.0f);
+    for (int i = 0; i < vertices.size(); i += 9) {
+        glm::vec3 v0(vertices[i], vertices[i + 1], vertices[i + 2]);
+        glm::vec3 v1(vertices[i + 3], vertices[i + 4], vertices[i + 5]);
+        glm::vec3 v2(vertices[i + 6], vertices[i + 7], vertices[i + 8]);
+        glm::vec3 e1 = v1 - v0;
+        glm::vec3 e2 = v2 - v0;
+        glm::vec3 normal = glm::normalize(glm::cross(e1, e2));
+        normals[i] = normal.x;
+        normals[i + 1] = normal.y;
+        normals[i + 2] = normal.z;
+        normals[i + 3] = normal.x;
+        normals[i + 4] = normal.y;
+        normals[i + 5] = normal.z;
+        normals[i + 6] = normal.x;
+        normals[i + 7] = normal.y;
+        normals[i + 8] = normal.z;
+    }
+    return normals;
+}
+
+// Smooth normals for a welded mesh. Each vertex gets the area weighted average of the
+// normals of the triangles around it.
+inline std::vector<float> compute_normals(const MCMesh& mesh) {
+    std::vector<float> normals(mesh.vertices.size(), 0.0f);
+    const std::vector<float>& v = mesh.vertices;
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        uint32_t a = 3 * mesh.indices[t];
+        uint32_t b = 3 * mesh.indices[t + 1];
+        uint32_t c = 3 * mesh.indices[t + 2];
+        glm::vec3 v0(v[a], v[a + 1], v[a + 2]);
+        glm::vec3 e1 = glm::vec3(v[b], v[b + 1], v[b + 2]) - v0;
+        glm::vec3 e2 = glm::vec3(v[c], v[c + 1], v[c + 2]) - v0;
+        // the cross product length is twice the triangle area, which weights the sum
+        glm::vec3 normal = glm::cross(e1, e2);
+        for (uint32_t corner : { a, b, c }) {
+            normals[corner] += normal.x;
+            normals[corner + 1] += normal.y;
+            normals[corner + 2] += normal.z;
+        }
+    }
+    for (size_t i = 0; i < normals.size(); i += 3) {
+        glm::vec3 normal(normals[i], normals[i + 1], normals[i + 2]);
+        float length = glm::length(normal);
+        if (length > 0.0f) {
+            normal /= length;
+        }
+        normals[i] = normal.x;
+        normals[i + 1] = normal.y;
+        normals[i + 2] = normal.z;
+    }
+    return normals;
+}
+
+// With countWidth > 0 the counts are zero padded to that many digits, so the header
+// always has the same length and can be rewritten in place once the counts are known.
+inline void writePLYHeader(std::ofstream& file, size_t vertexCount, size_t faceCount, int countWidth = 0) {
+    file << std::setfill('0');
+    file << "ply\n";
+    file << "format ascii 1.0\n";
+    file << "element vertex " << std::setw(countWidth) << vertexCount << "\n";
+    file << "property float x\n";
+    file << "property float y\n";
+    file << "property float z\n";
+    file << "property float nx\n";
+    file << "property float ny\n";
+    file << "property float nz\n";
+    file << "element face " << std::setw(countWidth) << faceCount << "\n";
+    file << "property list uchar int vertex_indices\n";
+    file << "end_header\n";
+    file << std::setfill(' ');
+}
+
+// Writes a triangle soup. Returns false when the file cannot be written.
+inline bool writePLY(const std::vector<float>& vertices, const std::vector<float>& normals, const std::string& fileName) {
+    std::ofstream file(fileName);
+    if (!file) {
+        return false;
+    }
+    writePLYHeader(file, vertices.size() / 3, vertices.size() / 9);
+    for (size_t i = 0; i < vertices.size(); i += 3) {
+        file << vertices[i] << " " << vertices[i + 1] << " " << vertices[i + 2] << " ";
+        file << normals[i] << " " << normals[i + 1] << " " << normals[i + 2] << "\n";
+    }
+    for (size_t i = 0; i < vertices.size(); i += 9) {
+        file << "3 " << i / 3 << " " << i / 3 + 1 << " " << i / 3 + 2 << "\n";
+    }
+    file.close();
+    return !file.fail();
+}
+
+// Writes a welded mesh, sharing each vertex between all faces that use it. Returns false
+// when the file cannot be written.
+inline bool writePLY(const MCMesh& mesh, const std::vector<float>& normals, const std::string& fileName) {
+    std::ofstream file(fileName);
+    if (!file) {
+        return false;
+    }
+    writePLYHeader(file, mesh.vertices.size() / 3, mesh.indices.size() / 3);
+    const std::vector<float>& vertices = mesh.vertices;
+    for (size_t i = 0; i < vertices.size(); i += 3) {
+        file << vertices[i] << " " << vertices[i + 1] << " " << vertices[i + 2] << " ";
+        file << normals[i] << " " << normals[i + 1] << " " << normals[i + 2] << "\n";
+    }
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+        file << "3 " << mesh.indices[i] << " " << mesh.indices[i + 1] << " " << mesh.indices[i + 2] << "\n";
+    }
+    file.close();
+    return !file.fail();
+}
+
+// Extracts the isosurface of f over [min, max]^3 straight into a PLY file, for grids whose
+// triangle soup does not fit in memory. The grid is extracted in z-slabs of
+// options.slabDepth cells (16 by default), one batch of slabs per pass of the worker pool,
+// and each slab is written with its gradient normals as soon as its batch is done, so memory
+// is bounded by the slabs in flight rather than by the whole surface. The counts in the
+// header are patched at the end. Returns false when the file cannot be written, stopping
+// at the first batch that fails, and gives the number of triangles written in triangles.
+template <typename Field>
+bool writePLYStreaming(
+        Field f,
+        float isovalue,
+        float min,
+        float max,
+        float stepsize,
+        const std::string& fileName,
+        const MCOptions& options = MCOptions(),
+        size_t* triangles = nullptr)
+{
+    const int countWidth = 12;
+    if (triangles) {
+        *triangles = 0;
+    }
+    std::ofstream file(fileName);
+    if (!file) {
+        return false;
+    }
+    writePLYHeader(file, 0, 0, countWidth);
+
+    size_t vertexCount = 0;
+    int nsteps = static_cast<int>((max - min) / stepsize);
+    std::vector<MCStats> slabStats(1);
+    if (nsteps > 0)
+    {
+        MCBlocks blocks = mc_make_blocks(f, isovalue, min, stepsize, nsteps, options, slabStats[0]);
+        int depth = options.slabDepth > 0 ? options.slabDepth : 16;
+        int nslabs = (nsteps + depth - 1) / depth;
+        int batch = std::max(1, std::min(mc_thread_count(options), nslabs));
+        std::vector<MCSoupOutput> slabs(batch);
+        for (MCSoupOutput& slab : slabs) {
+            slab.withNormals = true;
+        }
+        slabStats.resize(nslabs + 1);
+
+        for (int first = 0; first < nslabs && file; first += batch)
+        {
+            int count = std::min(batch, nslabs - first);
+            int base = first * depth;
+            mc_run_slabs(count * depth, depth, count, options, [&](int s, int k0, int k1) {
+                marching_cubes_slab(f, isovalue, min, stepsize, nsteps, blocks, options.placement,
+                                    base + k0, std::min(nsteps, base + k1), slabs[s], slabStats[first + s + 1]);
+            });
+
+            // Append in slab order so the file matches marching_cubes()
+            for (int s = 0; s < count; ++s)
+            {
+                std::vector<float>& vertices = slabs[s].vertices;
+                std::vector<float>& normals = slabs[s].normals;
+                for (size_t i = 0; i < vertices.size(); i += 3) {
+                    file << vertices[i] << " " << vertices[i + 1] << " " << vertices[i + 2] << " ";
+                    file << normals[i] << " " << normals[i + 1] << " " << normals[i + 2] << "\n";
+                }
+                vertexCount += vertices.size() / 3;
+                vertices.clear();
+                normals.clear();
+            }
+        }
+    }
+    mc_report_stats(slabStats, options);
+
+    // The faces of a soup are consecutive vertex triples, so they need nothing kept
+    for (size_t i = 0; i < vertexCount; i += 3) {
+        file << "3 " << i << " " << i + 1 << " " << i + 2 << "\n";
+    }
+    file.seekp(0);
+    writePLYHeader(file, vertexCount, vertexCount / 3, countWidth);
+    file.close();
+    if (file.fail()) {
+        return false;
+    }
+    if (triangles) {
+        *triangles = vertexCount / 3;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef NESTEDSURFACES_HPP
+#define NESTEDSURFACES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "MarchingCubes.hpp"
+
+// Several isosurfaces of one field in a single pass, such as nested contour shells. Each
+// lattice point is sampled once and given the number of isovalues at or below its value,
+// its level bucket. A cell crosses level i exactly when some corner has bucket <= i and
+// another > i, so cells whose corners share a bucket are dropped after comparing bytes,
+// and the others are triangulated once for each level between their smallest and largest
+// bucket. The cube index for level i has the bits of the corners with bucket <= i, the
+// same corners that are below the isovalue, so every level comes out exactly as
+// marching_cubes with the same options gives it, in the same order.
+
+// Bucket of v: how many of the count isovalues, in increasing order, are <= v
+inline uint8_t mc_level_bucket(const float* isovalues, int count, float v) {
+    return static_cast<uint8_t>(std::upper_bound(isovalues, isovalues + count, v) - isovalues);
+}
+
+// Extracts the cubes with k0 <= k < k1 for every level into outs[level], levels being the
+// sorted isovalues, rolling slices of values and of their buckets upwards.
+template <typename Field, typename Output>
+void mc_walk_levels(
+        const Field& f,
+        const std::vector<float>& levels,
+        float min,
+        float stepsize,
+        int nsteps,
+        const MCBlocks& blocks,
+        MCOptions::VertexPlacement placement,
+        int k0,
+        int k1,
+        std::vector<Output>& outs,
+        MCStats& stats)
+{
+    int n = nsteps + 1;
+    constexpr bool lattice = mc_has_lattice<Field>::value;
+    size_t points = static_cast<size_t>(n) * n;
+    std::vector<float> lower(lattice ? 0 : points), upper(lattice ? 0 : points);
+    std::vector<uint8_t> lowerBuckets(points), upperBuckets(points);
+    MCRow row(min, stepsize, lattice ? 0 : n);
+    const float* isovalues = levels.data();
+    int count = static_cast<int>(levels.size());
+
+    // Buckets of the points of slice k that were sampled. Up to 32 levels are counted level by
+    // level over chunks of 32 points, which vectorises, rather than searched point by point;
+    // !(v < l) puts NaN above every level as upper_bound does.
+    auto classify = [&](int k, const float* values, std::vector<uint8_t>& buckets) {
+        mc_slice_runs(nsteps, blocks, k, [&](int j, int i0, int run) {
+            size_t at = static_cast<size_t>(j) * n + i0;
+            const float* v = values + at;
+            uint8_t* b = buckets.data() + at;
+            int i = 0;
+            for (; count <= 32 && i + 32 <= run; i += 32) {
+                int chunk[32] = {};
+                for (int l = 0; l < count; ++l) {
+                    float level = isovalues[l];
+                    for (int t = 0; t < 32; ++t) {
+                        chunk[t] += !(v[i + t] < level);
+                    }
+                }
+                for (int t = 0; t < 32; ++t) {
+                    b[i + t] = static_cast<uint8_t>(chunk[t]);
+                }
+            }
+            for (; i < run; ++i) {
+                b[i] = mc_level_bucket(isovalues, count, v[i]);
+            }
+        });
+    };
+
+    const float* lowerValues = mc_load_slice(f, min, stepsize, nsteps, blocks, k0, row, lower, stats);
+    classify(k0, lowerValues, lowerBuckets);
+
+    for (int k = k0; k < k1; ++k)
+    {
+        const float* upperValues = mc_load_slice(f, min, stepsize, nsteps, blocks, k + 1, row, upper, stats);
+        classify(k + 1, upperValues, upperBuckets);
+        for (Output& out : outs) {
+            out.begin_layer(k);
+        }
+        int bz = k / blocks.size;
+
+        for (int j = 0; j < nsteps; ++j)
+        {
+            const float* lo0 = lowerValues + j * n;
+            const float* lo1 = lo0 + n;
+            const float* up0 = upperValues + j * n;
+            const float* up1 = up0 + n;
+            const uint8_t* bl0 = lowerBuckets.data() + j * n;
+            const uint8_t* bl1 = bl0 + n;
+            const uint8_t* bu0 = upperBuckets.data() + j * n;
+            const uint8_t* bu1 = bu0 + n;
+            int by = j / blocks.size;
+
+            for (int bx = 0; bx * blocks.size < nsteps; ++bx)
+            {
+                if (!blocks.is_active(bx, by, bz)) {
+                    continue;
+                }
+                // Smallest and largest bucket of the four corners on column x, carried over
+                // as the left face of the next cube
+                auto column = [&](int x, int& least, int& most) {
+                    least = std::min(std::min(bl0[x], bu0[x]), std::min(bl1[x], bu1[x]));
+                    most = std::max(std::max(bl0[x], bu0[x]), std::max(bl1[x], bu1[x]));
+                };
+
+                int iBegin = bx * blocks.size;
+                int iEnd = std::min(iBegin + blocks.size, nsteps);
+                int leftLeast, leftMost;
+                column(iBegin, leftLeast, leftMost);
+                for (int i = iBegin; i < iEnd; ++i)
+                {
+                    int rightLeast, rightMost;
+                    column(i + 1, rightLeast, rightMost);
+                    int least = std::min(leftLeast, rightLeast);
+                    int most = std::max(leftMost, rightMost);
+                    leftLeast = rightLeast;
+                    leftMost = rightMost;
+                    if (least == most) {
+                        continue;
+                    }
+
+                    std::array<float, 8> vals = { lo0[i], lo0[i + 1], up0[i + 1], up0[i],
+                                                  lo1[i], lo1[i + 1], up1[i + 1], up1[i] };
+                    uint8_t buckets[8] = { bl0[i], bl0[i + 1], bu0[i + 1], bu0[i],
+                                           bl1[i], bl1[i + 1], bu1[i + 1], bu1[i] };
+                    for (int level = least; level < most; ++level)
+                    {
+                        int cubeindex = 0;
+                        for (int c = 0; c < 8; ++c) {
+                            cubeindex |= (buckets[c] <= level) << c;
+                        }
+                        float isovalue = isovalues[level];
+                        Output& out = outs[level];
+                        for (int l = 0; marching_cubes_lut[cubeindex][l] != -1; ++l)
+                        {
+                            int edge = marching_cubes_lut[cubeindex][l];
+                            out.vertex(edge, i, j, k, [&](float* p, float* normal) {
+                                mc_place_vertex(f, isovalue, min, stepsize, placement, edge, i, j, k, vals, p, stats);
+                                if (normal) {
+                                    mc_vertex_normal(f, p, stepsize, normal, stats);
+                                }
+                            });
+                        }
+                    }
+                }
+            }
+        }
+
+        for (Output& out : outs) {
+            out.end_layer();
+        }
+        std::swap(lower, upper);
+        std::swap(lowerBuckets, upperBuckets);
+        lowerValues = upperValues;
+    }
+}
+
+// Runs marching cubes over [min, max]^3 for every isovalue in one pass and returns one
+// triangle soup per isovalue, in the order given, each with its vertex normals in normals
+// when that is not null. The lattice is sampled once whatever the number of isovalues, and
+// with options.cull only blocks that may hold one of them are visited. Slabs run on the
+// worker pool as in marching_cubes; exactOutput is not used.
+template <typename Field>
+std::vector<std::vector<float>> marching_cubes_levels(
+        Field f,
+        const std::vector<float>& isovalues,
+        float min,
+        float max,
+        float stepsize,
+        const MCOptions& options = MCOptions(),
+        std::vector<std::vector<float>>* normals = nullptr)
+{
+    int nsteps = static_cast<int>((max - min) / stepsize);
+    size_t count = isovalues.size();
+    std::vector<std::vector<float>> soups(count);
+    if (normals) {
+        normals->assign(count, std::vector<float>());
+    }
+    if (nsteps <= 0 || count == 0) {
+        mc_report_stats(std::vector<MCStats>(), options);
+        return soups;
+    }
+
+    // Buckets are bytes, so more than 255 levels take a pass per 255
+    if (count > 255) {
+        std::vector<MCStats> groupStats;
+        MCOptions group = options;
+        for (size_t first = 0; first < count; first += 255) {
+            std::vector<float> some(isovalues.begin() + first, isovalues.begin() + std::min(count, first + 255));
+            std::vector<std::vector<float>> someNormals;
+            groupStats.emplace_back();
+            group.stats = &groupStats.back();
+            std::vector<std::vector<float>> someSoups =
+                marching_cubes_levels(f, some, min, max, stepsize, group, normals ? &someNormals : nullptr);
+            for (size_t l = 0; l < some.size(); ++l) {
+                soups[first + l].swap(someSoups[l]);
+                if (normals) {
+                    (*normals)[first + l].swap(someNormals[l]);
+                }
+            }
+        }
+        mc_report_stats(groupStats, options);
+        return soups;
+    }
+
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return isovalues[a] < isovalues[b]; });
+    std::vector<float> levels(count);
+    for (size_t l = 0; l < count; ++l) {
+        levels[l] = isovalues[order[l]];
+    }
+
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = mc_make_blocks(f, levels.data(), static_cast<int>(count), min, stepsize, nsteps, options, slabStats[0]);
+
+    int depth = mc_slab_depth(nsteps, options);
+    int nslabs = (nsteps + depth - 1) / depth;
+    std::vector<std::vector<MCSoupOutput>> slabs(nslabs, std::vector<MCSoupOutput>(count));
+    slabStats.resize(1 + nslabs);
+    mc_run_slabs(nsteps, depth, nslabs, options, [&](int s, int k0, int k1) {
+        for (MCSoupOutput& out : slabs[s]) {
+            out.withNormals = normals != nullptr;
+        }
+        mc_walk_levels(f, levels, min, stepsize, nsteps, blocks, options.placement, k0, k1, slabs[s], slabStats[1 + s]);
+    });
+    mc_report_stats(slabStats, options);
+
+    // Merge each level's slabs in z order
+    for (size_t l = 0; l < count; ++l) {
+        std::vector<float>& soup = soups[order[l]];
+        for (int s = 0; s < nslabs; ++s) {
+            soup.insert(soup.end(), slabs[s][l].vertices.begin(), slabs[s][l].vertices.end());
+            std::vector<float>().swap(slabs[s][l].vertices);
+            if (normals) {
+                std::vector<float>& n = (*normals)[order[l]];
+                n.insert(n.end(), slabs[s][l].normals.begin(), slabs[s][l].normals.end());
+                std::vector<float>().swap(slabs[s][l].normals);
+            }
+        }
+    }
+    return soups;
+}
+
+#endif
@@ -0,0 +1,535 @@
+#ifndef SDF_HPP
+#define SDF_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <vector>
+
+#include "FieldSIMD.hpp"
+#include "Interval.hpp"
+
+// Scene of signed distance primitives (sphere, box, torus, capsule) combined by union,
+// intersection, difference and smooth union, and moved by rotations, translations and
+// uniform scales. Nodes are added bottom up and referred to by the index each call
+// returns; compile a scene with MCSdf to extract it.
+struct MCSdfScene {
+    enum Kind { SPHERE, BOX, TORUS, CAPSULE, UNION, INTERSECTION, DIFFERENCE, SMOOTH_UNION, TRANSFORM };
+
+    // Children a and b, and the sizes of a shape, the radius of a smooth union, or the
+    // rotation (row major), translation and scale of a transform
+    struct Node {
+        Kind kind;
+        int a, b;
+        float p[13];
+    };
+
+    std::vector<Node> nodes;
+
+    // Centred on the origin; the torus lies in the xz plane and the box takes half sizes
+    int sphere(float radius) { return add(SPHERE, -1, -1, { radius }); }
+    int box(float hx, float hy, float hz) { return add(BOX, -1, -1, { hx, hy, hz }); }
+    int torus(float major, float minor) { return add(TORUS, -1, -1, { major, minor }); }
+    int capsule(float ax, float ay, float az, float bx, float by, float bz, float radius) {
+        return add(CAPSULE, -1, -1, { ax, ay, az, bx, by, bz, radius });
+    }
+
+    int unite(int a, int b) { return add(UNION, a, b, {}); }
+    int intersect(int a, int b) { return add(INTERSECTION, a, b, {}); }
+    // a with b cut out of it
+    int subtract(int a, int b) { return add(DIFFERENCE, a, b, {}); }
+    // Union blended over a radius k (polynomial smooth minimum)
+    int smooth_unite(int a, int b, float k) { return add(SMOOTH_UNION, a, b, { k }); }
+
+    // Union of all the nodes given, which must not be empty
+    int unite(const std::vector<int>& children) {
+        int u = children[0];
+        for (size_t c = 1; c < children.size(); ++c) {
+            u = unite(u, children[c]);
+        }
+        return u;
+    }
+
+    int translate(int a, float x, float y, float z) {
+        return add(TRANSFORM, a, -1, { 1, 0, 0, 0, 1, 0, 0, 0, 1, x, y, z, 1 });
+    }
+
+    // By angle radians about the axis (x, y, z)
+    int rotate(int a, float x, float y, float z, float angle) {
+        float length = std::sqrt(x * x + y * y + z * z);
+        x /= length;
+        y /= length;
+        z /= length;
+        float c = std::cos(angle), s = std::sin(angle), t = 1 - c;
+        return add(TRANSFORM, a, -1, { t * x * x + c,     t * x * y - s * z, t * x * z + s * y,
+                                       t * x * y + s * z, t * y * y + c,     t * y * z - s * x,
+                                       t * x * z - s * y, t * y * z + s * x, t * z * z + c,
+                                       0, 0, 0, 1 });
+    }
+
+    int scale(int a, float s) { return add(TRANSFORM, a, -1, { 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, s }); }
+
+private:
+    int add(Kind kind, int a, int b, std::initializer_list<float> p) {
+        Node node = { kind, a, b, {} };
+        std::copy(p.begin(), p.end(), node.p);
+        nodes.push_back(node);
+        return static_cast<int>(nodes.size()) - 1;
+    }
+};
+
+// A scene compiled into a field for marching_cubes. Transforms are folded into the
+// primitives, every node gets a bounding box, and unions of many children are rebuilt as
+// a balanced tree of boxes split along their longest axis. Each chunk of samples is then
+// evaluated by a program holding only the nodes whose boxes come within margin of the
+// chunk, so a sample costs about as many primitives as are near it rather than all of
+// them.
+//
+// Within margin of the surface the pruned field is exactly the full one; farther out it
+// keeps its sign and stays farther than margin. Marching cubes only reads values at the
+// corners of the cells the surface passes through, which are at most a cell diagonal
+// from it, so the surfaces are identical as long as margin covers the diagonal of the
+// largest cell plus the isovalue. An infinite margin evaluates every primitive.
+struct MCSdf {
+    enum Op : uint8_t { SPHERE, BOX, TORUS, CAPSULE, UNION, INTERSECTION, DIFFERENCE, SMOOTH_UNION, CONST };
+
+    // Children a and b, or the primitive of a shape in a, and the box outside which the
+    // node is at least the distance to the box
+    struct Node {
+        Op op;
+        int a, b;
+        float k;
+        float lo[3], hi[3];
+    };
+
+    // The shape's sizes in its own frame, where local = m * world + c, and the uniform
+    // scale its distances are multiplied by
+    struct Primitive {
+        float m[9], c[3];
+        float scale;
+        float p[8];
+    };
+
+    // r[dst] = shape, op(r[dst], r[dst + 1]) or the constant k
+    struct Instruction {
+        Op op;
+        uint16_t dst;
+        int index;
+        float k;
+    };
+
+    // Samples per pruned program in eval_row
+    static constexpr int chunk = 32;
+
+    std::vector<Node> nodes;
+    std::vector<Primitive> primitives;
+    int root = -1;
+    int registers = 1;
+    float margin = std::numeric_limits<float>::infinity();
+
+    MCSdf() {}
+
+    // The margin is a little over the diagonal of a cell of the given step size; add the
+    // isovalue to it when extracting an offset surface
+    MCSdf(const MCSdfScene& scene, int node, float stepsize) {
+        Transform identity = { { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, { 0, 0, 0 }, 1 };
+        root = build(scene, node, identity);
+        registers = height(root);
+        margin = 1.8f * stepsize;
+    }
+
+    float operator()(float x, float y, float z) const {
+        float out;
+        eval_chunk(&x, &y, &z, &out, 1, margin);
+        return out;
+    }
+
+    void eval_row(const float* x, const float* y, const float* z, float* out, int count) const {
+        for (int start = 0; start < count; start += chunk) {
+            eval_chunk(x + start, y + start, z + start, out + start, std::min(chunk, count - start), margin);
+        }
+    }
+
+    // Distances change by at most the distance moved, so the field lies within the half
+    // diagonal r of the box around its value at the centre. Pruning the centre with a
+    // margin of 2r leaves that value exact unless it is beyond 2r, and then the whole box
+    // is beyond r.
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        const float inf = std::numeric_limits<float>::infinity();
+        float cx = 0.5f * (x.lo + x.hi), cy = 0.5f * (y.lo + y.hi), cz = 0.5f * (z.lo + z.hi);
+        float r = 0.5f * std::sqrt((x.hi - x.lo) * (x.hi - x.lo) + (y.hi - y.lo) * (y.hi - y.lo) +
+                                   (z.hi - z.lo) * (z.hi - z.lo));
+        float v;
+        eval_chunk(&cx, &cy, &cz, &v, 1, std::max(2 * r, margin));
+        if (v > 2 * r) {
+            return Interval(r, inf);
+        }
+        if (v < -2 * r) {
+            return Interval(-inf, -r);
+        }
+        return Interval(v - r, v + r);
+    }
+
+    // Primitives the program for the box [lo, hi] evaluates
+    int primitives_near(const float* lo, const float* hi) const {
+        thread_local std::vector<Instruction> code;
+        code.clear();
+        emit(root, lo, hi, margin, 0, code);
+        int count = 0;
+        for (const Instruction& in : code) {
+            count += in.op <= CAPSULE;
+        }
+        return count;
+    }
+
+private:
+    // world = s * r * local + t
+    struct Transform {
+        float r[9], t[3];
+        float s;
+    };
+
+    static Transform compose(const Transform& parent, const float* p) {
+        Transform out;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                out.r[3 * i + j] = parent.r[3 * i] * p[j] + parent.r[3 * i + 1] * p[3 + j] + parent.r[3 * i + 2] * p[6 + j];
+            }
+            out.t[i] = parent.s * (parent.r[3 * i] * p[9] + parent.r[3 * i + 1] * p[10] + parent.r[3 * i + 2] * p[11]) +
+                       parent.t[i];
+        }
+        out.s = parent.s * p[12];
+        return out;
+    }
+
+    int add(Op op, int a, int b, float k) {
+        Node node = { op, a, b, k, {}, {} };
+        nodes.push_back(node);
+        return static_cast<int>(nodes.size()) - 1;
+    }
+
+    int build(const MCSdfScene& scene, int index, const Transform& transform) {
+        const MCSdfScene::Node& node = scene.nodes[index];
+        switch (node.kind) {
+            case MCSdfScene::TRANSFORM:
+                return build(scene, node.a, compose(transform, node.p));
+            case MCSdfScene::UNION: {
+                std::vector<int> children;
+                gather(scene, index, transform, children);
+                return balance(children.data(), static_cast<int>(children.size()));
+            }
+            case MCSdfScene::INTERSECTION:
+            case MCSdfScene::DIFFERENCE: {
+                int a = build(scene, node.a, transform);
+                int b = build(scene, node.b, transform);
+                int n = add(node.kind == MCSdfScene::INTERSECTION ? INTERSECTION : DIFFERENCE, a, b, 0);
+                // either child's box bounds an intersection; a difference is inside a
+                int from = a;
+                if (node.kind == MCSdfScene::INTERSECTION && volume(nodes[b]) < volume(nodes[a])) {
+                    from = b;
+                }
+                std::copy(nodes[from].lo, nodes[from].lo + 3, nodes[n].lo);
+                std::copy(nodes[from].hi, nodes[from].hi + 3, nodes[n].hi);
+                return n;
+            }
+            case MCSdfScene::SMOOTH_UNION: {
+                int a = build(scene, node.a, transform);
+                int b = build(scene, node.b, transform);
+                float k = node.p[0] * transform.s;
+                int n = add(k > 0 ? SMOOTH_UNION : UNION, a, b, k);
+                // the blend dips up to k / 4 below either child, and children are pruned
+                // with 1.25k more margin, so the box grows by that much
+                enclose(n, a, b, k > 0 ? 1.25f * k : 0);
+                return n;
+            }
+            default:
+                return shape(node, transform);
+        }
+    }
+
+    // Children of a tree of unions, looking through transforms
+    void gather(const MCSdfScene& scene, int index, const Transform& transform, std::vector<int>& children) {
+        const MCSdfScene::Node& node = scene.nodes[index];
+        if (node.kind == MCSdfScene::UNION) {
+            gather(scene, node.a, transform, children);
+            gather(scene, node.b, transform, children);
+        } else if (node.kind == MCSdfScene::TRANSFORM) {
+            gather(scene, node.a, compose(transform, node.p), children);
+        } else {
+            children.push_back(build(scene, index, transform));
+        }
+    }
+
+    // Unions the nodes in a tree split at the median of their box centres along the
+    // longest axis. min is exact in any order, so this changes no value.
+    int balance(int* children, int count) {
+        if (count == 1) {
+            return children[0];
+        }
+        const float inf = std::numeric_limits<float>::infinity();
+        float lo[3] = { inf, inf, inf }, hi[3] = { -inf, -inf, -inf };
+        for (int c = 0; c < count; ++c) {
+            for (int a = 0; a < 3; ++a) {
+                float centre = nodes[children[c]].lo[a] + nodes[children[c]].hi[a];
+                lo[a] = std::min(lo[a], centre);
+                hi[a] = std::max(hi[a], centre);
+            }
+        }
+        int axis = 0;
+        for (int a = 1; a < 3; ++a) {
+            if (hi[a] - lo[a] > hi[axis] - lo[axis]) {
+                axis = a;
+            }
+        }
+        int half = count / 2;
+        std::nth_element(children, children + half, children + count, [&](int p, int q) {
+            return nodes[p].lo[axis] + nodes[p].hi[axis] < nodes[q].lo[axis] + nodes[q].hi[axis];
+        });
+        int a = balance(children, half);
+        int b = balance(children + half, count - half);
+        int n = add(UNION, a, b, 0);
+        enclose(n, a, b, 0);
+        return n;
+    }
+
+    void enclose(int n, int a, int b, float grow) {
+        for (int i = 0; i < 3; ++i) {
+            nodes[n].lo[i] = std::min(nodes[a].lo[i], nodes[b].lo[i]) - grow;
+            nodes[n].hi[i] = std::max(nodes[a].hi[i], nodes[b].hi[i]) + grow;
+        }
+    }
+
+    static float volume(const Node& node) {
+        return (node.hi[0] - node.lo[0]) * (node.hi[1] - node.lo[1]) * (node.hi[2] - node.lo[2]);
+    }
+
+    int shape(const MCSdfScene::Node& node, const Transform& transform) {
+        Primitive primitive;
+        const float* r = transform.r;
+        for (int i = 0; i < 3; ++i) {
+            // the inverse of a rotation is its transpose
+            for (int j = 0; j < 3; ++j) {
+                primitive.m[3 * i + j] = r[3 * j + i] / transform.s;
+            }
+            primitive.c[i] = -(primitive.m[3 * i] * transform.t[0] + primitive.m[3 * i + 1] * transform.t[1] +
+                               primitive.m[3 * i + 2] * transform.t[2]);
+        }
+        primitive.scale = transform.s;
+        std::copy(node.p, node.p + 8, primitive.p);
+
+        // box in the shape's own frame
+        const float* p = node.p;
+        float lo[3], hi[3];
+        switch (node.kind) {
+            case MCSdfScene::SPHERE:
+                std::fill(lo, lo + 3, -p[0]);
+                std::fill(hi, hi + 3, p[0]);
+                break;
+            case MCSdfScene::BOX:
+                for (int a = 0; a < 3; ++a) {
+                    lo[a] = -p[a];
+                    hi[a] = p[a];
+                }
+                break;
+            case MCSdfScene::TORUS:
+                lo[0] = lo[2] = -(p[0] + p[1]);
+                hi[0] = hi[2] = p[0] + p[1];
+                lo[1] = -p[1];
+                hi[1] = p[1];
+                break;
+            default:
+                for (int a = 0; a < 3; ++a) {
+                    lo[a] = std::min(p[a], p[3 + a]) - p[6];
+                    hi[a] = std::max(p[a], p[3 + a]) + p[6];
+                }
+                // the segment from a to b and the reciprocal of its squared length
+                primitive.p[3] = p[3] - p[0];
+                primitive.p[4] = p[4] - p[1];
+                primitive.p[5] = p[5] - p[2];
+                {
+                    float length2 = primitive.p[3] * primitive.p[3] + primitive.p[4] * primitive.p[4] +
+                                    primitive.p[5] * primitive.p[5];
+                    primitive.p[6] = length2 > 0 ? 1 / length2 : 0;
+                }
+                primitive.p[7] = p[6];
+                break;
+        }
+        primitives.push_back(primitive);
+
+        int n = add(static_cast<Op>(node.kind), static_cast<int>(primitives.size()) - 1, -1, 0);
+        Node& box = nodes[n];
+        std::fill(box.lo, box.lo + 3, std::numeric_limits<float>::infinity());
+        std::fill(box.hi, box.hi + 3, -std::numeric_limits<float>::infinity());
+        for (int corner = 0; corner < 8; ++corner) {
+            float l[3] = { corner & 1 ? hi[0] : lo[0], corner & 2 ? hi[1] : lo[1], corner & 4 ? hi[2] : lo[2] };
+            for (int a = 0; a < 3; ++a) {
+                float w = transform.s * (r[3 * a] * l[0] + r[3 * a + 1] * l[1] + r[3 * a + 2] * l[2]) + transform.t[a];
+                box.lo[a] = std::min(box.lo[a], w);
+                box.hi[a] = std::max(box.hi[a], w);
+            }
+        }
+        return n;
+    }
+
+    int height(int n) const {
+        const Node& node = nodes[n];
+        if (node.op <= CAPSULE) {
+            return 1;
+        }
+        return std::max(height(node.a), height(node.b) + 1);
+    }
+
+    // Emits the program of node n for the box [lo, hi] into register r, or nothing when
+    // the node is farther than m from all of the box. A union drops such a child, which
+    // is then not the smallest anywhere the result is within m, and an intersection or
+    // the outside of a difference makes the whole node that far.
+    bool emit(int n, const float* lo, const float* hi, float m, int r, std::vector<Instruction>& code) const {
+        const Node& node = nodes[n];
+        float d2 = 0;
+        for (int a = 0; a < 3; ++a) {
+            float d = std::max(std::max(node.lo[a] - hi[a], lo[a] - node.hi[a]), 0.0f);
+            d2 += d * d;
+        }
+        if (d2 > m * m) {
+            return false;
+        }
+        uint16_t dst = static_cast<uint16_t>(r);
+        switch (node.op) {
+            case UNION:
+            case SMOOTH_UNION: {
+                // a smooth union's children bend it within k of each other, and the blend
+                // reaches k / 4 below them, so they are pruned with that much more margin
+                float mk = node.op == SMOOTH_UNION ? m + 1.25f * node.k : m;
+                bool a = emit(node.a, lo, hi, mk, r, code);
+                bool b = emit(node.b, lo, hi, mk, a ? r + 1 : r, code);
+                if (a && b) {
+                    code.push_back({ node.op, dst, n, node.k });
+                }
+                return a || b;
+            }
+            case INTERSECTION: {
+                size_t mark = code.size();
+                if (!emit(node.a, lo, hi, m, r, code) || !emit(node.b, lo, hi, m, r + 1, code)) {
+                    code.resize(mark);
+                    return false;
+                }
+                code.push_back({ INTERSECTION, dst, n, 0 });
+                return true;
+            }
+            case DIFFERENCE:
+                if (!emit(node.a, lo, hi, m, r, code)) {
+                    return false;
+                }
+                if (emit(node.b, lo, hi, m, r + 1, code)) {
+                    code.push_back({ DIFFERENCE, dst, n, 0 });
+                }
+                return true;
+            default:
+                code.push_back({ node.op, dst, node.a, node.k });
+                return true;
+        }
+    }
+
+    // Prunes the scene to the box of n samples and runs the program over them, padded to
+    // a whole number of vectors with the last sample
+    void eval_chunk(const float* x, const float* y, const float* z, float* out, int n, float m) const {
+        thread_local std::vector<Instruction> code;
+        thread_local std::vector<float> file;
+        file.resize(static_cast<size_t>(registers + 3) * chunk);
+        float* px = file.data();
+        float* py = px + chunk;
+        float* pz = py + chunk;
+        float* r = pz + chunk;
+        int padded = (n + SimdFloat::width - 1) / SimdFloat::width * SimdFloat::width;
+        float lo[3] = { x[0], y[0], z[0] }, hi[3] = { x[0], y[0], z[0] };
+        for (int i = 0; i < padded; ++i) {
+            int s = std::min(i, n - 1);
+            px[i] = x[s];
+            py[i] = y[s];
+            pz[i] = z[s];
+            lo[0] = std::min(lo[0], x[s]);
+            hi[0] = std::max(hi[0], x[s]);
+            lo[1] = std::min(lo[1], y[s]);
+            hi[1] = std::max(hi[1], y[s]);
+            lo[2] = std::min(lo[2], z[s]);
+            hi[2] = std::max(hi[2], z[s]);
+        }
+        code.clear();
+        if (!emit(root, lo, hi, m, 0, code)) {
+            // nothing comes within m: any value past it has the right sign
+            code.push_back({ CONST, 0, -1, m });
+        }
+        for (const Instruction& in : code) {
+            run(in, px, py, pz, r + in.dst * chunk, padded);
+        }
+        memcpy(out, r, n * sizeof(float));
+    }
+
+    void run(const Instruction& in, const float* x, const float* y, const float* z, float* d, int n) const {
+        const int w = SimdFloat::width;
+        if (in.op > CAPSULE) {
+            const float* b = d + chunk;
+            SimdFloat k(in.k), quarter(0.25f / in.k);
+            for (int i = 0; i < n; i += w) {
+                SimdFloat p = SimdFloat::load(d + i), q = SimdFloat::load(b + i), v;
+                switch (in.op) {
+                    case UNION: v = simd_min(p, q); break;
+                    case INTERSECTION: v = simd_max(p, q); break;
+                    case DIFFERENCE: v = simd_max(p, SimdFloat(0.0f) - q); break;
+                    case SMOOTH_UNION: {
+                        SimdFloat h = simd_max(k - simd_abs(p - q), SimdFloat(0.0f));
+                        v = simd_min(p, q) - h * h * quarter;
+                        break;
+                    }
+                    default: v = k; break;
+                }
+                v.store(d + i);
+            }
+            return;
+        }
+        const Primitive& s = primitives[in.index];
+        SimdFloat zero(0.0f), scale(s.scale);
+        for (int i = 0; i < n; i += w) {
+            SimdFloat wx = SimdFloat::load(x + i), wy = SimdFloat::load(y + i), wz = SimdFloat::load(z + i);
+            SimdFloat qx = simd_fmadd(SimdFloat(s.m[0]), wx, simd_fmadd(SimdFloat(s.m[1]), wy, simd_fmadd(SimdFloat(s.m[2]), wz, SimdFloat(s.c[0]))));
+            SimdFloat qy = simd_fmadd(SimdFloat(s.m[3]), wx, simd_fmadd(SimdFloat(s.m[4]), wy, simd_fmadd(SimdFloat(s.m[5]), wz, SimdFloat(s.c[1]))));
+            SimdFloat qz = simd_fmadd(SimdFloat(s.m[6]), wx, simd_fmadd(SimdFloat(s.m[7]), wy, simd_fmadd(SimdFloat(s.m[8]), wz, SimdFloat(s.c[2]))));
+            SimdFloat v;
+            switch (in.op) {
+                case SPHERE:
+                    v = simd_sqrt(qx * qx + qy * qy + qz * qz) - SimdFloat(s.p[0]);
+                    break;
+                case BOX: {
+                    SimdFloat dx = simd_abs(qx) - SimdFloat(s.p[0]);
+                    SimdFloat dy = simd_abs(qy) - SimdFloat(s.p[1]);
+                    SimdFloat dz = simd_abs(qz) - SimdFloat(s.p[2]);
+                    SimdFloat ox = simd_max(dx, zero), oy = simd_max(dy, zero), oz = simd_max(dz, zero);
+                    v = simd_sqrt(ox * ox + oy * oy + oz * oz) + simd_min(simd_max(dx, simd_max(dy, dz)), zero);
+                    break;
+                }
+                case TORUS: {
+                    SimdFloat ring = simd_sqrt(qx * qx + qz * qz) - SimdFloat(s.p[0]);
+                    v = simd_sqrt(ring * ring + qy * qy) - SimdFloat(s.p[1]);
+                    break;
+                }
+                default: {
+                    SimdFloat ax = qx - SimdFloat(s.p[0]), ay = qy - SimdFloat(s.p[1]), az = qz - SimdFloat(s.p[2]);
+                    SimdFloat bx(s.p[3]), by(s.p[4]), bz(s.p[5]);
+                    SimdFloat h = (ax * bx + ay * by + az * bz) * SimdFloat(s.p[6]);
+                    h = simd_min(simd_max(h, zero), SimdFloat(1.0f));
+                    ax = ax - bx * h;
+                    ay = ay - by * h;
+                    az = az - bz * h;
+                    v = simd_sqrt(ax * ax + ay * ay + az * az) - SimdFloat(s.p[7]);
+                    break;
+                }
+            }
+            (v * scale).store(d + i);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef SPANSPACE_HPP
+#define SPANSPACE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MarchingCubes.hpp"
+
+// A field sampled once on the lattice of marching_cubes over [min, max]^3, with the range
+// of values of every block of cells indexed in span space: the blocks sorted by their
+// minimum and by their maximum. The blocks an isovalue passes through are those with
+// min < isovalue <= max, found by a binary search in each order, so the surface can be
+// re-extracted at any isovalue without touching the field or the empty blocks again.
+struct MCSpanIndex {
+    float min = 0;
+    float stepsize = 1;
+    int nsteps = 0;
+
+    // Samples of the lattice, indexed by (k * (nsteps + 1) + j) * (nsteps + 1) + i
+    std::vector<float> values;
+
+    // Range of the samples in each block, indexed like MCBlocks::active
+    int blockSize = 0;
+    int blockCount = 0;
+    std::vector<float> blockMin, blockMax;
+
+    // Block numbers sorted by blockMin and by blockMax
+    std::vector<uint32_t> byMin, byMax;
+
+    const float* lattice_slice(int k) const {
+        int n = nsteps + 1;
+        return values.data() + static_cast<size_t>(k) * n * n;
+    }
+
+    // Trilinear interpolation of the samples, for vertex placements that look between them
+    float operator()(float x, float y, float z) const {
+        int n = nsteps + 1;
+        float p[3] = { x, y, z };
+        int c[3];
+        float t[3];
+        for (int a = 0; a < 3; ++a) {
+            float u = std::min(std::max((p[a] - min) / stepsize, 0.0f), static_cast<float>(nsteps));
+            c[a] = std::min(static_cast<int>(u), nsteps - 1);
+            t[a] = u - c[a];
+        }
+        const float* v = values.data() + (static_cast<size_t>(c[2]) * n + c[1]) * n + c[0];
+        size_t dy = n, dz = static_cast<size_t>(n) * n;
+        float x00 = v[0] + (v[1] - v[0]) * t[0];
+        float x10 = v[dy] + (v[dy + 1] - v[dy]) * t[0];
+        float x01 = v[dz] + (v[dz + 1] - v[dz]) * t[0];
+        float x11 = v[dz + dy] + (v[dz + dy + 1] - v[dz + dy]) * t[0];
+        float y0 = x00 + (x10 - x00) * t[1];
+        float y1 = x01 + (x11 - x01) * t[1];
+        return y0 + (y1 - y0) * t[2];
+    }
+
+    // Central differences of the interpolated samples, one step either side
+    void gradient(float x, float y, float z, float* g) const {
+        float h = stepsize;
+        g[0] = ((*this)(x + h, y, z) - (*this)(x - h, y, z)) / (2 * h);
+        g[1] = ((*this)(x, y + h, z) - (*this)(x, y - h, z)) / (2 * h);
+        g[2] = ((*this)(x, y, z + h) - (*this)(x, y, z - h)) / (2 * h);
+    }
+
+    // Marks the blocks holding part of the surface at isovalue, following the sign test of
+    // marching_cubes_slab: a cube has triangles when some corner is below the isovalue and
+    // some corner is not.
+    MCBlocks active_blocks(float isovalue, MCStats& stats) const {
+        MCBlocks blocks;
+        blocks.size = blockSize;
+        blocks.count = blockCount;
+        blocks.active.assign(blockMin.size(), 0);
+
+        // Blocks with min < isovalue are a prefix of byMin, those with max >= isovalue a
+        // suffix of byMax. Walk the shorter list and test the other bound.
+        size_t below = std::lower_bound(byMin.begin(), byMin.end(), isovalue, [&](uint32_t b, float v) {
+            return blockMin[b] < v;
+        }) - byMin.begin();
+        size_t above = byMax.end() - std::lower_bound(byMax.begin(), byMax.end(), isovalue, [&](uint32_t b, float v) {
+            return blockMax[b] < v;
+        });
+
+        if (below <= above) {
+            for (size_t r = 0; r < below; ++r) {
+                blocks.active[byMin[r]] = blockMax[byMin[r]] >= isovalue;
+            }
+        } else {
+            for (size_t r = byMax.size() - above; r < byMax.size(); ++r) {
+                blocks.active[byMax[r]] = blockMin[byMax[r]] < isovalue;
+            }
+        }
+
+        for (int bz = 0; bz < blockCount; ++bz) {
+            for (int by = 0; by < blockCount; ++by) {
+                for (int bx = 0; bx < blockCount; ++bx) {
+                    if (!blocks.is_active(bx, by, bz)) {
+                        long long cells = 1;
+                        for (int b : { bx, by, bz }) {
+                            cells *= std::min((b + 1) * blockSize, nsteps) - b * blockSize;
+                        }
+                        stats.cellsSkipped += cells;
+                    }
+                }
+            }
+        }
+        return blocks;
+    }
+};
+
+// Samples f over the lattice of marching_cubes(f, ..., min, max, stepsize) and builds the
+// span space index of its blocks of options.blockSize^3 cells. Uses options.threads workers.
+template <typename Field>
+MCSpanIndex mc_build_span_index(
+        Field f,
+        float min,
+        float max,
+        float stepsize,
+        const MCOptions& options = MCOptions())
+{
+    MCSpanIndex index;
+    index.min = min;
+    index.stepsize = stepsize;
+    index.nsteps = std::max(0, static_cast<int>((max - min) / stepsize));
+    int nsteps = index.nsteps;
+    if (nsteps <= 0) {
+        return index;
+    }
+
+    int n = nsteps + 1;
+    index.values.resize(static_cast<size_t>(n) * n * n);
+    index.blockSize = std::max(1, std::min(options.blockSize, nsteps));
+    index.blockCount = (nsteps + index.blockSize - 1) / index.blockSize;
+
+    // Sample every slice with a single block covering the grid
+    MCBlocks all;
+    all.size = nsteps;
+    all.count = 1;
+    all.active.assign(1, 1);
+    int threads = std::min(mc_thread_count(options), n);
+    std::vector<MCStats> sliceStats(threads);
+    std::atomic<int> next(0);
+    auto sampleWorker = [&](int t) {
+        MCRow row(min, stepsize, n);
+        for (int k = next++; k < n; k = next++) {
+            float* slice = index.values.data() + static_cast<size_t>(k) * n * n;
+            sliceStats[t].fieldEvaluations += mc_sample_slice(f, min, stepsize, nsteps, all, k, row, slice);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(sampleWorker, t);
+    }
+    sampleWorker(0);
+    for (std::thread& t : pool) {
+        t.join();
+    }
+    mc_report_stats(sliceStats, options);
+
+    // Range of each block over its (blockSize + 1)^3 lattice points, shared faces included
+    int size = index.blockSize, count = index.blockCount;
+    index.blockMin.assign(static_cast<size_t>(count) * count * count, INFINITY);
+    index.blockMax.assign(index.blockMin.size(), -INFINITY);
+    for (int k = 0; k < n; ++k) {
+        for (int j = 0; j < n; ++j) {
+            const float* row = index.lattice_slice(k) + j * n;
+            for (int bz = std::max(0, (k - 1) / size); bz <= std::min(count - 1, k / size); ++bz) {
+                for (int by = std::max(0, (j - 1) / size); by <= std::min(count - 1, j / size); ++by) {
+                    for (int bx = 0; bx < count; ++bx) {
+                        size_t b = (static_cast<size_t>(bz) * count + by) * count + bx;
+                        const float* first = row + bx * size;
+                        const float* last = row + std::min((bx + 1) * size, nsteps) + 1;
+                        auto range = std::minmax_element(first, last);
+                        index.blockMin[b] = std::min(index.blockMin[b], *range.first);
+                        index.blockMax[b] = std::max(index.blockMax[b], *range.second);
+                    }
+                }
+            }
+        }
+    }
+
+    index.byMin.resize(index.blockMin.size());
+    for (size_t b = 0; b < index.byMin.size(); ++b) {
+        index.byMin[b] = static_cast<uint32_t>(b);
+    }
+    index.byMax = index.byMin;
+    std::sort(index.byMin.begin(), index.byMin.end(), [&](uint32_t a, uint32_t b) {
+        return index.blockMin[a] < index.blockMin[b];
+    });
+    std::sort(index.byMax.begin(), index.byMax.end(), [&](uint32_t a, uint32_t b) {
+        return index.blockMax[a] < index.blockMax[b];
+    });
+    return index;
+}
+
+// Extracts the surface at isovalue from a span space index, visiting only the blocks whose
+// range holds it. The result matches marching_cubes on the field the index was built from.
+inline std::vector<float> marching_cubes(const MCSpanIndex& index, float isovalue, const MCOptions& options = MCOptions())
+{
+    if (index.nsteps <= 0) {
+        mc_report_stats(std::vector<MCStats>(), options);
+        return std::vector<float>();
+    }
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = index.active_blocks(isovalue, slabStats[0]);
+    return mc_extract_soup(index, isovalue, index.min, index.stepsize, index.nsteps, blocks, options, slabStats);
+}
+
+// Soup of the index at isovalue written into memory the caller provides, as with the
+// marching_cubes_into overload for fields.
+template <typename Allocate>
+size_t marching_cubes_into(const MCSpanIndex& index, float isovalue, Allocate allocate,
+                           const MCOptions& options = MCOptions())
+{
+    if (index.nsteps <= 0) {
+        float* vertices = nullptr;
+        float* normals = nullptr;
+        allocate(0, vertices, normals);
+        mc_report_stats(std::vector<MCStats>(), options);
+        return 0;
+    }
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = index.active_blocks(isovalue, slabStats[0]);
+    return mc_extract_soup_into(index, isovalue, index.min, index.stepsize, index.nsteps, blocks, options, slabStats,
+                                allocate);
+}
+
+inline MCMesh marching_cubes_indexed(const MCSpanIndex& index, float isovalue, const MCOptions& options = MCOptions())
+{
+    if (index.nsteps <= 0) {
+        mc_report_stats(std::vector<MCStats>(), options);
+        return MCMesh();
+    }
+    std::vector<MCStats> slabStats(1);
+    MCBlocks blocks = index.active_blocks(isovalue, slabStats[0]);
+    return mc_extract_indexed(index, isovalue, index.min, index.stepsize, index.nsteps, blocks, options, slabStats);
+}
+
+#endif
@@ -1,4 +1,7 @@
-int marching_cubes_lut[256][16] =
+#ifndef TRITABLE_HPP
+#define TRITABLE_HPP
+
+inline int marching_cubes_lut[256][16] =
 {{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 {0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 {0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
@@ -258,7 +261,7 @@ int marching_cubes_lut[256][16] =
 };
 
 
-float vertTable[12][3] = {
+inline float vertTable[12][3] = {
 	{0.5f, 0.0f, 0.0f},
 	{1.0f, 0.0f, 0.5f},
 	{0.5f, 0.0f, 1.0f},
@@ -273,3 +276,4 @@ float vertTable[12][3] = {
 	{0.0f, 0.5f, 1.0f},
 };
 
+#endif
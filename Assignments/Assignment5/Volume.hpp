@@ -0,0 +1,309 @@
+#ifndef VOLUME_HPP
+#define VOLUME_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Interval.hpp"
+#include "MarchingCubes.hpp"
+
+// Header of a volume file, followed by the dims[0] * dims[1] * dims[2] samples with x
+// fastest and z slowest. Everything is little endian.
+struct MCVolumeHeader {
+    char magic[4];
+    uint32_t type;
+    uint32_t dims[3];
+
+    // Coordinate of sample (0, 0, 0) on every axis and the spacing of the samples
+    float min;
+    float stepsize;
+
+    // A stored sample s stands for the value s * scale + offset
+    float scale;
+    float offset;
+};
+
+// Converts count samples of type T stored from in on into the values s * scale + offset
+template <typename T>
+void mc_convert_samples(const unsigned char* in, int count, float scale, float offset, float* out)
+{
+    if (std::is_same<T, float>::value && scale == 1 && offset == 0) {
+        memcpy(out, in, count * sizeof(T));
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        T s;
+        memcpy(&s, in + i * sizeof(T), sizeof(T));
+        out[i] = s * scale + offset;
+    }
+}
+
+// Scalar volume memory-mapped from a file, used as a field by the extractors. Opening it
+// only maps the file, so the samples are paged in when marching_cubes first reads them
+// and a volume larger than memory can be extracted as long as the slabs being worked on
+// fit. Sample (i, j, k) lies at min + (i, j, k) * stepsize.
+// Copies share the mapping, which is released with the last of them.
+struct MCVolume {
+    enum Type { UINT8, UINT16, FLOAT32 };
+
+    Type type = FLOAT32;
+    int dims[3] = { 0, 0, 0 };
+    float min = 0;
+    float stepsize = 1;
+    float scale = 1;
+    float offset = 0;
+
+    // Value of the lattice points past the samples, when the volume is not a cube
+    float outside = 0;
+
+    std::shared_ptr<void> mapping;
+    const unsigned char* samples = nullptr;
+
+    static size_t type_size(Type t) {
+        return t == UINT8 ? 1 : t == UINT16 ? 2 : 4;
+    }
+
+    // Index of the stored sample (i, j, k), which must lie in the volume
+    size_t index(int i, int j, int k) const {
+        return (static_cast<size_t>(k) * dims[1] + j) * dims[0] + i;
+    }
+
+    // Maps a volume file that starts with an MCVolumeHeader. Returns false when the file
+    // cannot be read or is not a volume.
+    bool open(const std::string& path) {
+        MCVolumeHeader header;
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        bool read = fread(&header, sizeof(header), 1, file) == 1;
+        fclose(file);
+        if (!read || memcmp(header.magic, "MCVL", 4) != 0 || header.type > FLOAT32) {
+            return false;
+        }
+        if (!open_raw(path, static_cast<Type>(header.type), header.dims[0], header.dims[1], header.dims[2],
+                      sizeof(header))) {
+            return false;
+        }
+        min = header.min;
+        stepsize = header.stepsize;
+        scale = header.scale;
+        offset = header.offset;
+        return true;
+    }
+
+    // Maps a headerless volume of nx * ny * nz samples of the given type starting
+    // headerBytes into the file, with unit spacing from the origin.
+    bool open_raw(const std::string& path, Type t, int nx, int ny, int nz, size_t headerBytes = 0) {
+        if (nx < 2 || ny < 2 || nz < 2) {
+            return false;
+        }
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        size_t length = static_cast<size_t>(nx) * ny * nz * type_size(t) + headerBytes;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < length) {
+            close(fd);
+            return false;
+        }
+        void* base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+
+        mapping = std::shared_ptr<void>(base, [length](void* p) { munmap(p, length); });
+        samples = static_cast<const unsigned char*>(base) + headerBytes;
+        type = t;
+        dims[0] = nx;
+        dims[1] = ny;
+        dims[2] = nz;
+        min = 0;
+        stepsize = 1;
+        scale = 1;
+        offset = 0;
+        return true;
+    }
+
+    // Steps of the cubic grid spanning the longest axis of the volume
+    int nsteps() const {
+        return std::max(dims[0], std::max(dims[1], dims[2])) - 1;
+    }
+
+    // Upper end of that grid, to pass to marching_cubes along with min and stepsize. Half a
+    // step past the last sample, so rounding cannot drop it when the steps are counted.
+    float max() const {
+        return min + (nsteps() + 0.5f) * stepsize;
+    }
+
+    // Converts count stored samples from index first on into values
+    void convert(size_t first, int count, float* out) const {
+        const unsigned char* in = samples + first * type_size(type);
+        switch (type) {
+            case UINT8: mc_convert_samples<uint8_t>(in, count, scale, offset, out); break;
+            case UINT16: mc_convert_samples<uint16_t>(in, count, scale, offset, out); break;
+            case FLOAT32: mc_convert_samples<float>(in, count, scale, offset, out); break;
+        }
+    }
+
+    float sample(int i, int j, int k) const {
+        if (i >= dims[0] || j >= dims[1] || k >= dims[2]) {
+            return outside;
+        }
+        float v;
+        convert(index(i, j, k), 1, &v);
+        return v;
+    }
+
+    // Slice k of a grid of nsteps^3 cells from min, at the points the active blocks touch.
+    // On the volume's own lattice the rows are converted straight from the mapping; other
+    // grids are interpolated point by point.
+    long long sample_slice(float gridMin, float gridStepsize, int gridSteps, const MCBlocks& blocks, int k,
+                           float* slice) const
+    {
+        int n = gridSteps + 1;
+        bool aligned = gridMin == min && gridStepsize == stepsize;
+        long long written = 0;
+        mc_slice_runs(gridSteps, blocks, k, [&](int j, int i0, int count) {
+            float* row = slice + blocks.slot(i0, j, n);
+            written += count;
+            if (!aligned) {
+                for (int i = 0; i < count; ++i) {
+                    row[i] = (*this)(gridMin + (i0 + i) * gridStepsize, gridMin + j * gridStepsize,
+                                     gridMin + k * gridStepsize);
+                }
+                return;
+            }
+            int inside = j < dims[1] && k < dims[2] ? std::max(0, std::min(count, dims[0] - i0)) : 0;
+            if (inside > 0) {
+                convert(index(i0, j, k), inside, row);
+            }
+            std::fill(row + inside, row + count, outside);
+        });
+        return written;
+    }
+
+    // Values of the 8 corners of cell (i, j, k), x fastest and z slowest. Inside the volume
+    // the corners lie at fixed strides from the first.
+    void corners(int i, int j, int k, float* v) const {
+        if (i + 1 >= dims[0] || j + 1 >= dims[1] || k + 1 >= dims[2]) {
+            for (int corner = 0; corner < 8; ++corner) {
+                v[corner] = sample(i + (corner & 1), j + ((corner >> 1) & 1), k + (corner >> 2));
+            }
+            return;
+        }
+        size_t first = index(i, j, k);
+        size_t row = dims[0], layer = static_cast<size_t>(dims[0]) * dims[1];
+        for (int corner = 0; corner < 8; ++corner) {
+            convert(first + (corner & 1) + ((corner >> 1) & 1) * row + (corner >> 2) * layer, 1, v + corner);
+        }
+    }
+
+    // Trilinear interpolation of the samples, for vertex placements that look between them
+    float operator()(float x, float y, float z) const {
+        float p[3] = { x, y, z };
+        int c[3];
+        float t[3];
+        int last = nsteps();
+        for (int a = 0; a < 3; ++a) {
+            float u = std::min(std::max((p[a] - min) / stepsize, 0.0f), static_cast<float>(last));
+            c[a] = std::min(static_cast<int>(u), last - 1);
+            t[a] = u - c[a];
+        }
+        float v[8];
+        corners(c[0], c[1], c[2], v);
+        float x00 = v[0] + (v[1] - v[0]) * t[0];
+        float x10 = v[2] + (v[3] - v[2]) * t[0];
+        float x01 = v[4] + (v[5] - v[4]) * t[0];
+        float x11 = v[6] + (v[7] - v[6]) * t[0];
+        float y0 = x00 + (x10 - x00) * t[1];
+        float y1 = x01 + (x11 - x01) * t[1];
+        return y0 + (y1 - y0) * t[2];
+    }
+
+    // Boxes entirely past the samples hold only the outside value, so culling skips the
+    // padding of volumes that are not cubes. Anywhere else the bound is the whole range of
+    // the stored type, as the samples are not read ahead of time.
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        float lo[3] = { x.lo, y.lo, z.lo };
+        for (int a = 0; a < 3; ++a) {
+            // Boxes of the grid start on lattice points, up to rounding
+            if ((lo[a] - min) / stepsize > dims[a] - 0.001f) {
+                return Interval(outside);
+            }
+        }
+        if (type == FLOAT32) {
+            return Interval(-std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity());
+        }
+        float top = (type == UINT8 ? 255.0f : 65535.0f) * scale + offset;
+        return Interval(std::min(std::min(offset, top), outside), std::max(std::max(offset, top), outside));
+    }
+};
+
+// Samples f on the lattice of nsteps^3 cells from min and writes it to a volume file of
+// the given type. Integer types store [lo, hi] over their whole range, clamping values
+// outside it. Returns false when the file cannot be written.
+template <typename Field>
+bool mc_write_volume(const std::string& path, const Field& f, float min, float stepsize, int nsteps,
+                     MCVolume::Type type, float lo = 0, float hi = 1)
+{
+    int n = nsteps + 1;
+    float top = type == MCVolume::UINT8 ? 255.0f : 65535.0f;
+    MCVolumeHeader header;
+    memcpy(header.magic, "MCVL", 4);
+    header.type = type;
+    header.dims[0] = header.dims[1] = header.dims[2] = n;
+    header.min = min;
+    header.stepsize = stepsize;
+    header.scale = type == MCVolume::FLOAT32 ? 1.0f : (hi - lo) / top;
+    header.offset = type == MCVolume::FLOAT32 ? 0.0f : lo;
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    MCBlocks all;
+    all.size = nsteps;
+    all.count = 1;
+    all.active.assign(1, 1);
+    MCRow row(min, stepsize, n);
+    std::vector<float> slice(static_cast<size_t>(n) * n);
+    std::vector<unsigned char> stored(slice.size() * MCVolume::type_size(type));
+    for (int k = 0; ok && k < n; ++k) {
+        mc_sample_slice(f, min, stepsize, nsteps, all, k, row, slice.data());
+        for (size_t p = 0; p < slice.size(); ++p) {
+            if (type == MCVolume::FLOAT32) {
+                memcpy(&stored[4 * p], &slice[p], 4);
+                continue;
+            }
+            float s = std::round(std::min(std::max((slice[p] - lo) / header.scale, 0.0f), top));
+            if (type == MCVolume::UINT8) {
+                stored[p] = static_cast<uint8_t>(s);
+            } else {
+                uint16_t s16 = static_cast<uint16_t>(s);
+                memcpy(&stored[2 * p], &s16, 2);
+            }
+        }
+        ok = fwrite(stored.data(), 1, stored.size(), file) == stored.size();
+    }
+    return fclose(file) == 0 && ok;
+}
+
+#endif
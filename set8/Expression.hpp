@@ -0,0 +1,538 @@
+#ifndef EXPRESSION_HPP
+#define EXPRESSION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "FieldSIMD.hpp"
+#include "Interval.hpp"
+
+// Scalar field given as text, such as "x*x + y*y - z*z + sin(x*y)", so surfaces can be
+// tried without recompiling. The text is parsed once into a graph with constants folded
+// and repeated subexpressions shared, then compiled to bytecode over a register file.
+// eval_row runs each instruction over a whole batch of samples at vector width, so the
+// dispatch of an instruction is paid once per batch rather than once per sample, and
+// bounds runs the same bytecode on intervals so marching_cubes can cull blocks.
+//
+// The language has + - * / and ^ (power, right associative), unary minus, parentheses,
+// numbers, the variables x y z, the constants pi and e, and the functions sin cos tan
+// sqrt abs exp log min max pow. Integer powers become multiplications.
+struct MCExpression {
+    enum Op : uint8_t {
+        X, Y, Z, CONST, ADD, SUB, MUL, DIV, NEG, SIN, COS, TAN, SQRT, ABS, EXP, LOG, MIN, MAX, POW,
+        // a * b + c, a * b - c and c - a * b, which products used once are fused into
+        MULADD, MULSUB, NMULADD
+    };
+
+    // dst = op(a, b) or op(a, b, c); unary operations ignore b
+    struct Instruction {
+        Op op;
+        uint8_t dst, a, b, c;
+    };
+
+    // Samples per batch of eval_row, and lanes of each register: a batch and room for a
+    // partial vector, so that the tail of a row runs with the batch before it rather than
+    // as a batch of its own
+    static constexpr int batch = 256;
+    static constexpr int lanes = batch + SimdFloat::width;
+
+    std::string text;
+    std::vector<Instruction> code;
+
+    // Registers 0 to 2 hold x, y and z, the next ones these constants, and the rest
+    // intermediate values
+    std::vector<float> constants;
+    int registers = 3;
+    int result = 0;
+
+    // Number of the compilation, which tells the per-thread registers of eval_row whether
+    // they already hold these constants. Copies share it along with the code.
+    uint64_t id = 0;
+
+    static float apply(Op op, float a, float b) {
+        switch (op) {
+            case ADD: return a + b;
+            case SUB: return a - b;
+            case MUL: return a * b;
+            case DIV: return a / b;
+            case NEG: return -a;
+            case SIN: return sinf(a);
+            case COS: return cosf(a);
+            case TAN: return tanf(a);
+            case SQRT: return sqrtf(a);
+            case ABS: return fabsf(a);
+            case EXP: return expf(a);
+            case LOG: return logf(a);
+            case MIN: return std::min(a, b);
+            case MAX: return std::max(a, b);
+            case POW: return powf(a, b);
+            default: return a;
+        }
+    }
+
+    // Parses and compiles source. Returns false and describes the problem in error when
+    // it is not a valid expression, leaving the previous one in place.
+    bool compile(const std::string& source, std::string* error = nullptr);
+
+    // One sample, as a row of one, so that it runs the same vector code and gets the same
+    // value as the rows of eval_row
+    float operator()(float x, float y, float z) const {
+        float value;
+        eval_row(&x, &y, &z, &value, 1);
+        return value;
+    }
+
+    void eval_row(const float* x, const float* y, const float* z, float* out, int count) const {
+        thread_local std::vector<float> file;
+        thread_local std::vector<const float*> src;
+        thread_local uint64_t filled = 0;
+        if (filled != id || file.empty()) {
+            file.resize(static_cast<size_t>(registers) * lanes);
+            src.resize(registers);
+            for (int i = 3; i < registers; ++i) {
+                src[i] = file.data() + i * lanes;
+            }
+            for (size_t c = 0; c < constants.size(); ++c) {
+                std::fill(file.data() + (3 + c) * lanes, file.data() + (4 + c) * lanes, constants[c]);
+            }
+            filled = id;
+        }
+        float* r = file.data();
+        const float* in[3] = { x, y, z };
+        for (int start = 0; start < count;) {
+            int n = count - start <= lanes ? count - start : batch;
+            // x, y and z are read in place and the last instruction writes to out, unless the
+            // row is shorter than a vector, when it is padded with its last sample
+            bool padded = n < SimdFloat::width;
+            for (int a = 0; a < 3; ++a) {
+                src[a] = in[a] + start;
+                if (padded) {
+                    memcpy(r + a * lanes, in[a] + start, n * sizeof(float));
+                    std::fill(r + a * lanes + n, r + a * lanes + SimdFloat::width, in[a][start + n - 1]);
+                    src[a] = r + a * lanes;
+                }
+            }
+            bool direct = !padded && !code.empty();
+            run(src.data(), r, padded ? SimdFloat::width : n, direct ? out + start : nullptr);
+            if (!direct) {
+                memcpy(out + start, src[result], n * sizeof(float));
+            }
+            start += n;
+        }
+    }
+
+    Interval bounds(Interval x, Interval y, Interval z) const {
+        const float inf = std::numeric_limits<float>::infinity();
+        thread_local std::vector<Interval> r;
+        r.resize(registers);
+        r[0] = x;
+        r[1] = y;
+        r[2] = z;
+        std::copy(constants.begin(), constants.end(), r.begin() + 3);
+        for (const Instruction& in : code) {
+            Interval a = r[in.a], b = r[in.b], c = r[in.c], v(-inf, inf);
+            // a register times itself is a square, which is never negative
+            Interval product = in.a == in.b ? sqr(a) : a * b;
+            switch (in.op) {
+                case ADD: v = a + b; break;
+                case SUB: v = a - b; break;
+                case MUL: v = product; break;
+                case MULADD: v = product + c; break;
+                case MULSUB: v = product - c; break;
+                case NMULADD: v = c - product; break;
+                case DIV:
+                    if (b.lo > 0 || b.hi < 0) {
+                        v = a * Interval(1 / b.hi, 1 / b.lo);
+                    }
+                    break;
+                case NEG: v = -a; break;
+                case SIN: v = sin(a); break;
+                case COS: v = cos(a); break;
+                case SQRT: v = Interval(sqrtf(std::max(a.lo, 0.0f)), sqrtf(std::max(a.hi, 0.0f))); break;
+                case ABS:
+                    v = a.lo >= 0 ? a : a.hi <= 0 ? -a : Interval(0, std::max(-a.lo, a.hi));
+                    break;
+                case EXP: v = Interval(expf(a.lo), expf(a.hi)); break;
+                case LOG: v = Interval(a.lo > 0 ? logf(a.lo) : -inf, logf(a.hi)); break;
+                case MIN: v = Interval(std::min(a.lo, b.lo), std::min(a.hi, b.hi)); break;
+                case MAX: v = Interval(std::max(a.lo, b.lo), std::max(a.hi, b.hi)); break;
+                default: break;
+            }
+            // infinities meeting zero leave no usable bound
+            r[in.dst] = v.lo <= v.hi ? v : Interval(-inf, inf);
+        }
+        return r[result];
+    }
+
+private:
+    // d = kernel(a, b) over n samples, n at least the vector width. A partial last vector
+    // is the one ending at n, overlapping the one before; it is loaded before any store, as
+    // d may be a or b, so the samples it repeats come out the same.
+    template <typename Kernel>
+    static void simd_apply(int n, float* d, const float* a, const float* b, Kernel kernel) {
+        int last = n - SimdFloat::width;
+        SimdFloat tail = kernel(SimdFloat::load(a + last), SimdFloat::load(b + last));
+        for (int i = 0; i < last; i += SimdFloat::width) {
+            kernel(SimdFloat::load(a + i), SimdFloat::load(b + i)).store(d + i);
+        }
+        tail.store(d + last);
+    }
+
+    template <typename Kernel>
+    static void simd_apply(int n, float* d, const float* a, const float* b, const float* c, Kernel kernel) {
+        int last = n - SimdFloat::width;
+        SimdFloat tail = kernel(SimdFloat::load(a + last), SimdFloat::load(b + last), SimdFloat::load(c + last));
+        for (int i = 0; i < last; i += SimdFloat::width) {
+            kernel(SimdFloat::load(a + i), SimdFloat::load(b + i), SimdFloat::load(c + i)).store(d + i);
+        }
+        tail.store(d + last);
+    }
+
+    // Runs the bytecode over the first n samples of the registers src points to, n at
+    // least the vector width. Results go to the intermediate registers in r, as x, y
+    // and z may be the caller's arrays, except that the last instruction writes to out
+    // when that is not null. Operations without a vector version go through libm lane by
+    // lane.
+    void run(const float* const* src, float* r, int n, float* out) const {
+        for (const Instruction& in : code) {
+            float* d = out && &in == &code.back() ? out : r + in.dst * lanes;
+            const float* a = src[in.a];
+            const float* b = src[in.b];
+            const float* c = src[in.c];
+            switch (in.op) {
+                case MULADD:
+                    simd_apply(n, d, a, b, c, [](SimdFloat p, SimdFloat q, SimdFloat s) { return simd_fmadd(p, q, s); });
+                    break;
+                case MULSUB:
+                    simd_apply(n, d, a, b, c, [](SimdFloat p, SimdFloat q, SimdFloat s) { return simd_fmsub(p, q, s); });
+                    break;
+                case NMULADD:
+                    simd_apply(n, d, a, b, c, [](SimdFloat p, SimdFloat q, SimdFloat s) { return simd_fnmadd(p, q, s); });
+                    break;
+                case ADD: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat q) { return p + q; }); break;
+                case SUB: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat q) { return p - q; }); break;
+                case MUL: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat q) { return p * q; }); break;
+                case DIV: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat q) { return p / q; }); break;
+                case NEG: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat) { return SimdFloat(0.0f) - p; }); break;
+                case SIN: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat) { return simd_sin(p); }); break;
+                case COS: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat) { return simd_cos(p); }); break;
+                case SQRT: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat) { return simd_sqrt(p); }); break;
+                case ABS: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat) { return simd_abs(p); }); break;
+                case MIN: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat q) { return simd_min(p, q); }); break;
+                case MAX: simd_apply(n, d, a, b, [](SimdFloat p, SimdFloat q) { return simd_max(p, q); }); break;
+                default:
+                    for (int i = 0; i < n; ++i) {
+                        d[i] = apply(in.op, a[i], b[i]);
+                    }
+                    break;
+            }
+        }
+    }
+};
+
+// Recursive descent parser building the expression graph. Nodes come after their
+// arguments, so the node list is already in evaluation order.
+struct MCExpressionParser {
+    typedef MCExpression::Op Op;
+
+    struct Node {
+        Op op;
+        float value;
+        int a, b;
+    };
+
+    const std::string& s;
+    size_t pos = 0;
+    std::string error;
+    std::vector<Node> nodes;
+
+    explicit MCExpressionParser(const std::string& source) : s(source) {}
+
+    int fail(const std::string& message) {
+        if (error.empty()) {
+            error = message + " at column " + std::to_string(pos + 1);
+        }
+        return -1;
+    }
+
+    // Adds a node, folding it when its arguments are constants and reusing an equal node
+    // when there is one
+    int node(Op op, int a = -1, int b = -1, float value = 0) {
+        if (a >= 0 && nodes[a].op == MCExpression::CONST && (b < 0 || nodes[b].op == MCExpression::CONST)) {
+            value = MCExpression::apply(op, nodes[a].value, b >= 0 ? nodes[b].value : 0);
+            op = MCExpression::CONST;
+            a = b = -1;
+        }
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i].op == op && nodes[i].a == a && nodes[i].b == b && nodes[i].value == value) {
+                return static_cast<int>(i);
+            }
+        }
+        nodes.push_back({ op, value, a, b });
+        return static_cast<int>(nodes.size()) - 1;
+    }
+
+    char peek() {
+        while (pos < s.size() && isspace(static_cast<unsigned char>(s[pos]))) {
+            ++pos;
+        }
+        return pos < s.size() ? s[pos] : '\0';
+    }
+
+    // base^n by repeated squaring
+    int integer_power(int base, int n) {
+        if (n < 0) {
+            return node(MCExpression::DIV, node(MCExpression::CONST, -1, -1, 1.0f), integer_power(base, -n));
+        }
+        if (n == 0) {
+            return node(MCExpression::CONST, -1, -1, 1.0f);
+        }
+        if (n == 1) {
+            return base;
+        }
+        int half = integer_power(base, n / 2);
+        int square = node(MCExpression::MUL, half, half);
+        return n % 2 ? node(MCExpression::MUL, square, base) : square;
+    }
+
+    int power(int base, int exponent) {
+        const Node& e = nodes[exponent];
+        if (e.op == MCExpression::CONST && e.value == std::floor(e.value) && std::fabs(e.value) <= 64) {
+            return integer_power(base, static_cast<int>(e.value));
+        }
+        if (e.op == MCExpression::CONST && e.value == 0.5f) {
+            return node(MCExpression::SQRT, base);
+        }
+        return node(MCExpression::POW, base, exponent);
+    }
+
+    int sum() {
+        int a = product();
+        while (a >= 0 && (peek() == '+' || peek() == '-')) {
+            Op op = s[pos++] == '+' ? MCExpression::ADD : MCExpression::SUB;
+            int b = product();
+            a = b < 0 ? -1 : node(op, a, b);
+        }
+        return a;
+    }
+
+    int product() {
+        int a = unary();
+        while (a >= 0 && (peek() == '*' || peek() == '/')) {
+            Op op = s[pos++] == '*' ? MCExpression::MUL : MCExpression::DIV;
+            int b = unary();
+            a = b < 0 ? -1 : node(op, a, b);
+        }
+        return a;
+    }
+
+    // -x^2 is -(x^2)
+    int unary() {
+        if (peek() == '-') {
+            ++pos;
+            int a = unary();
+            return a < 0 ? -1 : node(MCExpression::NEG, a);
+        }
+        if (peek() == '+') {
+            ++pos;
+            return unary();
+        }
+        int a = primary();
+        if (a >= 0 && peek() == '^') {
+            ++pos;
+            int b = unary();
+            return b < 0 ? -1 : power(a, b);
+        }
+        return a;
+    }
+
+    int primary() {
+        char c = peek();
+        if (c == '(') {
+            ++pos;
+            int a = sum();
+            if (a >= 0 && peek() != ')') {
+                return fail("expected ')'");
+            }
+            ++pos;
+            return a;
+        }
+        if (isdigit(static_cast<unsigned char>(c)) || c == '.') {
+            char* end;
+            float value = strtof(s.c_str() + pos, &end);
+            if (end == s.c_str() + pos) {
+                return fail("bad number");
+            }
+            pos = end - s.c_str();
+            return node(MCExpression::CONST, -1, -1, value);
+        }
+        if (!isalpha(static_cast<unsigned char>(c))) {
+            return fail(c ? std::string("unexpected '") + c + "'" : "unexpected end");
+        }
+
+        size_t start = pos;
+        while (pos < s.size() && (isalnum(static_cast<unsigned char>(s[pos])) || s[pos] == '_')) {
+            ++pos;
+        }
+        std::string name = s.substr(start, pos - start);
+        if (name == "x") return node(MCExpression::X);
+        if (name == "y") return node(MCExpression::Y);
+        if (name == "z") return node(MCExpression::Z);
+        if (name == "pi") return node(MCExpression::CONST, -1, -1, 3.14159265358979f);
+        if (name == "e") return node(MCExpression::CONST, -1, -1, 2.71828182845905f);
+
+        static const struct { const char* name; Op op; int arity; } functions[] = {
+            { "sin", MCExpression::SIN, 1 }, { "cos", MCExpression::COS, 1 }, { "tan", MCExpression::TAN, 1 },
+            { "sqrt", MCExpression::SQRT, 1 }, { "abs", MCExpression::ABS, 1 }, { "exp", MCExpression::EXP, 1 },
+            { "log", MCExpression::LOG, 1 }, { "min", MCExpression::MIN, 2 }, { "max", MCExpression::MAX, 2 },
+            { "pow", MCExpression::POW, 2 },
+        };
+        for (const auto& f : functions) {
+            if (name != f.name) {
+                continue;
+            }
+            if (peek() != '(') {
+                return fail("expected '(' after " + name);
+            }
+            ++pos;
+            int args[2] = { -1, -1 };
+            for (int i = 0; i < f.arity; ++i) {
+                if (i > 0 && peek() != ',') {
+                    return fail("expected ','");
+                }
+                pos += i > 0;
+                args[i] = sum();
+                if (args[i] < 0) {
+                    return -1;
+                }
+            }
+            if (peek() != ')') {
+                return fail("expected ')'");
+            }
+            ++pos;
+            return f.op == MCExpression::POW ? power(args[0], args[1]) : node(f.op, args[0], args[1]);
+        }
+        pos = start;
+        return fail("unknown name '" + name + "'");
+    }
+};
+
+inline bool MCExpression::compile(const std::string& source, std::string* error)
+{
+    MCExpressionParser parser(source);
+    int root = parser.sum();
+    if (root >= 0 && parser.peek() != '\0') {
+        root = parser.fail(std::string("unexpected '") + source[parser.pos] + "'");
+    }
+    if (root < 0) {
+        if (error) {
+            *error = parser.error;
+        }
+        return false;
+    }
+
+    // Count the uses of every node the result depends on, so the register of an
+    // intermediate value is freed after its last use
+    const std::vector<MCExpressionParser::Node>& nodes = parser.nodes;
+    std::vector<int> uses(nodes.size(), 0);
+    uses[root] = 1;
+    for (int i = root; i >= 0; --i) {
+        if (uses[i] > 0) {
+            if (nodes[i].a >= 0) uses[nodes[i].a]++;
+            if (nodes[i].b >= 0) uses[nodes[i].b]++;
+        }
+    }
+
+    // A product used only by a sum or difference is fused into it as a multiply-add, and
+    // gets no register of its own
+    std::vector<int> product(nodes.size(), -1);
+    std::vector<char> fused(nodes.size(), 0);
+    for (int i = 0; i <= root; ++i) {
+        const MCExpressionParser::Node& n = nodes[i];
+        if (uses[i] == 0 || (n.op != ADD && n.op != SUB)) {
+            continue;
+        }
+        for (int arg : { n.a, n.b }) {
+            if (nodes[arg].op == MUL && uses[arg] == 1 && !fused[arg]) {
+                fused[arg] = 1;
+                product[i] = arg;
+                break;
+            }
+        }
+    }
+
+    // x, y and z, then the constants, then intermediate values
+    std::vector<int> reg(nodes.size(), -1);
+    std::vector<float> newConstants;
+    for (int i = 0; i <= root; ++i) {
+        if (uses[i] > 0 && nodes[i].op <= Z) {
+            reg[i] = nodes[i].op;
+        } else if (uses[i] > 0 && nodes[i].op == CONST) {
+            newConstants.push_back(nodes[i].value);
+            reg[i] = 2 + static_cast<int>(newConstants.size());
+        }
+    }
+
+    std::vector<Instruction> newCode;
+    std::vector<int> free;
+    int count = 3 + static_cast<int>(newConstants.size());
+    for (int i = 0; i <= root; ++i) {
+        const MCExpressionParser::Node& n = nodes[i];
+        if (uses[i] == 0 || reg[i] >= 0 || fused[i]) {
+            continue;
+        }
+        Op op = n.op;
+        int args[3] = { n.a, n.b < 0 ? n.a : n.b, n.a };
+        int released[3] = { n.a, n.b, -1 };
+        if (product[i] >= 0) {
+            const MCExpressionParser::Node& m = nodes[product[i]];
+            int other = product[i] == n.a ? n.b : n.a;
+            op = n.op == ADD ? MULADD : product[i] == n.a ? MULSUB : NMULADD;
+            args[0] = released[0] = m.a;
+            args[1] = released[1] = m.b;
+            args[2] = released[2] = other;
+        }
+        Instruction in = { op, 0, static_cast<uint8_t>(reg[args[0]]), static_cast<uint8_t>(reg[args[1]]),
+                           static_cast<uint8_t>(reg[args[2]]) };
+        // the registers of arguments used for the last time can take the result, as every
+        // operation reads a sample before writing it
+        for (int arg : released) {
+            if (arg >= 0 && --uses[arg] == 0 && nodes[arg].op > CONST) {
+                free.push_back(reg[arg]);
+            }
+        }
+        if (!free.empty()) {
+            reg[i] = free.back();
+            free.pop_back();
+        } else {
+            reg[i] = count++;
+        }
+        in.dst = static_cast<uint8_t>(reg[i]);
+        newCode.push_back(in);
+    }
+    if (count > 256) {
+        if (error) {
+            *error = "expression too large";
+        }
+        return false;
+    }
+
+    text = source;
+    code = newCode;
+    constants = newConstants;
+    registers = count;
+    result = reg[root];
+    static std::atomic<uint64_t> compiled(0);
+    id = ++compiled;
+    return true;
+}
+
+#endif
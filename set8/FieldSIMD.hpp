@@ -0,0 +1,204 @@
+#ifndef FIELDSIMD_HPP
+#define FIELDSIMD_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// A small float vector type used to evaluate fields several samples at a time.
+// Uses AVX2 when the compiler targets it (-mavx2 -mfma or -march=native), SSE2 otherwise,
+// and a one lane fallback on other targets, so field kernels are written once.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+struct SimdFloat {
+    static const int width = 8;
+    __m256 v;
+
+    SimdFloat() {}
+    SimdFloat(__m256 v_) : v(v_) {}
+    SimdFloat(float s) : v(_mm256_set1_ps(s)) {}
+
+    static SimdFloat load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a.v, b.v); }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a.v, b.v); }
+inline SimdFloat simd_sqrt(SimdFloat a) { return _mm256_sqrt_ps(a.v); }
+inline SimdFloat simd_abs(SimdFloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline SimdFloat simd_min(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a.v, b.v); }
+inline SimdFloat simd_max(SimdFloat a, SimdFloat b) { return _mm256_max_ps(a.v, b.v); }
+
+typedef __m256i SimdQuadrant;
+
+#if defined(__FMA__)
+inline SimdFloat simd_fmadd(SimdFloat a, SimdFloat b, SimdFloat c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+inline SimdFloat simd_fmsub(SimdFloat a, SimdFloat b, SimdFloat c) { return _mm256_fmsub_ps(a.v, b.v, c.v); }
+inline SimdFloat simd_fnmadd(SimdFloat a, SimdFloat b, SimdFloat c) { return _mm256_fnmadd_ps(a.v, b.v, c.v); }
+#else
+inline SimdFloat simd_fmadd(SimdFloat a, SimdFloat b, SimdFloat c) { return a * b + c; }
+inline SimdFloat simd_fmsub(SimdFloat a, SimdFloat b, SimdFloat c) { return a * b - c; }
+inline SimdFloat simd_fnmadd(SimdFloat a, SimdFloat b, SimdFloat c) { return c - a * b; }
+#endif
+
+// Quadrant of x / (pi / 2) rounded to nearest, as an int per lane and as a float per lane
+inline SimdFloat simd_quadrant(SimdFloat x, SimdQuadrant& q) {
+    q = _mm256_cvtps_epi32(_mm256_mul_ps(x.v, _mm256_set1_ps(0.636619772f)));
+    return _mm256_cvtepi32_ps(q);
+}
+
+// Picks sin or cos of the reduced angle and its sign from the quadrant bits
+inline SimdFloat simd_select_quadrant(__m256i q, SimdFloat s, SimdFloat c) {
+    __m256i one = _mm256_set1_epi32(1);
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, one), one));
+    __m256 r = _mm256_blendv_ps(s.v, c.v, swap);
+    __m256 sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, _mm256_set1_epi32(2)), 30));
+    return _mm256_xor_ps(r, sign);
+}
+
+inline __m256i simd_add_quadrant(__m256i q, int n) { return _mm256_add_epi32(q, _mm256_set1_epi32(n)); }
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+struct SimdFloat {
+    static const int width = 4;
+    __m128 v;
+
+    SimdFloat() {}
+    SimdFloat(__m128 v_) : v(v_) {}
+    SimdFloat(float s) : v(_mm_set1_ps(s)) {}
+
+    static SimdFloat load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm_add_ps(a.v, b.v); }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a.v, b.v); }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a.v, b.v); }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm_div_ps(a.v, b.v); }
+inline SimdFloat simd_sqrt(SimdFloat a) { return _mm_sqrt_ps(a.v); }
+inline SimdFloat simd_abs(SimdFloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline SimdFloat simd_min(SimdFloat a, SimdFloat b) { return _mm_min_ps(a.v, b.v); }
+inline SimdFloat simd_max(SimdFloat a, SimdFloat b) { return _mm_max_ps(a.v, b.v); }
+
+typedef __m128i SimdQuadrant;
+inline SimdFloat simd_fmadd(SimdFloat a, SimdFloat b, SimdFloat c) { return a * b + c; }
+inline SimdFloat simd_fmsub(SimdFloat a, SimdFloat b, SimdFloat c) { return a * b - c; }
+inline SimdFloat simd_fnmadd(SimdFloat a, SimdFloat b, SimdFloat c) { return c - a * b; }
+
+inline SimdFloat simd_quadrant(SimdFloat x, SimdQuadrant& q) {
+    q = _mm_cvtps_epi32(_mm_mul_ps(x.v, _mm_set1_ps(0.636619772f)));
+    return _mm_cvtepi32_ps(q);
+}
+
+inline SimdFloat simd_select_quadrant(__m128i q, SimdFloat s, SimdFloat c) {
+    __m128i one = _mm_set1_epi32(1);
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+    __m128 r = _mm_or_ps(_mm_and_ps(swap, c.v), _mm_andnot_ps(swap, s.v));
+    __m128 sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30));
+    return _mm_xor_ps(r, sign);
+}
+
+inline __m128i simd_add_quadrant(__m128i q, int n) { return _mm_add_epi32(q, _mm_set1_epi32(n)); }
+
+#else
+
+struct SimdFloat {
+    static const int width = 1;
+    float v;
+
+    SimdFloat() {}
+    SimdFloat(float s) : v(s) {}
+
+    static SimdFloat load(const float* p) { return *p; }
+    void store(float* p) const { *p = v; }
+};
+
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return a.v + b.v; }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return a.v - b.v; }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return a.v * b.v; }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return a.v / b.v; }
+inline SimdFloat simd_sqrt(SimdFloat a) { return sqrtf(a.v); }
+inline SimdFloat simd_abs(SimdFloat a) { return fabsf(a.v); }
+inline SimdFloat simd_min(SimdFloat a, SimdFloat b) { return a.v < b.v ? a.v : b.v; }
+inline SimdFloat simd_max(SimdFloat a, SimdFloat b) { return a.v > b.v ? a.v : b.v; }
+inline SimdFloat simd_fmadd(SimdFloat a, SimdFloat b, SimdFloat c) { return a.v * b.v + c.v; }
+inline SimdFloat simd_fmsub(SimdFloat a, SimdFloat b, SimdFloat c) { return a.v * b.v - c.v; }
+inline SimdFloat simd_fnmadd(SimdFloat a, SimdFloat b, SimdFloat c) { return c.v - a.v * b.v; }
+
+inline SimdFloat simd_sin(SimdFloat x) { return sinf(x.v); }
+inline SimdFloat simd_cos(SimdFloat x) { return cosf(x.v); }
+
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+// sin and cos of the angle r in [-pi/4, pi/4] (Cephes single precision polynomials)
+inline SimdFloat simd_sin_reduced(SimdFloat r) {
+    SimdFloat r2 = r * r;
+    SimdFloat p = simd_fmadd(r2, SimdFloat(-1.9515295891e-4f), SimdFloat(8.3321608736e-3f));
+    p = simd_fmadd(p, r2, SimdFloat(-1.6666654611e-1f));
+    return simd_fmadd(p * r2, r, r);
+}
+
+inline SimdFloat simd_cos_reduced(SimdFloat r) {
+    SimdFloat r2 = r * r;
+    SimdFloat p = simd_fmadd(r2, SimdFloat(2.443315711809948e-5f), SimdFloat(-1.388731625493765e-3f));
+    p = simd_fmadd(p, r2, SimdFloat(4.166664568298827e-2f));
+    p = simd_fmadd(p, r2 * r2, SimdFloat(1.0f) - SimdFloat(0.5f) * r2);
+    return p;
+}
+
+// Reduces x by the nearest multiple of pi/2 in three parts (Cody-Waite), which keeps
+// the result within a few ulp of libm for the |x| < 8192 the fields produce.
+inline SimdFloat simd_reduce(SimdFloat x, SimdQuadrant& q) {
+    SimdFloat j = simd_quadrant(x, q);
+    SimdFloat r = simd_fmadd(j, SimdFloat(-1.5703125f), x);
+    r = simd_fmadd(j, SimdFloat(-4.837512969970703125e-4f), r);
+    return simd_fmadd(j, SimdFloat(-7.549789948768648e-8f), r);
+}
+
+inline SimdFloat simd_sin(SimdFloat x) {
+    SimdQuadrant q;
+    SimdFloat r = simd_reduce(x, q);
+    return simd_select_quadrant(q, simd_sin_reduced(r), simd_cos_reduced(r));
+}
+
+// cos(x) = sin(x + pi/2), which is one quadrant further on
+inline SimdFloat simd_cos(SimdFloat x) {
+    SimdQuadrant q;
+    SimdFloat r = simd_reduce(x, q);
+    return simd_select_quadrant(simd_add_quadrant(q, 1), simd_sin_reduced(r), simd_cos_reduced(r));
+}
+
+#endif
+
+// Evaluates a field over count SoA samples, width lanes at a time with kernel. The tail is
+// padded to a full batch rather than handed to the field's scalar operator(), so a sample
+// gets the same value however the rows it lies on are split, which keeps the bricks of
+// MCBrickMesher from disagreeing on the points they share.
+template <typename Kernel>
+void simd_eval_row(Kernel kernel, const float* x, const float* y, const float* z, float* out, int count) {
+    int i = 0;
+    for (; i + SimdFloat::width <= count; i += SimdFloat::width) {
+        kernel(SimdFloat::load(x + i), SimdFloat::load(y + i), SimdFloat::load(z + i)).store(out + i);
+    }
+    if (i < count) {
+        alignas(64) float tail[4][SimdFloat::width];
+        for (int l = 0; l < SimdFloat::width; ++l) {
+            int from = std::min(i + l, count - 1);
+            tail[0][l] = x[from];
+            tail[1][l] = y[from];
+            tail[2][l] = z[from];
+        }
+        kernel(SimdFloat::load(tail[0]), SimdFloat::load(tail[1]), SimdFloat::load(tail[2])).store(tail[3]);
+        std::copy(tail[3], tail[3] + (count - i), out + i);
+    }
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef INTERVAL_HPP
+#define INTERVAL_HPP
+
+#include <algorithm>
+#include <cmath>
+
+// Closed interval [lo, hi] used to bound a field over a box of space. Every operation
+// returns an interval that contains all the values the operation can take on its inputs.
+struct Interval {
+    float lo;
+    float hi;
+
+    Interval() : lo(0), hi(0) {}
+    Interval(float v) : lo(v), hi(v) {}
+    Interval(float lo_, float hi_) : lo(lo_), hi(hi_) {}
+
+    bool contains(float v) const { return lo <= v && v <= hi; }
+};
+
+inline Interval operator+(Interval a, Interval b) { return Interval(a.lo + b.lo, a.hi + b.hi); }
+inline Interval operator-(Interval a, Interval b) { return Interval(a.lo - b.hi, a.hi - b.lo); }
+inline Interval operator-(Interval a) { return Interval(-a.hi, -a.lo); }
+
+inline Interval operator*(Interval a, Interval b) {
+    float p[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+    return Interval(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+}
+
+// Tighter than a * a, which cannot see that both factors are the same number
+inline Interval sqr(Interval a) {
+    float l = a.lo * a.lo, h = a.hi * a.hi;
+    if (a.lo >= 0) return Interval(l, h);
+    if (a.hi <= 0) return Interval(h, l);
+    return Interval(0, std::max(l, h));
+}
+
+inline Interval intersect(Interval a, Interval b) {
+    return Interval(std::max(a.lo, b.lo), std::min(a.hi, b.hi));
+}
+
+// sin over [lo, hi], widened to 1 or -1 where the interval holds a crest or a trough
+inline Interval sin(Interval a) {
+    const float pi = 3.14159265358979f;
+    if (a.hi - a.lo >= 2 * pi) {
+        return Interval(-1, 1);
+    }
+    float s0 = std::sin(a.lo), s1 = std::sin(a.hi);
+    Interval r(std::min(s0, s1), std::max(s0, s1));
+    // first crest (pi/2 + 2 pi n) and trough (3 pi/2 + 2 pi n) at or after lo
+    float crest = pi / 2 + 2 * pi * std::ceil((a.lo - pi / 2) / (2 * pi));
+    float trough = 3 * pi / 2 + 2 * pi * std::ceil((a.lo - 3 * pi / 2) / (2 * pi));
+    if (crest <= a.hi) r.hi = 1;
+    if (trough <= a.hi) r.lo = -1;
+    return r;
+}
+
+inline Interval cos(Interval a) {
+    const float halfPi = 1.57079632679f;
+    return sin(a + Interval(halfPi));
+}
+
+#endif
@@ -10,8 +10,11 @@
 GLFWwindow* window;
 
 #include <iostream>
+#include <string>
 #include <vector>
 
+#include "Expression.hpp"
+
 #define TOP_LEFT     8
 #define TOP_RIGHT    4
 #define BOTTOM_RIGHT 2
@@ -74,23 +77,62 @@ float f3(float x, float y) {
 }
 
 
-std::vector<float> marching_squares(scalar_field_2d f, float isoval, float minx, float maxx, float miny, float maxy, float stepsize) {
+// Coordinates of the samples of a row for eval_row, x stepping from minx in the plane
+// z = 0. Made once by marching_squares; only ys changes from row to row.
+struct MSRow {
+	std::vector<float> xs, ys, zs;
+
+	MSRow(float minx, float stepsize, int count) : xs(count), ys(count), zs(count, 0.0f) {
+		float x = minx;
+		for (int i = 0; i < count; ++i, x += stepsize) {
+			xs[i] = x;
+		}
+	}
+};
+
+// Samples f at the points of row at y
+template <typename Field2D>
+void ms_sample_row(const Field2D& f, MSRow& row, float y, float* out) {
+	for (size_t i = 0; i < row.xs.size(); ++i) {
+		out[i] = f(row.xs[i], y);
+	}
+}
+
+// Expressions are evaluated a whole row at a time
+void ms_sample_row(const MCExpression& f, MSRow& row, float y, float* out) {
+	std::fill(row.ys.begin(), row.ys.end(), y);
+	f.eval_row(row.xs.data(), row.ys.data(), row.zs.data(), out, static_cast<int>(row.xs.size()));
+}
+
+// f is a function of (x, y) or an MCExpression. Each row of samples is shared by the
+// squares above and below it, so every point is evaluated once.
+template <typename Field2D>
+std::vector<float> marching_squares(const Field2D& f, float isoval, float minx, float maxx, float miny, float maxy, float stepsize) {
 
 	std::vector<float> vertices;
 
+	int columns = 1;
+	for (float x = minx; x < maxx; x += stepsize) {
+		columns++;
+	}
+	std::vector<float> below(columns), above(columns);
+	MSRow row(minx, stepsize, columns);
+
 	float x = minx;
 	float y = miny;
 	float tl, tr, br, bl;
 	int which = 0;
 	int* verts;
+	ms_sample_row(f, row, y, below.data());
 	for ( ; y < maxy; y += stepsize) {
-		for (x = minx ; x < maxx; x += stepsize) {
+		ms_sample_row(f, row, y+stepsize, above.data());
+		x = minx;
+		for (int i = 0; i + 1 < columns; ++i, x += stepsize) {
 			//test the square
-			tl = (*f)(x, y+stepsize);
-			tr = (*f)(x+stepsize, y+stepsize);
-			br = (*f)(x+stepsize, y);
-			bl = (*f)(x, y);
-			printf("%f %f %f %f", tl, tr, br, bl);
+			tl = above[i];
+			tr = above[i+1];
+			br = below[i+1];
+			bl = below[i];
 
 			which = 0;
 			if (tl < isoval) {
@@ -122,6 +164,7 @@ std::vector<float> marching_squares(scalar_field_2d f, float isoval, float minx,
 				vertices.emplace_back(y+stepsize*g_verts[verts[3]][1]);
 			}
 		} 
+		std::swap(below, above);
 	}
 
 	return vertices;
@@ -224,6 +267,15 @@ int main( int argc, char* argv[])
 	if (argc > 6) {
 		isoval = atof(argv[6]);
 	}
+	// an expression of x and y to draw instead of f1
+	MCExpression expression;
+	if (argc > 7) {
+		std::string error;
+		if (!expression.compile(argv[7], &error)) {
+			fprintf(stderr, "%s: %s\n", argv[7], error.c_str());
+			return -1;
+		}
+	}
 	float ymin = xmin;
 	float ymax = xmax;
 	///////////////////////////////////////////////////////
@@ -273,7 +325,8 @@ int main( int argc, char* argv[])
 	glLoadIdentity();
 	glOrtho(xmin, xmax, ymin, ymax, -1, 1);
 
-	std::vector<float> marchingVerts1 = marching_squares(f1, isoval, xmin, xmax, ymin, ymax, stepsize);
+	std::vector<float> marchingVerts1 = argc > 7 ? marching_squares(expression, isoval, xmin, xmax, ymin, ymax, stepsize)
+	                                             : marching_squares(f1, isoval, xmin, xmax, ymin, ymax, stepsize);
 	std::vector<float> marchingVerts2 = marching_squares(f2, isoval, xmin, xmax, ymin, ymax, stepsize);
 	std::vector<float> marchingVerts3 = marching_squares(f3, isoval, xmin, xmax, ymin, ymax, stepsize);
 	printf("%ld %ld %ld\n", marchingVerts1.size(), marchingVerts2.size(), marchingVerts3.size());